@@ -0,0 +1,141 @@
+//
+// Copyright 2015 KISS Technologies GmbH, Switzerland
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Component: UTIL
+//
+// A pool of buffers in power of two size classes.  istreambuf and
+// ostreambuf (and hence connections and sysloggers) take their buffers
+// from it, so that connection churn doesn't go through the allocator.
+//
+// Usage:
+//   // Takes a buffer of the 1024 bytes size class
+//   nanonet::util::pooled_buffer b(1000);
+//   std::memcpy(b.data(), ..., b.size());
+//   // Returned to the pool on destruction
+//
+// Notes:
+// * Thread safe.  Each thread keeps a cache of free buffers per size
+//   class, up to LOCAL_CACHE_BYTES.  Beyond that and on thread exit,
+//   buffers go to a global pool, up to GLOBAL_POOL_BYTES per size
+//   class, and are freed beyond that.
+// * Buffers larger than MAX_POOLED_SIZE are allocated and freed
+//   directly.
+// * Memory in the pool is only returned to the system by
+//   buffer_pool_trim().
+//
+
+#ifndef NANONET_BUFFER_POOL_H
+#define NANONET_BUFFER_POOL_H
+
+#include <utility>
+
+
+namespace nanonet {
+
+namespace detail_ {
+
+/// @return A buffer of at least size bytes
+char* buffer_pool_allocate(long size);
+
+/// Returns p, obtained from buffer_pool_allocate(size)
+void buffer_pool_release(char* p, long size);
+
+} // namespace detail_
+
+namespace util {
+
+/// Smallest and largest size class [bytes]
+constexpr long MIN_POOLED_SIZE = 64;
+constexpr long MAX_POOLED_SIZE = 1L << 20;
+
+/// Limits of free memory per size class [bytes] in each thread's cache
+/// and in the global pool
+constexpr long LOCAL_CACHE_BYTES = 1L << 18;
+constexpr long GLOBAL_POOL_BYTES = 1L << 22;
+
+struct buffer_pool_statistics {
+  /// Buffers taken from the pool
+  long long hits = 0;
+  /// Buffers allocated from the system
+  long long misses = 0;
+  /// Free memory held in the pool [bytes]
+  long long bytes_held = 0;
+
+  /// @return hits / (hits + misses), 0 if there were no allocations
+  double hit_rate() const {
+    return hits + misses > 0 ? static_cast<double>(hits) / (hits + misses)
+                             : 0;
+  }
+};
+
+/// @return Statistics since program start, for all threads
+buffer_pool_statistics buffer_pool_stats();
+
+/// Frees the free buffers in the global pool and in the calling
+/// thread's cache.
+void buffer_pool_trim();
+
+/// A buffer of fixed size from the pool, moveable but not copyable.
+/// The contents are not initialized.
+struct pooled_buffer {
+  /// An empty buffer
+  pooled_buffer() = default;
+
+  explicit pooled_buffer(long const size)
+  : data_(size > 0 ? nanonet::detail_::buffer_pool_allocate(size) : nullptr),
+    size_(size > 0 ? size : 0) {}
+
+  pooled_buffer(pooled_buffer&& other) noexcept
+  : data_(std::exchange(other.data_, nullptr)),
+    size_(std::exchange(other.size_, 0)) {}
+
+  pooled_buffer& operator=(pooled_buffer&& other) noexcept {
+    swap(other);
+    return *this;
+  }
+
+  pooled_buffer(pooled_buffer const&) = delete;
+  pooled_buffer& operator=(pooled_buffer const&) = delete;
+
+  ~pooled_buffer() {
+    if (data_) {
+      nanonet::detail_::buffer_pool_release(data_, size_);
+    }
+  }
+
+  void swap(pooled_buffer& other) noexcept {
+    std::swap(data_, other.data_);
+    std::swap(size_, other.size_);
+  }
+
+  char      * data()       { return data_; }
+  char const* data() const { return data_; }
+
+  long size() const { return size_; }
+  bool empty() const { return 0 == size_; }
+
+  char      & operator[](long const i)       { return data_[i]; }
+  char const& operator[](long const i) const { return data_[i]; }
+
+private:
+  char* data_ = nullptr;
+  long size_ = 0;
+};
+
+} // namespace util
+
+} // namespace nanonet
+
+#endif // NANONET_BUFFER_POOL_H
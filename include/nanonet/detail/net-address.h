@@ -26,23 +26,32 @@
 #include "nanonet/detail/socket_lowlevel.h"
 
 #include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <cstddef>
+#include <cstring>
 
 
 namespace nanonet {
 
 namespace detail_ {
 
-// Returns AF_INET, AF_INET6 or AF_UNSPEC or throws in case of invalid value
+// Returns AF_INET, AF_INET6, AF_UNIX or AF_UNSPEC or throws in case of
+// invalid value
 int int_address_family( nanonet::util::network::address_family_type ) ;
 
-// Returns ipv4, ipv6 or ip_unspec (on input AF_INET, AF_INET6, ...) or throws
-// in case of invalid value
+// Returns ipv4, ipv6, unix_domain or ip_unspec (on input AF_INET,
+// AF_INET6, ...) or throws in case of invalid value
 nanonet::util::network::address_family_type from_int_address_family( int ) ;
 
 
 /// A safety wrapper around struct sockaddr_storage, templatized on
 /// SOCK_DGRAM/SOCK_STREAM.
-/// TODO: Support UNIX domain sockets!  .... How to implement host/port then?
+/// For Unix domain sockets, host() is the path (with a leading '@' in
+/// the abstract namespace, empty for unnamed sockets) and port() is
+/// empty.
 template< int type >
 struct address {
 
@@ -52,8 +61,14 @@ struct address {
     sockaddr_pointer()->sa_family = AF_INET;
   }
 
+  // Copies only addrlen bytes, the argument may point to a smaller
+  // struct (e.g. sockaddr_in from getaddrinfo()).
   address( sockaddr_storage const& addr , socklen_t addrlen )
-  : addr( addr ) , addrlen( addrlen ) {}
+  : addrlen( addrlen ) {
+    always_assert( addrlen <= maxlength() ) ;
+    std::memset( &this->addr , 0 , sizeof( this->addr ) ) ;
+    std::memcpy( &this->addr , &addr , addrlen ) ;
+  }
 
   // Numeric form.
   std::string const host() const ;
@@ -67,7 +82,7 @@ struct address {
 
   bool dgram() const { return SOCK_DGRAM == type ; }
 
-  // Returns the address family type (ipv4 or ipv6)
+  // Returns the address family type (ipv4, ipv6 or unix_domain)
   nanonet::util::network::address_family_type family() const {
     return nanonet::detail_::from_int_address_family( family_detail_() ) ;
   }
@@ -96,6 +111,9 @@ struct address {
   sockaddr_in6 const& as_sockaddr_in6() const
   { return *reinterpret_cast< sockaddr_in6 const* >( &addr ) ; }
 
+  sockaddr_un  const& as_sockaddr_un () const
+  { return *reinterpret_cast< sockaddr_un  const* >( &addr ) ; }
+
   socklen_t const* socklen_pointer() const { return &addrlen ; }
   socklen_t      * socklen_pointer()       { return &addrlen ; }
 
@@ -117,7 +135,12 @@ bool operator!=( address< type > const& a1 , address< type > const& a2 ) {
     return true;
   }
 
-  if( AF_INET == a1.family_detail_() ) {
+  if( AF_UNIX == a1.family_detail_() ) {
+    return    a1.length() != a2.length()
+        ||    0 != std::memcmp( a1.sockaddr_pointer() , a2.sockaddr_pointer() ,
+                                a1.length() )
+    ;
+  } else if( AF_INET == a1.family_detail_() ) {
     return    a1.as_sockaddr_in().sin_port
            != a2.as_sockaddr_in().sin_port
         ||    a1.as_sockaddr_in().sin_addr.s_addr
@@ -140,8 +163,13 @@ bool operator==( address< type > const& a1 , address< type > const& a2 ) {
 // String conversion, writing the numeric address and port.
 // IPv6 addresses are surrounded by square brackets as per
 // http://en.wikipedia.org/wiki/IPv6_address
+// Unix domain addresses are written as services, e.g. unix:/run/app.sock
 template <int type>
 std::string to_string(const address<type>& a) {
+  if( AF_UNIX == a.family_detail_() ) {
+    return nanonet::util::network::UNIX_SERVICE_PREFIX + a.host() ;
+  }
+
   std::string ret;
   if( AF_INET6 == a.family_detail_() ) {
     ret += '[';
@@ -162,7 +190,14 @@ std::ostream& operator<<( std::ostream& os , address< type > const& a ) {
   return os;
 }
 
+// Returns the Unix domain address for the given path, or name in the
+// abstract namespace if it starts with '@'.  Throws if it's too long.
+template< int type >
+address< type > unix_address( std::string const& path ) ;
+
 // Resolve implementations, see resolve_stream(), resolve_datagram()
+// A service with UNIX_SERVICE_PREFIX resolves to the Unix domain address
+// following the prefix, ignoring n and family_hint.
 template< int type >
 std::vector< address< type > >
 my_getaddrinfo( char const* n , char const* s , 
@@ -243,6 +278,42 @@ inline const char* notnull( const char* const s ) {
   return s ? s : "(null)";
 }
 
+template< int type >
+nanonet::detail_::address< type >
+nanonet::detail_::unix_address( std::string const& path ) {
+
+  sockaddr_un un ;
+  std::memset( &un , 0 , sizeof( un ) ) ;
+  un.sun_family = AF_UNIX ;
+
+  std::string name = path ;
+  bool const abstract = !name.empty() && '@' == name[ 0 ] ;
+#if (BOOST_OS_LINUX)
+  // Abstract names start with a NUL character and aren't terminated
+  if( abstract ) { name[ 0 ] = '\0' ; }
+#else
+  if( abstract ) {
+    throw std::runtime_error( 
+        "abstract Unix domain socket names are only supported on Linux: " 
+      + path ) ;
+  }
+#endif
+
+  if( name.empty() || name.size() >= sizeof( un.sun_path ) ) {
+    throw std::runtime_error( 
+        "invalid Unix domain socket path: '" + path + "'" ) ;
+  }
+  std::memcpy( un.sun_path , name.data() , name.size() ) ;
+
+  socklen_t const length = 
+      offsetof( sockaddr_un , sun_path ) + name.size() + ( abstract ? 0 : 1 ) ;
+
+  sockaddr_storage storage ;
+  std::memcpy( &storage , &un , sizeof( un ) ) ;
+  return address< type >( storage , length ) ;
+
+}
+
 template< int type >
 std::vector< nanonet::detail_::address< type > >
 nanonet::detail_::my_getaddrinfo(
@@ -255,6 +326,11 @@ nanonet::detail_::my_getaddrinfo(
 
   always_assert( SOCK_DGRAM == type || SOCK_STREAM == type ) ;
   always_assert( n || s ) ;
+
+  if( s && nanonet::util::network::is_unix_service( s ) ) {
+    return { nanonet::detail_::unix_address< type >( 
+        s + std::strlen( nanonet::util::network::UNIX_SERVICE_PREFIX ) ) } ;
+  }
   int const flags = n ? 0 : AI_PASSIVE ;
 
   addrinfo* res = 0 ;
@@ -416,6 +492,21 @@ template< int type >
 std::string const
 nanonet::detail_::address< type >::host() const {
 
+  if( AF_UNIX == family_detail_() ) {
+    long const n = 
+        static_cast< long >( length() ) - offsetof( sockaddr_un , sun_path ) ;
+    char const* const p = as_sockaddr_un().sun_path ;
+    if( n <= 0 ) {
+      return "" ;
+    } else if( '\0' == p[ 0 ] ) {
+      std::string ret( 1 , '@' ) ;
+      ret.append( p + 1 , n - 1 ) ;
+      return ret ;
+    } else {
+      return std::string( p , ::strnlen( p , n ) ) ;
+    }
+  }
+
   nanonet::detail_::check_family( family_detail_() ) ;
 
   return nanonet::detail_::my_getnameinfo< type >( *this , true , true , false ) ;
@@ -426,6 +517,10 @@ template< int type >
 std::string const
 nanonet::detail_::address< type >::port() const {
 
+  if( AF_UNIX == family_detail_() ) {
+    return "" ;
+  }
+
   return nanonet::detail_::my_getnameinfo< type >( *this , false , true , false ) ;
 
 }
@@ -20,6 +20,9 @@
 
 #include "nanonet/detail/platform_wrappers.h"
 
+#include <iterator>
+#include <type_traits>
+
 
 namespace nanonet {
 
@@ -34,6 +37,14 @@ socketfd_t my_accept( socketfd_t const fd );
 /// and no connection comes in within timeout [s].
 socketfd_t my_accept(const socketfd_t fd, double timeout);
 
+/// Accepts a connection on fd, storing the peer address in a/len if
+/// non-null.  The returned socket is close-on-exec and non-blocking iff
+/// nonblocking is true.  Uses accept4() where available.
+/// @return The connected socket or invalid_socket() if fd is
+/// non-blocking and there's no connection pending.
+socketfd_t my_accept4(socketfd_t fd, sockaddr* a, socklen_t* len,
+                      bool nonblocking);
+
 /// Connects fd to the given address
 void my_connect(socketfd_t fd , const sockaddr* a, socklen_t len);
 
@@ -41,9 +52,30 @@ void my_connect(socketfd_t fd , const sockaddr* a, socklen_t len);
 /// and no connection can be establiehed in within timeout [s].
 void my_connect(socketfd_t fd , const sockaddr* a, socklen_t len, double timeout);
 
+/// Waits until fd is readable for at most timeout [s], or indefinitely
+/// if timeout < 0.  Uses poll(), so fd may be >= FD_SETSIZE.
+/// @return false on timeout
+bool wait_readable(socketfd_t fd, double timeout);
+
 long my_send(socketfd_t const fd , char const* p , long n );
 long my_sendto(socketfd_t const fd , const sockaddr* a, socklen_t len, char const* p, long n);
 
+/// Iterators into contiguous memory of bytes (char, unsigned char,
+/// std::byte), e.g. char*, std::span<char>::iterator or
+/// std::vector<char>::iterator.  Datagram sockets send and receive
+/// directly from/to such ranges.
+template <typename It>
+concept contiguous_byte_iterator =
+    std::contiguous_iterator<It>
+    && sizeof(std::iter_value_t<It>) == 1
+    && std::is_trivially_copyable_v<std::iter_value_t<It>>;
+
+/// As above, and the bytes are writable
+template <typename It>
+concept contiguous_mutable_byte_iterator =
+    contiguous_byte_iterator<It>
+    && !std::is_const_v<std::remove_reference_t<std::iter_reference_t<It>>>;
+
 } // detail_
 
 } // nanonet
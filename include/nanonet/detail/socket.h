@@ -23,6 +23,8 @@
 #include "nanonet/detail/platform_wrappers.h"
 #include "nanonet/detail/socket_lowlevel.h"
 
+#include <chrono>
+
 namespace nanonet {
 
 namespace detail_ {
@@ -51,7 +53,7 @@ auto_socket_resource ;
 /// Checks socket type (SOCK_DGRAM or SOCK_STREAM) and returns it
 int check_socktype( int const type ) ;
 
-/// Checks address family type (AF_INET6 or AF_INET) and returns it
+/// Checks address family type (AF_INET6, AF_INET or AF_UNIX) and returns it
 int check_family( int const family ) ;
 
 // A socket template with some intelligence, e.g. it checks
@@ -96,6 +98,33 @@ template< int type > struct socket {
   long read ( char      * buf , long n ) ;
   long write( char const* buf , long n ) ;
 
+  // Scatter read: Reads into buf1, and into buf2 once buf1 is full,
+  // using a single system call.  Returns the total number of bytes read,
+  // 0 on EOF or -1.
+  long read( char* buf1 , long n1 , char* buf2 , long n2 ) ;
+
+  // Gather write: Sends n1 bytes from buf1, then n2 bytes from buf2
+  // using a single system call if possible.  Either n may be zero.
+  // Returns n1 + n2 or -1.
+  long write( char const* buf1 , long n1 , char const* buf2 , long n2 ) ;
+
+  // Statistics: Bytes read and written so far and time of the first
+  // successful write (only valid if bytes_written() > 0).
+  long long bytes_read   () const { return bytes_read_    ; }
+  long long bytes_written() const { return bytes_written_ ; }
+  std::chrono::steady_clock::time_point first_write() const
+  { return first_write_ ; }
+
+  // Enables/disables kernel receive timestamps for read()
+  void receive_timestamps( bool const enable ) {
+    nanonet::detail_::receive_timestamps( fd() , enable ) ;
+    timestamps_ = enable ;
+  }
+
+  // Kernel receive time of the data returned by the last read() [s]
+  // like nanonet::util::utc(), 0 if not enabled or unavailable.
+  double receive_time() const { return receive_time_ ; }
+
   // No-ops for DGRAM sockets
   void shutdown_read () 
   { if ( SOCK_STREAM == type ) { socket_shutdown_read ( fd() ) ; } }
@@ -107,6 +136,13 @@ private:
   // This wrapper around the handle takes care of move semantics.
   auto_socket_resource fd_ ;
 
+  long long bytes_read_    = 0 ;
+  long long bytes_written_ = 0 ;
+  std::chrono::steady_clock::time_point first_write_ ;
+
+  bool timestamps_ = false ;
+  double receive_time_ = 0 ;
+
 } ;
 
 typedef socket< SOCK_DGRAM  > datagram_socket_reader_writer ;
@@ -125,6 +161,10 @@ template< int type >
 long nanonet::detail_::socket< type >::read
 ( char      * const buf , long const n ) {
 
+  if( timestamps_ ) {
+    return read( buf , n , nullptr , 0 ) ;
+  }
+
   long ret ;
   do { ret = ::recv( fd() , buf , n , 0 ) ; }
   while( EINTR_repeat( ret ) ) ;
@@ -132,26 +172,92 @@ long nanonet::detail_::socket< type >::read
   assert( -1 <= ret      ) ;
   assert(       ret <= n ) ;
 
+  if( ret > 0 ) { bytes_read_ += ret ; }
+
   return ret ;
 
 }
 
 template< int type >
-long nanonet::detail_::socket< type >::write
-( char const* const buf , long const n ) {
+long nanonet::detail_::socket< type >::read( 
+    char* const buf1 , long const n1 , char* const buf2 , long const n2 ) {
+
+  ::iovec iov[ 2 ] = {
+    { buf1 , static_cast< std::size_t >( n1 ) } ,
+    { buf2 , static_cast< std::size_t >( n2 ) }
+  } ;
+  alignas( ::cmsghdr ) char control[ TIMESTAMP_CONTROL_SIZE ] ;
+  ::msghdr msg{} ;
+  msg.msg_iov    = iov ;
+  msg.msg_iovlen = 0 == n2 ? 1 : 2 ;
+  if( timestamps_ ) {
+    msg.msg_control    = control ;
+    msg.msg_controllen = sizeof( control ) ;
+  }
 
   long ret ;
-
-  // TODO: Handle partial send
-  do { ret = nanonet::detail_::socketsend( fd() , buf , n ) ; }
+  do { ret = ::recvmsg( fd() , &msg , 0 ) ; }
   while( EINTR_repeat( ret ) ) ;
 
-  if( ret < 0 || n != ret )
-  { return -1 ; }
+  assert( -1 <= ret           ) ;
+  assert(       ret <= n1 + n2 ) ;
+
+  if( ret > 0 ) { 
+    bytes_read_ += ret ; 
+    if( timestamps_ ) { receive_time_ = receive_timestamp( msg ) ; }
+  }
 
-  assert( n == ret ) ;
   return ret ;
 
 }
 
+template< int type >
+long nanonet::detail_::socket< type >::write
+( char const* const buf , long const n ) {
+  return write( buf , n , nullptr , 0 ) ;
+}
+
+template< int type >
+long nanonet::detail_::socket< type >::write( 
+    char const* const buf1 , long const n1 , 
+    char const* const buf2 , long const n2 ) {
+
+  ::iovec iov[ 2 ] = {
+    { const_cast< char* >( buf1 ) , static_cast< std::size_t >( n1 ) } ,
+    { const_cast< char* >( buf2 ) , static_cast< std::size_t >( n2 ) }
+  } ;
+
+  // Skip empty buffers, retry on partial send
+  long total = 0 ;
+  int i = 0 ;
+  advance_iovec( iov , i , 2 , 0 ) ;
+  while( i < 2 ) {
+    long ret ;
+    if( 1 == i || 0 == iov[ 1 ].iov_len ) {
+      do { 
+        ret = nanonet::detail_::socketsend( 
+            fd() , static_cast< char const* >( iov[ i ].iov_base ) , 
+            iov[ i ].iov_len ) ; 
+      } while( EINTR_repeat( ret ) ) ;
+    } else {
+      do { ret = nanonet::detail_::socketsendv( fd() , iov , 2 ) ; }
+      while( EINTR_repeat( ret ) ) ;
+    }
+
+    if( ret <= 0 )
+    { return -1 ; }
+
+    if( 0 == bytes_written_ ) 
+    { first_write_ = std::chrono::steady_clock::now() ; }
+    bytes_written_ += ret ;
+    total          += ret ;
+
+    advance_iovec( iov , i , 2 , ret ) ;
+  }
+
+  assert( n1 + n2 == total ) ;
+  return total ;
+
+}
+
 #endif // NANONET_DETAIL_SOCKET_H
@@ -61,9 +61,30 @@ void bool_fcntl_option(
 /// TODO: Other systems.
 int socketsend( socketfd_t fd , char const* data , std::size_t size ) ;
 
+/// Like socketsend(), but gathers the data from iovcnt buffers (writev()
+/// semantics).
+long socketsendv( socketfd_t fd , ::iovec const* iov , int iovcnt ) ;
+
+/// Like socketsend(), but never blocks, even on a blocking socket
+/// (MSG_DONTWAIT).
+int socketsend_nonblocking(
+    socketfd_t fd , char const* data , std::size_t size ) ;
+
 /// Platform dependent setup for stream sockets to guard against SIGPIPE
 void setup_stream_socket( socketfd_t fd ) ;
 
+/// Enables/disables kernel receive timestamps: SO_TIMESTAMPNS on Linux,
+/// SO_TIMESTAMP (microseconds) elsewhere.
+void receive_timestamps( socketfd_t fd , bool enable ) ;
+
+/// Space for a receive timestamp control message in msghdr::msg_control
+constexpr std::size_t TIMESTAMP_CONTROL_SIZE = CMSG_SPACE( sizeof( ::timespec ) ) ;
+
+/// Returns the receive timestamp from msg's control messages [s] since
+/// 1970-01-01 00:00 UTC, like nanonet::util::utc(), or 0 if there is
+/// none.
+double receive_timestamp( ::msghdr const& msg ) ;
+
 } // detail_
 
 } // nanonet
@@ -0,0 +1,154 @@
+//
+// Copyright 2015 KISS Technologies GmbH, Switzerland
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Component: MATH
+//
+// Log-linear (HDR style) histograms for latencies, and lock-free
+// sharded histograms and counters for recording from many threads.
+//
+// Usage:
+//   nanonet::math::sharded_histogram h;
+//   // In any thread:
+//   h.record(0.0012);
+//   // In any thread, merges all shards:
+//   const nanonet::math::histogram s = h.snapshot();
+//   std::cout << s.quantile(0.99) << std::endl;
+//
+// Notes:
+// * Values are in seconds.  They are recorded in microseconds with a
+//   relative error of at most 1/16 up to 2^40us (about 12 days),
+//   larger values end up in the last bucket.
+// * Threads are assigned to shards round robin.  Recording is one
+//   relaxed atomic increment each on the shard's bucket and sum, so
+//   there's no contention unless more than SHARDS threads record.
+// * Snapshots are not atomic, concurrent recordings may be missing
+//   from them.
+//
+
+
+#ifndef NANONET_HISTOGRAM_H
+#define NANONET_HISTOGRAM_H
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+
+
+namespace nanonet {
+
+namespace math {
+
+/// A histogram, e.g. a snapshot of a sharded_histogram
+struct histogram {
+  /// Each power of 2 is divided into this many buckets
+  static constexpr int SUB_BUCKET_BITS = 4;
+  static constexpr int SUB_BUCKETS     = 1 << SUB_BUCKET_BITS;
+
+  /// Largest power of 2 [us] with full resolution
+  static constexpr int MAX_EXPONENT    = 40;
+
+  /// Number of buckets
+  static constexpr int BUCKETS =
+      SUB_BUCKETS * (MAX_EXPONENT - SUB_BUCKET_BITS + 2);
+
+  /// @return Bucket index for x [s]
+  static int bucket(double x);
+
+  /// @return Lower bound [s] of values in bucket i
+  static double lower_bound(int i);
+
+  /// @return Upper bound [s] (exclusive) of values in bucket i
+  static double upper_bound(int i);
+
+  /// Records a value [s]
+  void record(double x);
+
+  /// Adds bucket i count times, sum [s] is the sum of the values
+  void add(int i, std::uint64_t count, double sum);
+
+  /// Adds all values from other
+  void merge(histogram const& other);
+
+  /// @return Number of values recorded
+  std::uint64_t count() const { return count_; }
+
+  /// @return Number of values recorded in bucket i
+  std::uint64_t count(const int i) const { return counts_[i]; }
+
+  /// @return Sum of values recorded [s]
+  double sum() const { return sum_; }
+
+  /// @return Mean value [s], 0 if empty
+  double mean() const;
+
+  /// @return Estimate of quantile q (between 0 and 1) [s], 0 if empty
+  double quantile(double q) const;
+
+private:
+  std::array<std::uint64_t, BUCKETS> counts_ = {};
+  std::uint64_t count_ = 0;
+  double sum_ = 0;
+};
+
+/// Number of shards for sharded_histogram and sharded_counter
+constexpr int SHARDS = 16;
+
+/// @return The calling thread's shard, between 0 and SHARDS - 1
+int this_thread_shard();
+
+/// A histogram that can be recorded to from any thread without locking
+struct sharded_histogram {
+  sharded_histogram();
+
+  /// Records a value [s]
+  void record(double x);
+
+  /// @return Merged histogram of all shards
+  histogram snapshot() const;
+
+private:
+  struct alignas(64) shard {
+    std::array<std::atomic<std::uint64_t>, histogram::BUCKETS> counts;
+    // [us]
+    std::atomic<std::uint64_t> sum;
+  };
+
+  std::unique_ptr<shard[]> shards_;
+};
+
+/// A counter that can be incremented from any thread without locking
+struct sharded_counter {
+  sharded_counter();
+
+  /// Adds n
+  void add(std::uint64_t n);
+
+  /// @return Sum of all shards
+  std::uint64_t value() const;
+
+private:
+  struct alignas(64) shard {
+    std::atomic<std::uint64_t> value;
+  };
+
+  std::unique_ptr<shard[]> shards_;
+};
+
+} // namespace math
+
+} // namespace nanonet
+
+#endif // NANONET_HISTOGRAM_H
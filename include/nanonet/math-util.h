@@ -59,7 +59,7 @@ struct exponential_moving_average {
   }
 
   void update_discrete_states(discrete_state_type& x, T const& u) const {
-    if (isnan(x)) {
+    if (std::isnan(x)) {
       x = u;
     } else {
       x = (1 - C) * x + C * u;
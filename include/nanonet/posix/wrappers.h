@@ -37,10 +37,14 @@
 #include <sys/stat.h>
 #include <sys/select.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
 
 #include <netinet/in.h>
 #include <netinet/tcp.h>
 
+#include <net/if.h>
+
 #include <netdb.h>
 #include <fcntl.h>
 #include <poll.h>
@@ -94,6 +98,26 @@ template< typename T > inline bool EINTR_repeat( T const ret )
 { return ret < 0 && errno == EINTR ; }
 
 
+//
+// Bookkeeping for partial writev()/sendmsg(): Advances iov[ i .. n - 1 ]
+// by written bytes, i becomes the index of the first entry with data
+// left (n if all has been written).
+//
+
+inline void advance_iovec( 
+    ::iovec* const iov , int& i , int const n , long written ) {
+  while( i < n && written >= static_cast< long >( iov[ i ].iov_len ) ) {
+    written -= iov[ i ].iov_len ;
+    iov[ i ].iov_len = 0 ;
+    ++i ;
+  }
+  if( i < n ) {
+    iov[ i ].iov_base = static_cast< char* >( iov[ i ].iov_base ) + written ;
+    iov[ i ].iov_len -= written ;
+  }
+}
+
+
 // 
 // Throw an exception of the form s + ": " + strerror_r( errnum ).
 //
@@ -179,7 +203,11 @@ struct posix_reader_writer {
   auto_fd fd;
   
   long read ( char      * const buf , long const n ) ;
+  long read ( char      * const buf1 , long const n1 ,
+              char      * const buf2 , long const n2 ) ;
   long write( char const* const buf , long const n ) ;
+  long write( char const* const buf1 , long const n1 ,
+              char const* const buf2 , long const n2 ) ;
 
   void shutdown_read () {}
   void shutdown_write() {}
@@ -0,0 +1,95 @@
+//
+// Copyright 2015 KISS Technologies GmbH, Switzerland
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Component: UTIL
+//
+// Token bucket rate limiting per key, e.g. per client address.
+//
+// Usage:
+//   // 5 events per second on average, bursts of up to 20, at most
+//   // 10000 keys remembered
+//   nanonet::util::rate_limiter limiter(5, 20, 10000);
+//   if (not limiter.allow(client_address, nanonet::util::utc())) {
+//     // Too many
+//   }
+//
+// Notes:
+// * Thread safe.  Keys are distributed over SHARDS shards with a lock
+//   each, so threads rarely contend.
+// * Memory is bounded by capacity:  When a shard is full, its least
+//   recently seen key is forgotten.  Forgotten keys start over with a
+//   full bucket, so capacity should exceed the number of clients
+//   active within burst / rate seconds.
+//
+
+#ifndef NANONET_RATE_LIMITER_H
+#define NANONET_RATE_LIMITER_H
+
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+
+namespace nanonet {
+
+namespace util {
+
+struct rate_limiter {
+  /// Number of independently locked shards
+  static constexpr int SHARDS = 16;
+
+  /// Each key's bucket holds up to burst tokens and is refilled with
+  /// rate tokens per second.  At most capacity keys (rounded up to a
+  /// multiple of SHARDS) are remembered.
+  rate_limiter(double rate, double burst, long capacity);
+
+  /// Takes a token from the key's bucket at time now [s].  Unknown
+  /// keys start with a full bucket.
+  /// @return true iff a token was available
+  bool allow(std::string_view key, double now);
+
+  /// @return Number of keys currently remembered
+  long size() const;
+
+private:
+  struct bucket {
+    std::string key;
+    double tokens = 0;
+    // [s]
+    double last = 0;
+  };
+
+  struct shard {
+    std::mutex mutex;
+    // Most recently seen first
+    std::list<bucket> lru;
+    // Keys point into lru
+    std::unordered_map<std::string_view, std::list<bucket>::iterator> index;
+  };
+
+  double rate_;
+  double burst_;
+  std::size_t shard_capacity_;
+  std::unique_ptr<shard[]> shards_;
+};
+
+} // namespace util
+
+} // namespace nanonet
+
+#endif // NANONET_RATE_LIMITER_H
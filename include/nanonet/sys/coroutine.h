@@ -0,0 +1,272 @@
+//
+// Copyright 2015 KISS Technologies GmbH, Switzerland
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Component: SYSUTIL
+//
+// C++20 coroutine handlers for run_server(): Each connection is served
+// by a coroutine that is suspended while waiting for the network, so an
+// idle connection costs its coroutine frame but no thread.
+//
+// Usage:
+//   nanonet::util::co_task<> echo(nanonet::util::co_connection& c) {
+//     while (auto const line = co_await c.read_line()) {
+//       if (not co_await c.write(*line) or not co_await c.write("\n")) {
+//         break;
+//       }
+//     }
+//   }
+//
+//   nanonet::util::run_server(
+//       nanonet::util::coroutine_handler_type{echo}, running, params);
+//
+// Notes:
+// * Coroutines run on the params.event_threads event loop threads (at
+//   least one) and must not block.  All coroutines of a connection run
+//   on the same thread.
+// * co_task is lazy, it starts running when awaited.  Sub-tasks may be
+//   awaited from the connection's coroutine, exceptions propagate to the
+//   awaiting coroutine.
+// * Timeouts, shutdown and logging are as for line handlers: On timeout,
+//   pending and further reads return end of input and writes fail.  On
+//   shutdown, reads return end of input.  A shutdown_exception escaping
+//   from the handler shuts the server down.
+//
+
+#ifndef NANONET_SYS_COROUTINE_H
+#define NANONET_SYS_COROUTINE_H
+
+#include "nanonet/sys/network.h"
+
+#include <coroutine>
+#include <exception>
+#include <functional>
+#include <iosfwd>
+#include <optional>
+#include <span>
+#include <string_view>
+#include <utility>
+
+
+namespace nanonet {
+
+namespace util {
+
+/// Forward declarations
+struct server_status;
+
+template<typename T = void> struct co_task;
+
+namespace detail_ {
+
+// Common part of the co_task promises: Resumes the awaiting coroutine
+// on completion and keeps exceptions for it.
+struct co_promise_base {
+  struct final_awaiter {
+    bool await_ready() const noexcept { return false; }
+
+    template<typename P>
+    std::coroutine_handle<> await_suspend(
+        std::coroutine_handle<P> const h) const noexcept {
+      return h.promise().continuation;
+    }
+
+    void await_resume() const noexcept {}
+  };
+
+  std::suspend_always initial_suspend() const noexcept { return {}; }
+  final_awaiter       final_suspend  () const noexcept { return {}; }
+
+  void unhandled_exception() { exception = std::current_exception(); }
+
+  void rethrow_if_failed() const {
+    if (exception) {
+      std::rethrow_exception(exception);
+    }
+  }
+
+  std::coroutine_handle<> continuation = std::noop_coroutine();
+  std::exception_ptr exception;
+};
+
+template<typename T> struct co_promise : co_promise_base {
+  co_task<T> get_return_object();
+
+  void return_value(T v) { value.emplace(std::move(v)); }
+
+  T result() {
+    rethrow_if_failed();
+    return std::move(*value);
+  }
+
+  std::optional<T> value;
+};
+
+template<> struct co_promise<void> : co_promise_base {
+  co_task<void> get_return_object();
+
+  void return_void() {}
+
+  void result() const { rethrow_if_failed(); }
+};
+
+} // namespace detail_
+
+/// A lazily started coroutine returning T
+template<typename T> struct [[nodiscard]] co_task {
+  typedef detail_::co_promise<T> promise_type;
+  typedef std::coroutine_handle<promise_type> handle_type;
+
+  explicit co_task(handle_type const h = nullptr) : h_(h) {}
+
+  ~co_task() {
+    if (h_) {
+      h_.destroy();
+    }
+  }
+
+  /// Moveable
+  co_task(co_task&& other) noexcept : h_(std::exchange(other.h_, nullptr)) {}
+
+  co_task& operator=(co_task&& other) noexcept {
+    std::swap(h_, other.h_);
+    return *this;
+  }
+
+  /// Noncopyable
+  co_task           (co_task const&) = delete;
+  co_task& operator=(co_task const&) = delete;
+
+  /// @return true iff the coroutine has finished
+  bool done() const { return not h_ or h_.done(); }
+
+  /// Runs a top level task until its first suspension
+  void start() { h_.resume(); }
+
+  /// @return The result of a finished task, rethrows its exception
+  T get() { return h_.promise().result(); }
+
+  /// Awaiting starts the task and resumes the awaiting coroutine
+  /// once it's finished
+  bool await_ready() const noexcept { return done(); }
+
+  std::coroutine_handle<> await_suspend(
+      std::coroutine_handle<> const caller) noexcept {
+    h_.promise().continuation = caller;
+    return h_;
+  }
+
+  T await_resume() { return get(); }
+
+private:
+  handle_type h_;
+};
+
+template<typename T>
+co_task<T> detail_::co_promise<T>::get_return_object() {
+  return co_task<T>(co_task<T>::handle_type::from_promise(*this));
+}
+
+inline co_task<void> detail_::co_promise<void>::get_return_object() {
+  return co_task<void>(co_task<void>::handle_type::from_promise(*this));
+}
+
+/// A connection served by a coroutine handler.  At most one read or
+/// write may be pending at any time.
+struct co_connection {
+  /// Connection state, private to the server
+  struct state;
+
+  explicit co_connection(state& s) : s_(s) {}
+
+  /// Noncopyable
+  co_connection           (co_connection const&) = delete;
+  co_connection& operator=(co_connection const&) = delete;
+
+  struct line_awaiter {
+    bool await_ready();
+    void await_suspend(std::coroutine_handle<> h);
+    std::optional<std::string_view> await_resume();
+
+    state& s;
+  };
+
+  struct read_awaiter {
+    bool await_ready();
+    void await_suspend(std::coroutine_handle<> h);
+    long await_resume();
+
+    state& s;
+    std::span<char> buffer;
+  };
+
+  struct write_awaiter {
+    bool await_ready();
+    void await_suspend(std::coroutine_handle<> h);
+    bool await_resume();
+
+    state& s;
+    std::span<const char> data;
+  };
+
+  /// Reads a line, without the '\n'.  Lines longer than
+  /// max_line_length run over into the next line as for getline().
+  /// The line is valid until the next read.
+  /// @return The line, nullopt on end of input, timeout or shutdown
+  line_awaiter read_line() { return {s_}; }
+
+  /// Reads at least one and at most buffer.size() bytes
+  /// @return Number of bytes read, 0 on end of input, timeout or shutdown
+  read_awaiter read_some(std::span<char> const buffer) {
+    return {s_, buffer};
+  }
+
+  /// Queues data for sending, it may go away after the co_await.
+  /// Output is sent when the coroutine waits for input or finishes,
+  /// writes only suspend if lots of output is pending.
+  /// @return false on errors or timeout
+  write_awaiter write(std::span<const char> const data) {
+    return {s_, data};
+  }
+
+  /// Sends a NUL terminated string (without the NUL)
+  write_awaiter write(const char* const s) {
+    return write(std::string_view(s));
+  }
+
+  /// @return The peer's address
+  nanonet::util::network::connection::address_type peer() const;
+
+  /// @return Status of the server
+  server_status const& status() const;
+
+  /// @return A stream for logging
+  std::ostream& log() const;
+
+private:
+  state& s_;
+};
+
+//
+// A coroutine handler, called once per connection.  The connection is
+// closed when the returned task finishes.
+//
+
+typedef std::function<co_task<>(co_connection&)> coroutine_handler_type;
+
+} // namespace util
+
+} // namespace nanonet
+
+#endif // NANONET_SYS_COROUTINE_H
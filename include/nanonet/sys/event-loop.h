@@ -0,0 +1,146 @@
+//
+// Copyright 2015 KISS Technologies GmbH, Switzerland
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Component: SYSUTIL
+//
+// A single-threaded I/O event loop for non-blocking file descriptors.
+//
+// Usage:
+//   nanonet::util::event_loop loop;
+//   loop.add(fd, event_loop::readable, [&](unsigned events) { ... });
+//   // From any thread:
+//   loop.post([&] { ... });
+//   loop.stop();
+//   // In the loop thread:
+//   loop.run();
+//
+// Notes:
+// * All methods except post() and stop() must be called from the thread
+//   running the loop (or before the loop is started).
+// * Callbacks may add, modify and remove any descriptor, including their
+//   own.
+// * Currently implemented on Linux (epoll) only.  On other platforms, the
+//   constructor throws.
+//
+
+#ifndef NANONET_SYS_EVENT_LOOP_H
+#define NANONET_SYS_EVENT_LOOP_H
+
+#include "nanonet/detail/platform_wrappers.h"
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+
+namespace nanonet {
+
+namespace util {
+
+struct event_loop {
+  /// Event flags for add() and modify() and passed to callbacks.
+  /// hangup is only ever passed to callbacks, it is always reported.
+  static constexpr unsigned readable = 1;
+  static constexpr unsigned writable = 2;
+  static constexpr unsigned hangup   = 4;
+
+  /// Called with the events that occurred on the descriptor
+  typedef std::function<void(unsigned events)> fd_callback;
+
+  /// Task type for post()
+  typedef std::function<void()> task;
+
+  /// Creates an empty loop
+  event_loop();
+
+  ~event_loop();
+
+  /// Noncopyable, nonmoveable (callbacks typically capture this)
+  event_loop           (event_loop const&) = delete;
+  event_loop& operator=(event_loop const&) = delete;
+
+  /// Registers fd for the given events.  The descriptor must not be
+  /// registered yet and must be non-blocking.  It is not owned by the loop,
+  /// remove() it before closing it.
+  void add(nanonet::detail_::socketfd_t fd, unsigned events, fd_callback cb);
+
+  /// Changes the events of interest for a registered fd
+  void modify(nanonet::detail_::socketfd_t fd, unsigned events);
+
+  /// Unregisters fd.  No more callbacks will be called for it, even
+  /// if the current batch of events contains some.
+  void remove(nanonet::detail_::socketfd_t fd);
+
+  /// @return Number of registered descriptors
+  long size() const { return static_cast<long>(fds_.size()); }
+
+  /// Thread safe: Queues t for execution in the loop thread and wakes
+  /// up the loop.
+  void post(task t);
+
+  /// Thread safe: Causes run() to return as soon as possible.
+  void stop();
+
+  /// @return true iff stop() has been called
+  bool stopped() const;
+
+  /// Waits at most timeout [s] for events (indefinitely if timeout < 0),
+  /// then runs the callbacks for all ready descriptors and all posted
+  /// tasks.
+  /// @return Number of callbacks and tasks run
+  long run_once(double timeout);
+
+  /// Calls run_once() until stop() is called.
+  void run();
+
+private:
+  struct registration {
+    std::uint64_t id;
+    fd_callback cb;
+  };
+
+  // @return Number of tasks run
+  long run_posted();
+
+  // epoll descriptor and wakeup eventfd
+  nanonet::detail_::auto_fd poll_fd_;
+  nanonet::detail_::auto_fd wake_fd_;
+
+  // Registered descriptors.  Events carry the registration id so
+  // that stale events for a removed and reused fd are ignored.
+  std::unordered_map<
+    nanonet::detail_::socketfd_t,
+    std::unique_ptr<registration>> fds_;
+  std::uint64_t next_id_ = 1;
+
+  // Registrations removed during the current batch of callbacks.  They
+  // are destroyed at the end of run_once() because a callback may remove
+  // itself.
+  std::vector<std::unique_ptr<registration>> removed_;
+
+  // Tasks from post() and stop flag, protected by mutex_
+  mutable std::mutex mutex_;
+  std::vector<task> posted_;
+  bool stopped_ = false;
+};
+
+} // namespace util
+
+} // namespace nanonet
+
+#endif // NANONET_SYS_EVENT_LOOP_H
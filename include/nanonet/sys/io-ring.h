@@ -0,0 +1,138 @@
+//
+// Copyright 2015 KISS Technologies GmbH, Switzerland
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Component: SYSUTIL
+//
+// A minimal io_uring submission/completion ring using the raw system
+// calls (no liburing needed).
+//
+// Usage:
+//   nanonet::util::io_ring ring(256);
+//   ring.provide_buffers(1024, 4096);
+//   ring.recv_multishot(fd, 42);
+//   ring.wait(1.0, [&](io_ring::completion const& c) {
+//     if (c.has_buffer()) {
+//       use(ring.buffer_data(c.buffer()), c.res);
+//       ring.recycle_buffer(c.buffer());
+//     }
+//   });
+//
+// Notes:
+// * Requests are queued and submitted in a single system call by the
+//   next wait().
+// * Not thread safe, use from one thread only.
+// * Only available on Linux (kernel >= 6.0) if nanonet is built with
+//   -DNANONET_IO_URING=ON.  Otherwise, the constructor throws and
+//   available() returns false.
+//
+
+#ifndef NANONET_SYS_IO_RING_H
+#define NANONET_SYS_IO_RING_H
+
+#include "nanonet/detail/platform_wrappers.h"
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+
+
+namespace nanonet {
+
+namespace util {
+
+struct io_ring {
+  /// A completion queue entry
+  struct completion {
+    std::uint64_t user_data = 0;
+    /// Result as for the corresponding system call, but -errno on error
+    int           res       = 0;
+    unsigned      flags     = 0;
+
+    /// @return true iff a multishot request remains armed
+    bool more() const;
+
+    /// @return true iff the data was received into a provided buffer
+    bool has_buffer() const;
+
+    /// @return The provided buffer id, only valid if has_buffer()
+    unsigned buffer() const;
+  };
+
+  typedef std::function<void(completion const&)> completion_handler;
+
+  /// @return true iff io_uring is compiled in and supported by the kernel
+  static bool available();
+
+  /// Sets up a ring with at least the given number of submission
+  /// queue entries.
+  explicit io_ring(unsigned entries);
+
+  ~io_ring();
+
+  /// Noncopyable
+  io_ring           (io_ring const&) = delete;
+  io_ring& operator=(io_ring const&) = delete;
+
+  /// Registers count buffers of size bytes each for recv_multishot().
+  /// count must be a power of 2 <= 32768.  Call at most once.
+  void provide_buffers(unsigned count, unsigned size);
+
+  /// @return The start of provided buffer id
+  char* buffer_data(unsigned id);
+
+  /// Returns provided buffer id to the kernel after use
+  void recycle_buffer(unsigned id);
+
+  /// Queues a multishot accept on a listening socket.  Each completion
+  /// carries a new descriptor (or -errno) in res.
+  void accept_multishot(nanonet::detail_::socketfd_t fd, std::uint64_t user_data);
+
+  /// Queues a multishot receive into the provided buffers.  res is the
+  /// number of bytes received, 0 on EOF or -errno.  The request stays
+  /// armed as long as completions have more() set.
+  void recv_multishot(nanonet::detail_::socketfd_t fd, std::uint64_t user_data);
+
+  /// Queues a send of n bytes at buf.  buf must stay valid until the
+  /// completion has been seen.  Never raises SIGPIPE.
+  void send(nanonet::detail_::socketfd_t fd, const char* buf, long n,
+            std::uint64_t user_data);
+
+  /// Queues a read of n bytes into buf at the current position
+  void read(nanonet::detail_::socketfd_t fd, void* buf, unsigned n,
+            std::uint64_t user_data);
+
+  /// Queues a one-shot wait until fd becomes readable, without
+  /// consuming anything.
+  void poll_readable(nanonet::detail_::socketfd_t fd, std::uint64_t user_data);
+
+  /// Queues cancellation of the request(s) with user data target
+  void cancel(std::uint64_t target, std::uint64_t user_data);
+
+  /// Submits all queued requests and waits at most timeout [s] for
+  /// completions (indefinitely if timeout < 0).  Calls h for each
+  /// completion, h may queue new requests.
+  /// @return Number of completions handled
+  long wait(double timeout, completion_handler const& h);
+
+private:
+  struct impl;
+  std::unique_ptr<impl> impl_;
+};
+
+} // namespace util
+
+} // namespace nanonet
+
+#endif // NANONET_SYS_IO_RING_H
@@ -25,15 +25,25 @@ namespace nanonet {
 namespace util    {
 namespace network {
 
-/// Constants for IPv4 and IPv6.
+/// Constants for IPv4, IPv6 and Unix domain sockets.
 /// Avoid overlap of enum with port numbers.
 enum address_family_type { 
-  ipv4      = 1000123, 
-  ipv6      = 1000343, 
-  ip_unspec = 1000999 
+  ipv4        = 1000123, 
+  ipv6        = 1000343, 
+  unix_domain = 1000555,
+  ip_unspec   = 1000999 
 };
 
-/// @return ipv4 for "ipv4", "ip4" etc.
+/// Services starting with this prefix denote Unix domain sockets,
+/// e.g. "unix:/run/app.sock".  With an '@' after the prefix, e.g.
+/// "unix:@app", the name is in the abstract namespace (Linux only) and
+/// no file is created.
+constexpr char const* UNIX_SERVICE_PREFIX = "unix:";
+
+/// @return true iff service starts with UNIX_SERVICE_PREFIX
+bool is_unix_service(std::string const& service);
+
+/// @return ipv4 for "ipv4", "ip4" etc., unix_domain for "unix"
 ///
 /// Throws if description cannot be recognized.
 /// allow_unspec: If true, allows 'any' or 'unspec' as description
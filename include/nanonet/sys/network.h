@@ -18,12 +18,23 @@
 // Supports:
 // * Datagram (UDP) and stream (TCP) abstractions
 // * IPv4 and IPv6
+// * Unix domain sockets, for stream and datagram
 // * IOstreams abstractions TCP
 // * Name resolution (DNS)
 //
 // Notes:
 // * In order to send from client datagram socket, the address family
 //   must match the destination address.
+// * Unix domain sockets are given as services "unix:<path>" or, in the
+//   abstract namespace (Linux), "unix:@<name>", e.g.
+//   acceptor a( "unix:/run/app.sock" ) ;
+//   connection c( "" , "unix:/run/app.sock" ) ;
+//   datagram_socket d( "" , "unix:@app-dgram" ) ;
+//   Host names and address family hints are ignored for these.  Binding
+//   replaces a socket file nobody listens on any more; the file is not
+//   removed on close.  Unbound datagram sockets (unix_domain family)
+//   are bound to an automatic abstract name so that they can receive
+//   replies (Linux).
 //
 // TODO:
 // * Client and server constructors or factory functions for UDP.
@@ -52,6 +63,8 @@
 #include "nanonet/detail/socket_lowlevel.h"
 
 
+#include <algorithm>
+#include <memory>
 #include <vector>
 #include <istream>
 #include <ostream>
@@ -61,6 +74,7 @@
 #include <limits>
 #include <iostream>
 #include <iterator>
+#include <span>
 
 #include <cstdlib>
 
@@ -132,6 +146,72 @@ resolve_datagram( ARG&& ... arg ) {
 // connect() from different threads can yield unpredictable results.
 ////////////////////////////////////////////////////////////////////////
 
+//
+// A message slot for datagram_socket::receive_batch() and send_batch(),
+// preallocated by the caller and reusable.
+//
+
+struct datagram_message {
+
+  // Payload buffer
+  std::span< char > buffer ;
+
+  // Source (receive) or destination (send) address
+  datagram_address address ;
+
+  // Payload size: Received, or number of bytes of buffer to send
+  unsigned long size = 0 ;
+
+  // Set on receive if the datagram didn't fit into buffer
+  bool truncated = false ;
+
+  // Kernel receive time [s] like nanonet::util::utc(), 0 if receive
+  // timestamps aren't enabled, see datagram_socket::receive_timestamps()
+  double timestamp = 0 ;
+
+} ;
+
+//
+// A payload received by datagram_socket::receive_segments(), one or
+// more datagrams of segment_size bytes each, the last one possibly
+// shorter.
+//
+
+struct datagram_segments {
+
+  // Received payload
+  std::span< char > data ;
+
+  // Size of the datagrams in data
+  long segment_size = 0 ;
+
+  // Source address
+  datagram_address address ;
+
+  // Set if the payload didn't fit into the buffer
+  bool truncated = false ;
+
+  // Kernel receive time [s] like nanonet::util::utc(), 0 if receive
+  // timestamps aren't enabled, see datagram_socket::receive_timestamps()
+  double timestamp = 0 ;
+
+  // Returns the number of datagrams in data, at least 1
+  long count() const {
+    long const n = data.size() ;
+    return segment_size > 0 && n > 0 ? ( n + segment_size - 1 ) / segment_size
+                                     : 1 ;
+  }
+
+  // Returns datagram i, 0 <= i < count()
+  std::span< char > operator[]( long const i ) const {
+    if( segment_size <= 0 ) { return data ; }
+    long const begin = i * segment_size ;
+    return data.subspan( 
+        begin , std::min< long >( segment_size , data.size() - begin ) ) ;
+  }
+
+} ;
+
 struct datagram_socket {
 
   // Types
@@ -235,13 +315,17 @@ struct datagram_socket {
   // If t < 0, blocks.
   // Returns: timeout() on timeout, or the number of characters written.
   // n: Maximum size to receive.
+  // If begin points into contiguous memory (char*, std::span<char> or
+  // std::vector<char> iterators etc.), receives directly into it, so
+  // there must be room for n bytes.  Otherwise, receives into a buffer
+  // from the pool (see buffer-pool.h) and copies to begin.
   template< typename for_it >
   size_type receive( 
     for_it const& begin , 
     double const& t = -1 ,
     size_type n = default_size()
   ) {
-    return receive_internal( nullptr , begin , t , n );
+    return receive_internal( nullptr , nullptr , begin , t , n );
   }
 
   // Like receive() above, but fills the source address
@@ -252,12 +336,97 @@ struct datagram_socket {
     double const& t = -1 ,
     size_type n = default_size()
   ) {
-    return receive_internal( &source , begin , t , n );
+    return receive_internal( &source , nullptr , begin , t , n );
+  }
+
+  // Enables/disables kernel receive timestamps: SO_TIMESTAMPNS on
+  // Linux, SO_TIMESTAMP elsewhere.  The time a datagram entered the
+  // host is then returned by receive_timestamped(), receive_batch() and
+  // receive_segments().  It is comparable to nanonet::util::utc(), e.g.
+  // utc() - timestamp is the queueing delay within the process.
+  void receive_timestamps( bool const enable = true ) 
+  { s.receive_timestamps( enable ) ; }
+
+  // Like receive() above, but also fills the kernel receive time [s],
+  // 0 if receive timestamps aren't enabled.
+  template< typename for_it >
+  size_type receive_timestamped( 
+    address_type& source ,
+    double& timestamp ,
+    for_it const& begin , 
+    double const& t = -1 ,
+    size_type n = default_size()
+  ) {
+    return receive_internal( &source , &timestamp , begin , t , n );
   }
 
 
+  // Maximum number of messages per system call in the batch functions
+  static constexpr long MAX_BATCH = 64 ;
+
+  // Receives up to messages.size() datagrams with as few system calls
+  // as possible (recvmmsg() on Linux), filling in size, address,
+  // truncated and timestamp of each message.
+  // Waits for the first datagram like receive() with timeout t, then
+  // takes only those already queued.
+  // Returns: The number of messages received, 0 on timeout or if the
+  // socket is non-blocking and nothing is queued.
+  long receive_batch(
+    std::span< datagram_message > messages ,
+    double t = -1
+  ) ;
+
+  // Sends the first size bytes of each message's buffer to its address,
+  // or to the address given in connect() if use_address is false.  Uses
+  // as few system calls as possible (sendmmsg() on Linux).
+  // Messages refused by the destination are skipped.
+  // Returns: The number of datagrams sent.
+  long send_batch(
+    std::span< datagram_message const > messages ,
+    bool use_address = true
+  ) ;
+
+
+  // Maximum number of datagrams per system call in send_segmented()
+  static constexpr long MAX_SEGMENTS = 64 ;
+
+  // Sends data as datagrams of segment_size bytes each, the last one
+  // possibly shorter, to the address given in connect().
+  // On Linux, uses UDP segmentation offload (UDP_SEGMENT): Up to
+  // MAX_SEGMENTS datagrams, but at most 64 kB, go out with one system
+  // call.  Elsewhere, for Unix domain sockets, if the kernel or device
+  // doesn't support it or segment_size exceeds the path MTU, sends one
+  // datagram per call.
+  // Datagrams refused by the destination are dropped, like in send().
+  void send_segmented( std::span< char const > data , long segment_size ) ;
+
+  // As above, but sends to the given destination
+  void send_segmented( 
+    std::span< char const > data ,
+    long segment_size ,
+    address_type const& destination
+  ) ;
+
+  // Enables or disables UDP receive offload (UDP_GRO, Linux): The
+  // kernel may then deliver several datagrams from the same source with
+  // the same size as one payload.  Only use receive_segments() on such
+  // a socket.  No-op elsewhere.
+  void receive_offload( bool = true ) ;
+
+  // Receives one payload into buffer, which should have room for 64 kB
+  // if receive_offload() is enabled, and splits it into datagrams.
+  // t: Timeout [s] like in receive().
+  // Returns false on timeout.
+  bool receive_segments( 
+    std::span< char > buffer , 
+    datagram_segments& segments ,
+    double t = -1
+  ) ;
+
+
   // Send overloads.
   // Connection refused error is ignored.
+  // Ranges in contiguous memory are sent without a copy.
 
   // Sends to address given in connect().
   // Throws if connect() has not been called.
@@ -304,20 +473,61 @@ struct datagram_socket {
     return nanonet::detail_::my_getpeername< SOCK_DGRAM >( fd() ) ;
   }
 
+  // Returns the low-level socket descriptor
+  nanonet::detail_::socketfd_t fd() const { return s.fd() ; }
+
+  // Multicast
+
+  // Joins the multicast group (an IPv4 or IPv6 address matching the
+  // socket's family) on the given interface, e.g. "eth0", or on the
+  // interface chosen by the system if empty.  Bind the socket to the
+  // group's port to receive its datagrams.
+  void join_group( 
+      std::string const& group , std::string const& interface = "" ) ;
+
+  // Leaves a group joined with join_group()
+  void leave_group( 
+      std::string const& group , std::string const& interface = "" ) ;
+
 private:
   template< typename for_it >
   size_type receive_internal(
     address_type* source ,
+    double* timestamp ,
     for_it const& begin , 
     double const& t ,
     size_type n 
   ) ;
 
+  // Receives into [p, p + n) without waiting
+  size_type receive_into( 
+      address_type* source , double* timestamp , char* p , size_type n ) ;
+
+  template< typename for_it >
+  void send_internal(
+    address_type const* destination ,
+    for_it const& begin ,
+    for_it const& end
+  ) ;
+
+  // Sends [p, p + n) to destination, or to the connected peer if
+  // destination is null
+  void send_from( address_type const* destination , char const* p , long n ) ;
+
+  void send_segmented_internal(
+    address_type const* destination ,
+    std::span< char const > data ,
+    long segment_size 
+  ) ;
+
   // Enables broadcasting
   void initialize();
 
+  // Multicast group membership
+  void group_membership(
+      int option , std::string const& group , std::string const& interface ) ;
+
   nanonet::detail_::datagram_socket_reader_writer s ;
-  nanonet::detail_::socketfd_t fd() const { return s.fd() ; }
 
 } ;
 
@@ -397,10 +607,19 @@ struct connection : nanonet::util::file::buffer_maker< connection > {
   /// Throws a timeout_exception after timeout [s] if timeout >= 0.
   connection( acceptor& , double timeout = -1.0 ) ;
 
+  /// Takes ownership of a descriptor already returned by accept(), e.g.
+  /// from an io_uring multishot accept.
+  explicit connection( nanonet::detail_::socketfd_t accepted ) ;
+
+  /// As above, with the peer address as returned by accept()
+  connection( nanonet::detail_::socketfd_t accepted ,
+              address_type const& peer ) ;
+
   //////////////////////////////////////////////////////////////////////// 
   // Parametrization
   //////////////////////////////////////////////////////////////////////// 
 
+  // No-op for Unix domain sockets.
   // Enables/disables the TCP_NODELAY option.  If set, sends out data as 
   // soon as possible, otherwise waits a bit (RFC1122/`Nagle algorithm').
   void no_delay( bool = true ) ;
@@ -413,6 +632,24 @@ struct connection : nanonet::util::file::buffer_maker< connection > {
   // Default: Wait indefinitely
   void timeout        ( double ) ;
 
+  // Enables/disables kernel receive timestamps (SO_TIMESTAMPNS on Linux).
+  void receive_timestamps( bool enable = true )
+  { s->receive_timestamps( enable ) ; }
+
+  // Returns the time the data of the last read from the socket, i.e.
+  // the last instream buffer fill, entered the host [s].  Comparable to
+  // nanonet::util::utc(), e.g. utc() - receive_time() is the queueing
+  // delay within the process.  0 if receive timestamps aren't enabled
+  // or unavailable.  Call from the thread reading the instream.
+  double receive_time() const { return s->receive_time() ; }
+
+  // Sets the buffer size of subsequently created instream/onstream
+  // objects [bytes], must be >= 1.
+  // Default: nanonet::util::DEFAULT_BUFFER_SIZE
+  void buffer_size( long const size ) 
+  { always_assert( size >= 1 ) ; buffer_size_ = size ; }
+  long buffer_size() const { return buffer_size_ ; }
+
   // Returns the other endpoint's address
   address_type const& peer () const { return  peer_ ; }
   // Returns the local address
@@ -427,8 +664,10 @@ struct connection : nanonet::util::file::buffer_maker< connection > {
   nanonet::detail_::socketfd_t fd() { return s->fd() ; }
 
   // Implementation of buffer_maker<> interface
-  instreambuf make_istreambuf() { return instreambuf( socket() ) ; }
-  onstreambuf make_ostreambuf() { return onstreambuf( socket() ) ; }
+  instreambuf make_istreambuf() 
+  { return instreambuf( socket() , buffer_size_ ) ; }
+  onstreambuf make_ostreambuf() 
+  { return onstreambuf( socket() , buffer_size_ ) ; }
 
 private:
 
@@ -454,6 +693,8 @@ private:
   address_type local_ ;
   address_type  peer_ ;
 
+  long buffer_size_ = nanonet::util::DEFAULT_BUFFER_SIZE ;
+
 } ;
 
 
@@ -475,15 +716,25 @@ struct acceptor {
   // Listens on the given local service (port). Tries IPv4, IPv6
   // if IPv4 isn't available.
   // Backlog: Maximum queue size for incoming connections.
-  acceptor( std::string const& ls , int backlog = 0 ) ;
+  // reuse_port: Set SO_REUSEPORT, allowing several acceptors (possibly
+  // in different processes) on the same address.  On Linux, incoming
+  // connections are distributed over them.
+  acceptor( std::string const& ls , int backlog = 0 ,
+            bool reuse_port = false ) ;
 
   // Listens on the given local address and service (port), IPv4 or IPv6
   // Use (any_ipv4()/"0.0.0.0", ls) for IPv4
   // Use (any_ipv6()/"::", ls) for IPv6
-  acceptor( std::string const& ln , std::string const& ls , int backlog = 0 ) ;
+  acceptor( std::string const& ln , std::string const& ls , int backlog = 0 ,
+            bool reuse_port = false ) ;
 
   // Listens on first suitable local address from the given list.
-  acceptor( address_list_type const& la , int backlog = 0 ) ;
+  acceptor( address_list_type const& la , int backlog = 0 ,
+            bool reuse_port = false ) ;
+
+  // Takes ownership of a socket that is already listening, e.g. one
+  // received from another process with receive_descriptors().
+  explicit acceptor( nanonet::detail_::socketfd_t listening ) ;
 
   // Returns the address we're listening on
   address_type const& local() const { return local_ ; }
@@ -491,6 +742,16 @@ struct acceptor {
   // Returns the low-level file descriptor
   nanonet::detail_::socketfd_t fd() const { return s.fd() ; }
 
+  // Accepts all pending connections, but at most max, and appends them
+  // to batch.  Doesn't wait, poll fd() for incoming connections first.
+  // If nonblocking is true, the new connections are non-blocking.
+  // Returns the number of connections appended.  Throws only if
+  // no connection could be accepted at all.
+  // Sets the listening socket to non-blocking mode, use
+  // connection( acceptor& , timeout ) with timeout >= 0 only afterwards.
+  long accept_batch( std::vector< std::unique_ptr< connection > >& batch ,
+                     long max , bool nonblocking = false ) ;
+
 private:
 
   // Socket read/write interface, but the acceptor will only use 
@@ -499,9 +760,36 @@ private:
 
   address_type local_ ;
 
+  // Whether the listening socket has been set to non-blocking mode
+  bool nonblocking_ = false ;
+
 } ;
 
 
+//
+// Passing descriptors between processes over a Unix domain stream
+// connection (SCM_RIGHTS), e.g. listening sockets for handing them off
+// to a new server process.  The receiver gets new descriptors referring
+// to the same open sockets, the sender keeps its own.
+// Use the connection's fd directly, not via instream/onstream.
+//
+
+// Maximum number of descriptors per message
+constexpr long MAX_DESCRIPTORS = 64 ;
+
+// Sends message, which must be nonempty, together with the descriptors.
+void send_descriptors( 
+    connection& c , std::string const& message ,
+    std::vector< nanonet::detail_::socketfd_t > const& fds ) ;
+
+// Receives a message of at most max_size bytes sent by
+// send_descriptors() and appends the descriptors sent with it to fds.
+// Returns an empty string on EOF.  Keep messages short, they're
+// received with a single read.
+std::string receive_descriptors(
+    connection& c , std::vector< nanonet::detail_::auto_fd >& fds ,
+    long max_size = 4096 ) ;
+
 
 //
 // std::istream and std::ostream classes for stream (TCP) sockets.
@@ -575,97 +863,40 @@ private:
 // Template definitions.
 ////////////////////////////////////////////////////////////////////////
 
-// TODO: This should be done with timeout socket options, not select?!
-// At the very least, use poll or ppoll, not select!
 template< typename for_it >
 nanonet::util::network::datagram_socket::size_type 
 nanonet::util::network::datagram_socket::receive_internal( 
   address_type* const source_ret ,
+  double* const timestamp ,
   for_it const& begin ,
   double const& t , 
   size_type const max
 ) {
 
-  if( t >= 0 ) {
-
-    // Watch fd to see if it has input
-
-    fd_set rfds ;
-    FD_ZERO(        &rfds ) ;
-    FD_SET ( fd() , &rfds ) ;
-
-    // Do not wait.
-
-    ::timeval tv = nanonet::detail_::to_timeval( t ) ;
-
-    int const nfds = fd() + 1 ;     // Size of array containing sockets 
-                                    // up to and including the one we set.
-
-    int err ;
-    do 
-    { err = ::select( nfds , &rfds , 0 , 0 , &tv ) ; } 
-    while( nanonet::detail_::EINTR_repeat( err ) ) ;  
-    // Some platforms including Linux update timeout.
-
-    if( err < 0 ) { nanonet::detail_::throw_socket_error( "select" ) ; }
-
-    if( err == 0 ) { return timeout() ; }
-
+  if( !nanonet::detail_::wait_readable( fd() , t ) ) { return timeout() ; }
+
+  if constexpr(
+      nanonet::detail_::contiguous_mutable_byte_iterator< for_it > ) {
+    return receive_into(
+        source_ret , timestamp ,
+        reinterpret_cast< char* >( std::to_address( begin ) ) , max ) ;
+  } else {
+    nanonet::util::pooled_buffer buffer( max ) ;
+    size_type const n = 
+      receive_into( source_ret , timestamp , buffer.data() , max ) ;
+    std::copy( buffer.data() , buffer.data() + n , begin ) ;
+    return n ;
   }
 
-  std::vector< char > buffer( max ) ;
-
-  long err ;
-  do {
-    address_type source ;
-
-    err = 
-      ::recvfrom(
-         fd()           ,
-         &buffer[ 0 ]   ,
-         buffer.size()  ,
-         0              ,
-         source.sockaddr_pointer() ,
-         source. socklen_pointer()
-      ) ;
-
-    if( nullptr != source_ret ) {
-      *source_ret = source ;
-    }
-
-  } while( nanonet::detail_::EINTR_repeat( err ) ) ;
-
-  if( err < 0 )
-  { nanonet::detail_::throw_socket_error( "recvfrom" ) ; }
-
-  assert( static_cast< size_type >( err ) <= buffer.size() ) ;
-
-  std::copy( buffer.begin() , buffer.begin() + err , begin ) ;
-  return err ;
-
 }
 
 
-// TODO: Factor out common code from send(begin, end) and 
-// send(begin, end, dest).
 template< typename for_it >
 void nanonet::util::network::datagram_socket::send(
   for_it const& begin ,
   for_it const& end
 ) {
- 
-  std::vector< char > const buffer( begin , end ) ;
-
-  long const result = 
-      nanonet::detail_::my_send( fd() , &buffer[ 0 ] , buffer.size() ) ;
-
-  if( result < 0 ) {
-    if( errno == ECONNREFUSED ) { return ; }
-    nanonet::detail_::throw_socket_error( "send" ) ;
-  }
-
-  always_assert( result == static_cast< long >( buffer.size() ) ) ;
-
+  send_internal( nullptr , begin , end ) ;
 }
 
 template< typename for_it >
@@ -674,26 +905,26 @@ void nanonet::util::network::datagram_socket::send(
   for_it const& end   ,
   address_type const& d
 ) {
+  send_internal( &d , begin , end ) ;
+}
 
-  // It appears we cannot send from an IPv4 socket to IPv6 or vice versa
-  // (tested MacOS X).  Hence, test for this condition and throw
-  // in case somebody tries.
-  if( d.family_detail_() != local().family_detail_() ) {
-    throw std::runtime_error( "datagram send: address family mismatch" ) ;
-  }
-
-  std::vector< char > const buffer( begin , end ) ;
-
-  const long result = nanonet::detail_::my_sendto(
-      fd() , d.sockaddr_pointer() , d.length() , &buffer[ 0 ] , buffer.size() ) ;
+template< typename for_it >
+void nanonet::util::network::datagram_socket::send_internal(
+  address_type const* const d ,
+  for_it const& begin ,
+  for_it const& end
+) {
 
-  if( result < 0 ) {
-    if( errno == ECONNREFUSED ) { return ; }
-    nanonet::detail_::throw_socket_error( "send to " + d.host() + ":" + d.port() ) ; 
+  if constexpr( nanonet::detail_::contiguous_byte_iterator< for_it > ) {
+    send_from( 
+        d , reinterpret_cast< char const* >( std::to_address( begin ) ) , 
+        end - begin ) ;
+  } else {
+    nanonet::util::pooled_buffer buffer( std::distance( begin , end ) ) ;
+    std::copy( begin , end , buffer.data() ) ;
+    send_from( d , buffer.data() , buffer.size() ) ;
   }
 
-  always_assert( result == static_cast< long >( buffer.size() ) ) ;
-
 }
  
 template< typename for_it >
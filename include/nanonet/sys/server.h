@@ -30,12 +30,17 @@
 #ifndef NANONET_SYS_SERVER_H
 #define NANONET_SYS_SERVER_H
 
+#include "nanonet/histogram.h"
+#include "nanonet/sys/coroutine.h"
 #include "nanonet/sys/network.h"
 
 #include <atomic>
+#include <condition_variable>
 #include <functional>
 #include <iosfwd>
+#include <mutex>
 #include <optional>
+#include <span>
 #include <stdexcept>
 #include <thread>
 
@@ -50,13 +55,37 @@ struct server_status;
 /// A flag to control the running state of one or more 
 /// background tasks.  This is in fact an atomic boolean 
 /// that can only change state from true to false.
+/// shutdown() wakes up waiting threads immediately, they can either
+/// use wait_for_shutdown() or include wait_fd() in their poll set.
 struct running_flag {
+  /// Running, throws if the wakeup descriptor can't be created
+  running_flag();
+
+  /// Noncopyable
+  running_flag           (running_flag const&) = delete;
+  running_flag& operator=(running_flag const&) = delete;
+
   bool running() const { return running_; }
 
-  void shutdown() { running_ = false; }
+  /// Sets the flag to false and wakes up all waiters
+  void shutdown();
+
+  /// Waits until shutdown() is called, but at most timeout [s]
+  void wait_for_shutdown(double timeout) const;
+
+  /// @return A descriptor that becomes readable on shutdown() and stays
+  /// readable.  Poll it, but don't read from it.
+  nanonet::detail_::socketfd_t wait_fd() const { return wake_fd_.get(); }
 
 private:
   std::atomic_bool running_ = true;
+
+  mutable std::mutex mutex_;
+  mutable std::condition_variable cv_;
+
+  // eventfd or read end of a pipe, write end (pipe only)
+  nanonet::detail_::auto_fd wake_fd_;
+  nanonet::detail_::auto_fd wake_write_fd_;
 };
 
 /// Server manager, returned from run_server()
@@ -141,6 +170,24 @@ typedef std::function<
        const server_status&)> input_handler_type;
 
 
+//
+// Alternatively, a server can be built around a frame handler for
+// binary protocols.  Frames are length-prefixed as written by
+// nanonet::xdr::write_frame(), the handler gets the payload.
+//
+// The frame is read into a buffer that is reused for the next frame,
+// so handlers must copy whatever they need beyond their return.
+// Everything else is as for input_handler_type.
+//
+
+typedef std::function<
+  bool(std::span<const char> frame,
+       std::istream& ins,
+       std::ostream& ons,
+       std::ostream& log,
+       const server_status&)> frame_handler_type;
+
+
 //
 // This function is called at the beginning of a server to write a
 // welcome message.
@@ -149,10 +196,33 @@ typedef std::function<
 typedef std::function<
   void(std::ostream& ons, const server_status&)> os_writer;
 
+/// What to do with incoming connections if max_connections is reached
+enum class overflow_policy {
+  /// Leave them in the listen backlog until a connection closes
+  queue,
+  /// Accept, write busy_message and close
+  reject,
+  /// Accept and close immediately
+  close
+};
+
+/// Load states of a server, see server_parameters::shed_cps
+enum class load_state {
+  /// All connections are accepted
+  normal,
+  /// A growing share of new connections is shed as the load rises
+  degraded,
+  /// All new connections are shed
+  shedding
+};
+
 //
 // Connection parameters.
 // bind_address    ... The local address to bind to, default: "0.0.0.0"
-// service         ... Port, or "test:stdio" for test run on stdin/stdout
+// service         ... Port, "unix:<path>" for a Unix domain socket
+//                     (bind_address is ignored, "unix:@<name>" for the
+//                     abstract namespace) or "test:stdio" for test run
+//                     on stdin/stdout
 // server_name     ... Server name for syslog
 // n_listen_retries ... Retry this many times to listen to incoming
 //                      connections, typically to wait for the port to
@@ -161,13 +231,26 @@ typedef std::function<
 // listen_retry_time ... Time to wait for listening port to become available
 //                     after a failure to listn [s]
 // log_connections ... Whether to log connections or not
-//                     ("New connection", "Connection closing" log entries)
+//                     ("New connection", "Connection closing" log entries).
+//                     Shed, rate limited and rejected connections are only
+//                     summarized, at most once per second.
 // max_line_length ... Maximum for input lines
+// max_frame_size  ... Maximum payload size for frame handlers [bytes].
+//                     Larger frames close the connection.
+// buffer_size     ... Size of each connection's input and output stream
+//                     buffers [bytes].  Not used with event_threads.
 // timeout         ... I/O timeout.  Connections time out if during this time
 //                     nothing has been sent nor received [s].  Timeout causes
 //                     EOF on any onstream/instream.
+// read_timeout    ... If > 0, connections time out if a line or frame
+//                     isn't complete this long after its first byte
+//                     arrived [s].  Only used with event_threads.
+// write_timeout   ... If > 0, connections time out if pending output
+//                     doesn't make progress during this time [s].  Only
+//                     used with event_threads.
 // accept_timeout  ... If no connection comes in during this time, the service
-//                     cycles the accept loop, thus checking the running_flag [s].
+//                     cycles the accept loop [s].  The running_flag's
+//                     shutdown() terminates the loop immediately.
 // C_cps_{slow,medium,fast} ... Mix-in constants for the connection 
 //                     rate estimators, must be between 0 and 1
 // backlog         ... Max number of backlogged connections (see acceptor)
@@ -177,8 +260,84 @@ typedef std::function<
 //                     Setting this parameter to true can help enforce a
 //                     client-close-first policy, thus avoiding 'address
 //                     already in use' errors on server restart.
+// event_threads   ... If > 0, connections are served by this many event
+//                     loop threads (see event-loop.h, Linux only) instead
+//                     of one thread per connection.  Handlers must not
+//                     block: ins only contains input that has already
+//                     been received, and output written to ons is sent
+//                     after the handler returns.  Event loop threads
+//                     keep the idle, read and write deadlines of their
+//                     connections in a timer wheel (see timer-wheel.h).
+//                     If nanonet is built with -DNANONET_IO_URING=ON and
+//                     the kernel supports it, io_uring is used for
+//                     accepting, receiving and sending instead of epoll.
+// listen_shards   ... If > 1, this many acceptors are bound to the same
+//                     address with SO_REUSEPORT, each with its own
+//                     accept loop thread.  The kernel distributes
+//                     incoming connections over them.  Status and
+//                     connection rates are shared by all shards.
+//                     Requires a fixed service (port), ignored for Unix
+//                     domain sockets.
+// pin_listen_shards . If true, shard i's accept loop thread is pinned
+//                     to CPU i modulo the number of CPUs (Linux only).
+// handler_threads ... If > 0 and event_threads == 0, connections are
+//                     handled by a pool of this many threads instead of
+//                     one thread per connection.  Connections beyond
+//                     that wait for a free thread.
+// max_connections ... If > 0, the maximum number of connections being
+//                     served or waiting for a handler thread.  Incoming
+//                     connections beyond that are handled according to
+//                     overflow and counted in connections_rejected
+//                     unless queued.
+// overflow        ... See overflow_policy
+// peer_rate       ... If > 0, each client address may open this many
+//                     connections per second on average, with bursts
+//                     of up to peer_burst (see rate-limiter.h).  Further
+//                     connections are closed right after accept() and
+//                     counted in connections_rate_limited.
+// peer_burst      ... See peer_rate
+// peer_table_size ... Maximum number of client addresses remembered
+//                     for peer_rate, the least recently seen ones are
+//                     forgotten first.
+// shed_cps        ... If > 0, capacity in connections per second for
+//                     load shedding.  The load is the largest of
+//                     cps_estimate_fast / shed_cps, connections_current /
+//                     shed_connections and connections_queued /
+//                     shed_queued (where given).  At a load of 0.75 the
+//                     server becomes degraded and sheds a share of new
+//                     connections that grows with the load, at 1 it
+//                     sheds all of them.  It goes back to degraded below
+//                     0.9 and to normal below 0.6.  Shed connections are
+//                     closed right after accept() without busy_message
+//                     (with queue, they're left in the backlog while
+//                     shedding) and counted in connections_shed.
+// shed_connections ... If > 0, capacity in current connections for load
+//                     shedding, see shed_cps
+// shed_queued     ... If > 0, capacity in queued connections for load
+//                     shedding, see shed_cps and handler_threads
+// busy_message    ... Written to rejected connections without waiting:
+//                     It's cut off where it doesn't fit into the
+//                     socket's send buffer.
+// metrics_service ... If non-empty, a second listener on this port
+//                     (bound to bind_address) answers HTTP GET requests
+//                     for metrics_path with write_metrics(), i.e. the
+//                     status of all servers in this process.
+// metrics_path    ... See metrics_service, other paths get a 404
+// handoff_service ... If non-empty, a Unix domain control socket
+//                     ("unix:<path>") for restarts without refused
+//                     connections.  On start, the server first asks a
+//                     server running there for its listening sockets
+//                     (including metrics) and takes them over, backlog
+//                     and all.  Only if there's none, it binds itself.
+//                     It then answers such requests itself:  It passes
+//                     its listening sockets on, stops accepting, drains
+//                     its connections and shuts down.
+// handoff_drain_timeout ... After a handoff, remaining connections are
+//                     closed after this time [s]
 //
-// For test mode, timeouts, backlog and background are ignored.
+// For test mode, timeouts, backlog, background, event_threads,
+// listen_shards, handler_threads, max_connections, peer_rate, load
+// shedding, metrics_service and handoff_service are ignored.
 //
 
 struct server_parameters {
@@ -191,7 +350,11 @@ struct server_parameters {
   long   n_listen_retries = -1  ;
   double listen_retry_time = 1.0;
   long   max_line_length = 1000 ;
+  long   max_frame_size  = 1 << 20;
+  long   buffer_size     = nanonet::util::DEFAULT_BUFFER_SIZE;
   double timeout         = 60.0 ;
+  double read_timeout    = 0.0  ;
+  double write_timeout   = 0.0  ;
   double accept_timeout  = 3.0  ;
 
   double C_cps_slow   = 0.002   ;
@@ -201,14 +364,37 @@ struct server_parameters {
   int    backlog         = 0    ;
   bool   background      = false;
   bool   shutdown_wait_for_client_close = true;
+  long   event_threads   = 0    ;
+  long   listen_shards   = 1    ;
+  bool   pin_listen_shards = false;
+  long   handler_threads = 0    ;
+  long   max_connections = 0    ;
+  overflow_policy overflow = overflow_policy::queue;
+  double peer_rate       = 0.0  ;
+  double peer_burst      = 10.0 ;
+  long   peer_table_size = 65536;
+  double shed_cps        = 0.0  ;
+  long   shed_connections = 0   ;
+  long   shed_queued     = 0    ;
+  std::optional<os_writer> busy_message;
+  std::string metrics_service;
+  std::string metrics_path = "/metrics";
+  std::string handoff_service;
+  double handoff_drain_timeout = 60.0;
 };
 
-/// Server status, passed to each connection handler
+/// Server status, passed to each connection handler.  All live
+/// instances are exported by write_metrics().
 struct server_status {
-  server_status() {}
+  server_status();
+
+  server_status(const server_parameters& params);
 
-  server_status(const server_parameters& params)
-  : name(params.server_name) {}
+  ~server_status();
+
+  /// Noncopyable
+  server_status           (server_status const&) = delete;
+  server_status& operator=(server_status const&) = delete;
 
   /// Name of this server
   std::string name;
@@ -219,6 +405,31 @@ struct server_status {
   /// Current number of connections
   std::atomic_long connections_current = 0;
 
+  /// Connections rejected or closed because max_connections was
+  /// reached.  These are not included in connections_total.
+  std::atomic_llong connections_rejected = 0;
+
+  /// Connections closed because their client exceeded peer_rate.
+  /// These are not included in connections_total.
+  std::atomic_llong connections_rate_limited = 0;
+
+  /// Connections shed because of overload, see server_parameters::shed_cps.
+  /// These are not included in connections_total.
+  std::atomic_llong connections_shed = 0;
+
+  /// Current load state
+  std::atomic<load_state> load = load_state::normal;
+
+  /// Connections waiting for a free handler thread, see
+  /// server_parameters::handler_threads
+  std::atomic_long connections_queued = 0;
+
+  /// Connections timed out by their idle, read or write deadline, see
+  /// server_parameters::event_threads
+  std::atomic_llong timeouts_idle  = 0;
+  std::atomic_llong timeouts_read  = 0;
+  std::atomic_llong timeouts_write = 0;
+
   /// Connections per second estimate, long averaging
   /// See C_cps_{slow,medium,fast} above
   std::atomic<double> cps_estimate_slow   = 0.0;
@@ -228,14 +439,46 @@ struct server_status {
 
   /// Connections per second estimate, fast averaging
   std::atomic<double> cps_estimate_fast   = 0.0;
+
+  /// Time spent in the handler per input line or frame [s]
+  nanonet::math::sharded_histogram handler_time;
+
+  /// Time from accepting a connection until the first byte is sent [s]
+  nanonet::math::sharded_histogram time_to_first_byte;
+
+  /// Lifetime of closed connections [s]
+  nanonet::math::sharded_histogram connection_lifetime;
+
+  /// Bytes received and sent.  Connections with their own handler
+  /// thread only add their bytes when they are closed.
+  nanonet::math::sharded_counter bytes_received;
+  nanonet::math::sharded_counter bytes_sent;
+
+  /// Input lines or frames passed to the handler
+  nanonet::math::sharded_counter lines_received;
 };
 
 /// @return "(thread <threadid>)" for the current thread ID
 std::string this_thread_id_paren();
 
 //
-// Starts an IPv4 server on port params.service with the given
-// backlog.
+// Writes the status of all server_status instances alive in this
+// process to os in the Prometheus text exposition format (version
+// 0.0.4).  Each server is labelled with server="<name>".  The
+// buffer pool statistics (buffer-pool.h) are process wide and
+// unlabelled.
+//
+// Connections are not slowed down by this: It only reads the atomic
+// counters and merges the histogram shards.  The output is formatted
+// into a string first, so the registry isn't locked while writing to
+// os (which may be a slow peer's socket).
+//
+
+void write_metrics(std::ostream& os);
+
+//
+// Starts an IPv4 server on port params.service (or a Unix domain
+// socket server) with the given backlog.
 //
 // Logs start with params.server_name in syslog or on the given
 // ostream (sl), if non-null.  The ostream *must* outlive the
@@ -257,7 +500,9 @@ std::string this_thread_id_paren();
 // If any connection handler throws a shutdown_exception, calls
 // shutdown() on running and the server tries to shut down.
 // A shutdown can also be requested 'externally' by calling shutdown()
-// on running.
+// on running.  On shutdown, the accept loops terminate immediately
+// and connections waiting for input are closed.  Connections whose
+// handler is running are closed once it returns.
 //
 // THROWS: On errors listening to the port, e.g. privilege error
 // or address already in use.  Exceptions in connection handlers
@@ -285,6 +530,35 @@ std::string this_thread_id_paren();
     server_parameters const& params = server_parameters(),
     std::ostream* sl = nullptr);
 
+//
+// As above, but each connection runs a nanonet::xdr::read_frame() loop
+// calling handler.  With event_threads > 0, the frame refers directly
+// to the received data.
+//
+// NOTE: A std::string converts to a span, so plain functions are
+// ambiguous here.  Pass nanonet::util::frame_handler_type{frame_func}.
+//
+
+[[nodiscard]] server_manager run_server(
+    frame_handler_type const& handler,
+    running_flag& running,
+    std::optional<os_writer> welcome = std::nullopt,
+    server_parameters const& params = server_parameters(),
+    std::ostream* sl = nullptr);
+
+//
+// As above, but each connection is served by a coroutine on one of
+// params.event_threads (at least one) event loop threads, see
+// coroutine.h.  Always uses epoll, even if io_uring is available.
+// Test mode ("test:stdio") is not supported and throws.
+//
+
+[[nodiscard]] server_manager run_server(
+    coroutine_handler_type const& handler,
+    running_flag& running,
+    server_parameters const& params,
+    std::ostream* sl = nullptr);
+
 } // namespace util
 
 } // namespace nanonet
@@ -0,0 +1,132 @@
+//
+// Copyright 2015 KISS Technologies GmbH, Switzerland
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Component: NETWORK
+//
+// Receives datagrams from many sockets, e.g. multicast feeds, in one
+// thread.  The sockets share one event_loop (epoll set), readable ones
+// are read with receive_batch() and their callbacks get the whole batch.
+//
+// Usage:
+//   nanonet::util::network::udp_reactor r;
+//   auto s = datagram_socket::bound("0.0.0.0", "4711");
+//   s.join_group("239.1.2.3");
+//   r.add(std::move(s), [](datagram_socket& s,
+//                          std::span<datagram_message const> batch) {
+//     for (auto const& m : batch) { ... m.buffer.first(m.size) ... }
+//   });
+//   r.run();
+//
+// Notes:
+// * Single threaded like event_loop: Use stop() and loop().post() from
+//   other threads only.
+// * The datagrams passed to callbacks are only valid during the call.
+// * Exceptions from receive_batch() and callbacks propagate out of
+//   run_once() and run().
+// * Currently implemented on Linux only, see event_loop.
+//
+
+#ifndef NANONET_SYS_UDP_REACTOR_H
+#define NANONET_SYS_UDP_REACTOR_H
+
+#include "nanonet/buffer-pool.h"
+#include "nanonet/sys/event-loop.h"
+#include "nanonet/sys/network.h"
+
+#include <functional>
+#include <memory>
+#include <span>
+#include <unordered_map>
+#include <vector>
+
+
+namespace nanonet {
+
+namespace util {
+
+namespace network {
+
+struct udp_reactor {
+  /// Called with the datagrams received on a socket in one batch,
+  /// in order of arrival
+  typedef std::function<void(
+      datagram_socket&, std::span<datagram_message const>)> callback;
+
+  /// batch_size: Maximum number of datagrams per callback, <= MAX_BATCH
+  /// is best.
+  /// max_size: Maximum datagram size [bytes], larger ones are truncated.
+  explicit udp_reactor(long batch_size = 32, long max_size = 2048);
+
+  /// Noncopyable, nonmoveable (callbacks typically capture this)
+  udp_reactor           (udp_reactor const&) = delete;
+  udp_reactor& operator=(udp_reactor const&) = delete;
+
+  /// Takes ownership of s, makes it non-blocking and calls cb for
+  /// the datagrams received on it.
+  /// @return The registered socket, e.g. for sending or remove()
+  datagram_socket& add(datagram_socket s, callback cb);
+
+  /// Unregisters and closes s.  May be called from any callback,
+  /// including the one of s.
+  void remove(datagram_socket const& s);
+
+  /// @return Number of registered sockets
+  long size() const { return static_cast<long>(feeds_.size()); }
+
+  /// The loop the sockets are registered with, e.g. for adding other
+  /// descriptors or posting tasks
+  event_loop& loop() { return loop_; }
+
+  /// Waits at most timeout [s] for datagrams (indefinitely if
+  /// timeout < 0) and dispatches one batch per readable socket.
+  /// @return Number of callbacks and tasks run, see event_loop
+  long run_once(double const timeout) { return loop_.run_once(timeout); }
+
+  /// Dispatches until stop() is called
+  void run() { loop_.run(); }
+
+  /// Thread safe: Causes run() to return as soon as possible.
+  void stop() { loop_.stop(); }
+
+private:
+  struct feed {
+    datagram_socket socket;
+    callback cb;
+  };
+
+  void dispatch(feed& f);
+
+  event_loop loop_;
+
+  std::unordered_map<nanonet::detail_::socketfd_t,
+                     std::unique_ptr<feed>> feeds_;
+
+  // The feed whose callback is running, and the same if the callback
+  // has removed it.  It is destroyed when the callback returns.
+  feed* current_ = nullptr;
+  std::unique_ptr<feed> removed_;
+
+  // Receive buffers, shared by all sockets
+  nanonet::util::pooled_buffer buffer_;
+  std::vector<datagram_message> messages_;
+};
+
+} // namespace network
+
+} // namespace util
+
+} // namespace nanonet
+
+#endif // NANONET_SYS_UDP_REACTOR_H
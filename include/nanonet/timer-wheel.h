@@ -0,0 +1,154 @@
+//
+// Copyright 2015 KISS Technologies GmbH, Switzerland
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Component: UTIL
+//
+// A hierarchical timer wheel for large numbers of deadlines, e.g.
+// connection timeouts.
+//
+// Usage:
+//   nanonet::util::timer_wheel w(0.01, nanonet::util::utc());
+//   const auto id = w.add(42);
+//   w.arm(id, nanonet::util::utc() + 60);
+//   // Periodically, e.g. in an event loop:
+//   w.expire(nanonet::util::utc(),
+//       [](timer_wheel::timer_id, std::uint64_t const user_data) {
+//     std::cout << user_data << " expired" << std::endl;
+//   });
+//
+// Notes:
+// * Arming, rearming and disarming are O(1).  expire() takes O(1) per
+//   expired timer plus O(1) per 64 ticks elapsed, and timers move
+//   down one level at most LEVELS - 1 times in their life.
+// * Timers fire in the first expire() at or after their deadline,
+//   rounded up to the resolution.  Deadlines more than 2^30 ticks
+//   ahead are supported, their timers are cascaded more often.
+// * Times are in seconds, but may have any origin, e.g. utc() or a
+//   monotonic clock.  They must not go backwards.
+// * Not thread safe, use from one thread only.
+//
+
+#ifndef NANONET_TIMER_WHEEL_H
+#define NANONET_TIMER_WHEEL_H
+
+#include <array>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+
+namespace nanonet {
+
+namespace util {
+
+struct timer_wheel {
+  /// Identifies a timer, valid from add() to remove()
+  typedef std::uint32_t timer_id;
+
+  /// Called for each expired timer, which is disarmed at that point
+  /// and may be rearmed or removed by the handler
+  typedef std::function<void(timer_id id, std::uint64_t user_data)>
+      expiry_handler;
+
+  /// Each level has 2^SLOT_BITS slots, each slot of level l covers
+  /// 2^(l * SLOT_BITS) ticks
+  static constexpr int SLOT_BITS = 6;
+  static constexpr int SLOTS     = 1 << SLOT_BITS;
+  static constexpr int LEVELS    = 5;
+
+  /// Sets up an empty wheel with the given resolution [s] at time now
+  timer_wheel(double resolution, double now);
+
+  /// Noncopyable
+  timer_wheel           (timer_wheel const&) = delete;
+  timer_wheel& operator=(timer_wheel const&) = delete;
+
+  /// @return A new, disarmed timer carrying user_data
+  timer_id add(std::uint64_t user_data);
+
+  /// Disarms and frees a timer, its id may be reused
+  void remove(timer_id id);
+
+  /// Arms the timer to expire at deadline [s], replacing its previous
+  /// deadline.  Deadlines in the past expire on the next expire().
+  void arm(timer_id id, double deadline);
+
+  /// Disarms the timer, no-op if it's not armed
+  void disarm(timer_id id);
+
+  /// @return true iff the timer is armed
+  bool armed(timer_id id) const;
+
+  /// @return The user data given to add()
+  std::uint64_t user_data(timer_id id) const;
+
+  /// @return Number of armed timers
+  long size() const { return armed_; }
+
+  /// Advances the wheel to now [s] and calls h for each timer that
+  /// expired, in order of their deadlines rounded to the resolution.
+  /// @return Number of expired timers
+  long expire(double now, expiry_handler const& h);
+
+  /// @return A time [s] at or before the earliest deadline, infinity if
+  /// no timer is armed.  expire() has nothing to do before that.
+  double next_expiry() const;
+
+private:
+  static constexpr std::uint32_t NONE = 0xffffffff;
+
+  // Slot values other than slot indices
+  static constexpr int DISARMED = -1;
+  static constexpr int FIRED    = -2;
+  static constexpr int FREE     = -3;
+
+  struct entry {
+    std::uint64_t user_data = 0;
+    // [ticks]
+    std::uint64_t deadline = 0;
+    std::uint32_t prev = NONE;
+    std::uint32_t next = NONE;
+    // Slot index (level * SLOTS + slot), DISARMED, FIRED or FREE
+    int slot = FREE;
+  };
+
+  std::uint64_t to_ticks(double t) const;
+  void insert(timer_id id);
+  void unlink(timer_id id);
+  void cascade(int level);
+
+  double resolution_;
+  double origin_;
+
+  // The next tick to process
+  std::uint64_t current_ = 0;
+  long armed_ = 0;
+
+  std::vector<entry> entries_;
+  std::uint32_t free_ = NONE;
+
+  // Heads of the slot lists and the non-empty slots per level
+  std::array<std::uint32_t, LEVELS * SLOTS> heads_;
+  std::array<std::uint64_t, LEVELS> occupied_ = {};
+
+  // Reused by expire()
+  std::vector<timer_id> fired_;
+};
+
+} // namespace util
+
+} // namespace nanonet
+
+#endif // NANONET_TIMER_WHEEL_H
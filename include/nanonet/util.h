@@ -21,6 +21,7 @@
 #define NANONET_UTIL_H
 
 #include "nanonet/assert.h"
+#include "nanonet/buffer-pool.h"
 #include "nanonet/units.h"
 
 #include "boost/algorithm/string.hpp"
@@ -32,8 +33,10 @@
 #include <memory>
 #include <mutex>
 #include <ostream>
+#include <span>
 #include <sstream>
 #include <string>
+#include <string_view>
 #include <type_traits>
 #include <vector>
 
@@ -230,10 +233,22 @@ void mark_unused( T const& t ) {
 // size_hint can be used to tell the function to expect strings of
 // approximately that size.
 //
+// If the stream buffer has a get area (e.g., istreambuf, file and string
+// streams), the newline is searched for with find_char() and the line is
+// appended in chunks.  Otherwise, it's read character by character.
+//
 
 std::istream& getline(std::istream&, std::string& s, long maxsize,
     long size_hint = 0);
 
+//
+// Like std::memchr():  Returns a pointer to the first c in the n
+// characters at p, nullptr if there is none.
+// Uses AVX2 if the CPU supports it, SSE2 or plain C++ otherwise.
+//
+
+char const* find_char(char const* p, char c, long n);
+
 
 // Removes whitespace at the beginning and end of s
 std::string trim(const std::string& s);
@@ -315,16 +330,20 @@ std::vector<std::string> split(
 
 
 //
-// Copy is to os character-wise
+// Copy is to os in chunks of chunk_size bytes until EOF.  With
+// istreambuf/ostreambuf, large chunks bypass the stream buffers.
+// Waits for a full chunk before writing it, use line-wise copying for
+// interactive data.
 //
 
-inline void stream_copy( std::istream& is , std::ostream& os ) {
+inline void stream_copy( std::istream& is , std::ostream& os ,
+                         long const chunk_size = 65536 ) {
 
-  std::copy(
-    std::istreambuf_iterator< char >( is ) ,
-    std::istreambuf_iterator< char >(    ) ,
-    std::ostreambuf_iterator< char >( os )
-  ) ;
+  std::vector< char > buffer( chunk_size ) ;
+  while( is && os ) {
+    is.read( &buffer[ 0 ] , chunk_size ) ;
+    os.write( &buffer[ 0 ] , is.gcount() ) ;
+  }
 
 }
 
@@ -612,13 +631,43 @@ bool mem_equal( T const& t1 , T const& t2 ) {
 // read() tries to read at most n characters.  A return value of zero
 // indicates end of file.
 //
-// write() tries to write n characters.  The return value is either n or
-// -1.
+// write() tries to write n characters, retrying on partial writes.  The
+// return value is either n or -1.
+//
+// Optionally, a reader_writer may implement a gather write
+//
+//   long write( char const* buf1 , long n1 , char const* buf2 , long n2 ) ;
+//
+// writing n1 bytes from buf1 followed by n2 bytes from buf2 (n1, n2 >= 0)
+// and returning n1 + n2 or -1.  ostreambuf uses it to send large writes
+// directly from the caller's memory together with the buffered data.
+// Without it, data is always written in chunks of the buffer size (e.g.,
+// syslog_writer relies on this).
+//
+// Likewise, a scatter read
+//
+//   long read( char* buf1 , long n1 , char* buf2 , long n2 ) ;
+//
+// reading into buf2 once buf1 is full lets istreambuf refill its buffer
+// in the same call that reads a large request into the caller's memory.
+//
+// The buffers are taken from the buffer pool (buffer-pool.h).
 //
 // The buffer co-owns the reader_writer with the caller.
 // This allows for multiple buffers to be used on a single resource, 
 // e.g. an input and an output buffer on a network socket.
 //
+// Besides the std::streambuf interface, istreambuf gives parsers direct
+// access to its buffer, avoiding a copy and a virtual call per
+// character:
+//   auto& buf = is.buffer() ;   // e.g. for an instream is
+//   while( true ) {
+//     auto const line = buf.read_until( '\n' ) ;
+//     if( line.empty() ) { break ; }   // EOF or line too long
+//     ...
+//   }
+// Views and spans are valid until the next read from the buffer.
+//
 // This implementation is based on code by Nico Josuttis which was 
 // accompanied by the following notice:
 /*
@@ -644,7 +693,6 @@ bool mem_equal( T const& t1 , T const& t2 ) {
 //
 // See also the crypt_istreambuf implementation.
 //
-// TODO: Implement xsputn().
 // TODO: Maybe get rid of virtual inheritance.
 //       In this case, the 'most derived' class initializes the virtual base,
 //       causing significant confusion.
@@ -660,6 +708,14 @@ bool mem_equal( T const& t1 , T const& t2 ) {
  *      - i18n
  */
 
+// Default buffer size for istreambuf and ostreambuf [bytes], may be
+// set at compile time (cmake -DNANONET_BUFFER_SIZE=...).
+#ifndef NANONET_DEFAULT_BUFFER_SIZE
+#  define NANONET_DEFAULT_BUFFER_SIZE 1024
+#endif
+constexpr int DEFAULT_BUFFER_SIZE = NANONET_DEFAULT_BUFFER_SIZE ;
+static_assert( DEFAULT_BUFFER_SIZE >= 1 ) ;
+
 template
 < typename RW >
 struct ostreambuf : std::streambuf {
@@ -685,7 +741,8 @@ struct ostreambuf : std::streambuf {
   // Construct an ostreambuf on resource r with buffer size.
   //
 
-  ostreambuf( std::shared_ptr<RW> const rw , int const size = 1024 )
+  ostreambuf( std::shared_ptr<RW> const rw ,
+              int const size = DEFAULT_BUFFER_SIZE )
   : rw    ( rw   ) ,
     buffer( size )
   { 
@@ -695,7 +752,7 @@ struct ostreambuf : std::streambuf {
 
   }
 
-  ostreambuf( int const size = 1024 )
+  ostreambuf( int const size = DEFAULT_BUFFER_SIZE )
   : rw    ( NULL  ) ,
     buffer(  size ) {
 
@@ -752,6 +809,13 @@ protected:
 
   virtual int sync() { return flush() ? 0 : -1 ; }
 
+  //
+  // Given a gather write, writes of at least the buffer size bypass the
+  // buffer and are sent together with the buffered data.
+  //
+
+  virtual std::streamsize xsputn( char const* s , std::streamsize n ) ;
+
 
 private:
 
@@ -763,7 +827,8 @@ private:
 
   std::shared_ptr<RW> rw ; 
   
-  std::vector< char > buffer ;
+  // From the buffer pool, see buffer-pool.h
+  pooled_buffer buffer ;
 
 } ;
 
@@ -796,12 +861,12 @@ struct istreambuf : virtual std::streambuf {
 
   istreambuf( 
     std::shared_ptr<RW> rw   , 
-    int const size    = 1024 ,
+    int const size    = DEFAULT_BUFFER_SIZE ,
     int const size_pb = 4 
   ) 
   : rw( rw ) ,
     size_pb( size_pb ) ,
-    buffer( size + size_pb , 0 ) {
+    buffer( size + size_pb ) {
 
     always_assert( size    >= 1 ) ;
     always_assert( size_pb >= 1 ) ;
@@ -825,18 +890,65 @@ struct istreambuf : virtual std::streambuf {
   virtual ~istreambuf() 
   { if (rw) { rw->shutdown_read() ; } }
 
+  //
+  // Direct buffer access, see above.
+  //
+
+  // Returns the data read but not yet consumed, without reading.
+  std::span< char const > peek_span() const 
+  { return std::span< char const >( gptr() , egptr() ) ; }
+
+  // Returns the number of bytes read but not yet consumed
+  long available() const { return egptr() - gptr() ; }
+
+  // Returns the number of bytes the buffer can hold (without putback)
+  long capacity() const { return buffer.size() - size_pb ; }
+
+  // Marks the first n available bytes as consumed
+  void consume( long const n ) {
+    always_assert( 0 <= n && n <= available() ) ;
+    setg( eback() , gptr() + n , egptr() ) ;
+  }
+
+  // Reads until at least min_bytes are available, growing the buffer
+  // if necessary.
+  // Returns available(), less than min_bytes on EOF or error.
+  long fill( long min_bytes ) ;
+
+  // Reads until delim is available and returns the data up to and
+  // including it, which is consumed.
+  // Returns an empty view and consumes nothing if there's no delim in
+  // the first max_size bytes or before EOF or error.  The buffer grows
+  // up to max_size if necessary.
+  std::string_view read_until( char delim , long max_size ) ;
+
+  // As above, max_size is the capacity
+  std::string_view read_until( char const delim ) 
+  { return read_until( delim , capacity() ) ; }
+
 protected:
 
   virtual int_type underflow() ;
 
+  // Requests of at least the buffer capacity are read directly into s,
+  // refilling the buffer in the same read if possible.
+  virtual std::streamsize xsgetn( char* s , std::streamsize n ) ;
+
 private:
 
+  // Moves the available data to the front, keeping up to size_pb
+  // characters of putback, and reads once.  Grows the buffer to hold at
+  // least min_bytes.
+  // Returns false on EOF or error.
+  bool read_more( long min_bytes ) ;
+
   std::shared_ptr<RW> rw ;
 
   // Size of putback area.
   int const size_pb ; 
 
-  std::vector< char > buffer ;
+  // From the buffer pool, see buffer-pool.h
+  pooled_buffer buffer ;
 
 } ;
 
@@ -883,13 +995,14 @@ struct auto_resource {
 
   ~auto_resource() { dispose() ; }
 
+  // Gives up ownership and returns the handle
+  R release() 
+  { R const ret = h ; h = T::invalid() ; return ret ; }
+
 private:
 
   void dispose() const { if( T::valid( h ) ) { T::dispose( h ) ; } }
 
-  R release() 
-  { R const ret = h ; h = T::invalid() ; return ret ; }
-
   R h ;
 
 } ;
@@ -945,32 +1058,164 @@ bool nanonet::util::ostreambuf< RW >::flush() {
 
 
 template< typename RW >
-typename nanonet::util::istreambuf< RW >::int_type
-nanonet::util::istreambuf< RW >::underflow() {
+std::streamsize nanonet::util::ostreambuf< RW >::xsputn(
+    char const* const s , std::streamsize const n ) {
 
-  if( gptr() < egptr() ) 
-  { return traits_type::to_int_type( *gptr() ) ; }
+  if( n <= epptr() - pptr() ) {
+    std::memcpy( pptr() , s , n ) ;
+    pbump( n ) ;
+    return n ;
+  }
+
+  if constexpr( requires( RW& w ) { w.write( s , 1L , s , 1L ) ; } ) {
+    if( rw && n >= static_cast< std::streamsize >( buffer.size() ) ) {
+      long const n_buffered = pptr() - pbase() ;
+      if( rw->write( pbase() , n_buffered , s , n ) < 0 ) { return 0 ; }
+      pbump( -n_buffered ) ;
+      return n ;
+    }
+  }
+
+  return std::streambuf::xsputn( s , n ) ;
 
-  int const n_pb = 
+}
+
+
+template< typename RW >
+bool nanonet::util::istreambuf< RW >::read_more( long const min_bytes ) {
+
+  long const n_pb = 
     std::min( 
       static_cast< long >( gptr() - eback() ) , 
       static_cast< long >( size_pb          ) 
     ) ;
+  long const n_available = available() ;
+
+  // Putback and unread data go to the front, unread data starting
+  // at size_pb.  Regions may overlap.
+  pooled_buffer grown ;
+  char* dest = &buffer[ 0 ] ;
+  if( size_pb + min_bytes > buffer.size() ) {
+    grown = pooled_buffer( size_pb + min_bytes ) ;
+    dest = &grown[ 0 ] ;
+  }
+  std::memmove( dest + size_pb - n_pb , gptr() - n_pb , n_pb + n_available ) ;
+  if( !grown.empty() ) { buffer.swap( grown ) ; }
 
-  std::memmove( &buffer[ 0 ] + size_pb - n_pb , gptr() - n_pb , n_pb ) ;
+  setg(
+    &buffer[ 0 ] + size_pb - n_pb           , // beginning of putback area
+    &buffer[ 0 ] + size_pb                  , // read position
+    &buffer[ 0 ] + size_pb + n_available      // end of buffer
+  ) ;
 
   long const read = 
-    rw->read( &buffer[ 0 ] + size_pb , buffer.size() - size_pb ) ;
+    rw->read( egptr() , buffer.size() - size_pb - n_available ) ;
   
-  if( read <= 0 ) { return traits_type::eof() ; }
+  if( read <= 0 ) { return false ; }
 
-  setg(
-    &buffer[ 0 ] + size_pb - n_pb , // beginning of putback area
-    &buffer[ 0 ] + size_pb        , // read position
-    &buffer[ 0 ] + size_pb + read   // end of buffer
-  ) ;
+  setg( eback() , gptr() , egptr() + read ) ;
+  return true ;
+
+}
+
+template< typename RW >
+std::streamsize nanonet::util::istreambuf< RW >::xsgetn( 
+    char* const s , std::streamsize const n ) {
+
+  std::streamsize done = 0 ;
+  while( done < n ) {
+
+    if( available() > 0 ) {
+      long const k = std::min( static_cast< long >( n - done ) , available() ) ;
+      std::memcpy( s + done , gptr() , k ) ;
+      consume( k ) ;
+      done += k ;
+      continue ;
+    }
+
+    if( !rw ) { break ; }
+
+    long const want = n - done ;
+    if( want < capacity() ) {
+      if( !read_more( 1 ) ) { break ; }
+      continue ;
+    }
+
+    char* const p = &buffer[ 0 ] + size_pb ;
+    long n_read ;
+    if constexpr( requires( RW& r ) { r.read( s , 1L , s , 1L ) ; } ) 
+    { n_read = rw->read( s + done , want , p , capacity() ) ; }
+    else 
+    { n_read = rw->read( s + done , want ) ; }
+
+    if( n_read <= 0 ) { break ; }
+
+    // Anything beyond want went into the buffer.  The putback area
+    // gets the last characters delivered.
+    long const direct = std::min( n_read , want ) ;
+    done += direct ;
+    long const n_pb = std::min( static_cast< long >( done ) , 
+                                static_cast< long >( size_pb ) ) ;
+    std::memcpy( p - n_pb , s + done - n_pb , n_pb ) ;
+    setg( p - n_pb , p , p + ( n_read - direct ) ) ;
+
+  }
+
+  return done ;
 
-  return traits_type::to_int_type( *gptr() ) ;
+}
+
+template< typename RW >
+typename nanonet::util::istreambuf< RW >::int_type
+nanonet::util::istreambuf< RW >::underflow() {
+
+  if( gptr() < egptr() || read_more( 1 ) ) 
+  { return traits_type::to_int_type( *gptr() ) ; }
+
+  return traits_type::eof() ;
+
+}
+
+template< typename RW >
+long nanonet::util::istreambuf< RW >::fill( long const min_bytes ) {
+
+  while( available() < min_bytes ) {
+    if( !read_more( min_bytes ) ) { break ; }
+  }
+
+  return available() ;
+
+}
+
+template< typename RW >
+std::string_view 
+nanonet::util::istreambuf< RW >::read_until( 
+    char const delim , long const max_size ) {
+
+  // Bytes already searched
+  long scanned = 0 ;
+
+  while( true ) {
+    long const n = std::min( available() , max_size ) ;
+    if( n > scanned ) {
+      char const* const found = find_char( gptr() + scanned , delim , n - scanned ) ;
+      if( found ) {
+        long const size = found - gptr() + 1 ;
+        std::string_view const ret( gptr() , size ) ;
+        consume( size ) ;
+        return ret ;
+      }
+      scanned = n ;
+    }
+
+    if( scanned >= max_size ) { return std::string_view() ; }
+
+    // Grow geometrically if the buffer is full
+    long const want = 
+        available() < capacity() ? available() + 1 : 2 * capacity() ;
+    if( !read_more( std::min( want , max_size ) ) ) 
+    { return std::string_view() ; }
+  }
 
 }
 
@@ -34,6 +34,12 @@
 //
 // We assume 2's complement representation for integers and IEEE for floats.
 //
+// Frames for binary protocols on streams are variable-length opaque data:
+// A 32 bit length, the payload and padding to a multiple of 4 bytes.
+//   nanonet::xdr::write_frame(os, payload);
+//   std::vector<char> buf;
+//   while (nanonet::xdr::read_frame(is, buf, max_size)) { use(buf); }
+//
 // TODO/WARNING:
 // * 16 bit variants *do not pad* to multiples of 4 bytes!!
 // * Remove 16 bit variants?  XDR is always on multiples of 4...
@@ -49,9 +55,12 @@
 #include <fstream>
 #include <iostream>
 #include <limits>
+#include <span>
+#include <stdexcept>
 #include <string>
 #include <typeinfo>
 #include <type_traits>
+#include <vector>
 
 
 namespace nanonet {
@@ -191,6 +200,49 @@ std::string read_string(IT& it, unsigned long const size) {
   return ret;
 }
 
+/// Size of the length field of a frame
+constexpr std::size_t FRAME_HEADER_SIZE = 4;
+
+/// Writes payload as a frame to os
+inline void write_frame(std::ostream& os, std::span<const char> const payload) {
+  always_assert(payload.size() <= std::numeric_limits<std::uint32_t>::max());
+  char header[FRAME_HEADER_SIZE];
+  char* it = &header[0];
+  write(it, static_cast<std::uint32_t>(payload.size()));
+
+  static const char zeros[4] = {};
+  os.write(header, FRAME_HEADER_SIZE);
+  os.write(payload.data(), payload.size());
+  os.write(zeros, padsize(payload.size()));
+}
+
+/// Reads the next frame from is into buf, resizing it to the payload
+/// size.  buf can be reused for subsequent frames, it only allocates
+/// if a frame is larger than all previous ones.
+/// @return true on success, false on EOF, timeout etc. like getline()
+/// THROWS: If the frame is larger than max_size
+inline bool read_frame(
+    std::istream& is, std::vector<char>& buf, std::size_t const max_size) {
+  char header[FRAME_HEADER_SIZE];
+  if (not is.read(header, FRAME_HEADER_SIZE)) {
+    return false;
+  }
+  char const* it = &header[0];
+  const std::size_t size = read_integer<false, 32>(it);
+  if (size > max_size) {
+    throw std::runtime_error(
+        "xdr: frame size " + std::to_string(size)
+      + " exceeds maximum of " + std::to_string(max_size));
+  }
+
+  buf.resize(size + padsize(size));
+  if (not is.read(buf.data(), buf.size())) {
+    return false;
+  }
+  buf.resize(size);
+  return true;
+}
+
 #if 0
 // Signed integers
 template<typename IT> int16_t read_s16(IT& it) 
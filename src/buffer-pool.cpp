@@ -0,0 +1,199 @@
+//
+// Copyright 2015 KISS Technologies GmbH, Switzerland
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "nanonet/buffer-pool.h"
+
+#include "nanonet/assert.h"
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <mutex>
+#include <vector>
+
+
+namespace {
+
+constexpr int MIN_SHIFT = std::bit_width(
+    static_cast<unsigned long>(nanonet::util::MIN_POOLED_SIZE - 1));
+constexpr int MAX_SHIFT = std::bit_width(
+    static_cast<unsigned long>(nanonet::util::MAX_POOLED_SIZE - 1));
+constexpr int CLASSES = MAX_SHIFT - MIN_SHIFT + 1;
+
+static_assert(nanonet::util::MIN_POOLED_SIZE == 1L << MIN_SHIFT);
+static_assert(nanonet::util::MAX_POOLED_SIZE == 1L << MAX_SHIFT);
+
+std::atomic<long long> hits{0};
+std::atomic<long long> misses{0};
+std::atomic<long long> bytes_held{0};
+
+// @return Size class of a buffer of size bytes, -1 if not pooled
+int size_class(long const size) {
+  if (size > nanonet::util::MAX_POOLED_SIZE) {
+    return -1;
+  }
+  int const shift = std::bit_width(static_cast<unsigned long>(size - 1));
+  return std::max(shift, MIN_SHIFT) - MIN_SHIFT;
+}
+
+long class_size(int const c) {
+  return 1L << (c + MIN_SHIFT);
+}
+
+// Maximum number of free buffers per size class
+long max_count(int const c, long const bytes) {
+  return std::max(bytes / class_size(c), 2L);
+}
+
+struct global_pool {
+  std::mutex mutex;
+  std::vector<char*> free[CLASSES];
+};
+
+// Never destroyed, buffers may still be released during static
+// destruction.
+global_pool& global() {
+  static global_pool* const ret = new global_pool;
+  return *ret;
+}
+
+// Moves p to the global pool or frees it
+void release_global(char* const p, int const c) {
+  {
+    global_pool& g = global();
+    std::lock_guard<std::mutex> lock{g.mutex};
+    if (static_cast<long>(g.free[c].size())
+        < max_count(c, nanonet::util::GLOBAL_POOL_BYTES)) {
+      g.free[c].push_back(p);
+      bytes_held += class_size(c);
+      return;
+    }
+  }
+  delete[] p;
+}
+
+struct local_cache {
+  std::vector<char*> free[CLASSES];
+  ~local_cache();
+};
+
+// Set on thread exit, trivially destructible so that it remains
+// accessible after local_cache has been destroyed.
+thread_local bool local_cache_gone = false;
+
+// @return The calling thread's cache, nullptr during thread exit
+local_cache* local() {
+  if (local_cache_gone) {
+    return nullptr;
+  }
+  thread_local local_cache ret;
+  return &ret;
+}
+
+local_cache::~local_cache() {
+  local_cache_gone = true;
+  for (int c = 0; c < CLASSES; ++c) {
+    for (char* const p : free[c]) {
+      bytes_held -= class_size(c);
+      release_global(p, c);
+    }
+  }
+}
+
+} // end anonymous namespace
+
+
+char* nanonet::detail_::buffer_pool_allocate(long const size) {
+  always_assert(size >= 1);
+  int const c = size_class(size);
+  if (c < 0) {
+    ++misses;
+    return new char[size];
+  }
+
+  char* ret = nullptr;
+  if (local_cache* const l = local(); l && !l->free[c].empty()) {
+    ret = l->free[c].back();
+    l->free[c].pop_back();
+  } else {
+    global_pool& g = global();
+    std::lock_guard<std::mutex> lock{g.mutex};
+    if (!g.free[c].empty()) {
+      ret = g.free[c].back();
+      g.free[c].pop_back();
+    }
+  }
+
+  if (ret) {
+    ++hits;
+    bytes_held -= class_size(c);
+    return ret;
+  }
+
+  ++misses;
+  return new char[class_size(c)];
+}
+
+void nanonet::detail_::buffer_pool_release(
+    char* const p, long const size) {
+  int const c = size_class(size);
+  if (c < 0) {
+    delete[] p;
+    return;
+  }
+
+  if (local_cache* const l = local();
+      l && static_cast<long>(l->free[c].size())
+           < max_count(c, nanonet::util::LOCAL_CACHE_BYTES)) {
+    l->free[c].push_back(p);
+    bytes_held += class_size(c);
+    return;
+  }
+
+  release_global(p, c);
+}
+
+nanonet::util::buffer_pool_statistics nanonet::util::buffer_pool_stats() {
+  buffer_pool_statistics ret;
+  ret.hits       = hits;
+  ret.misses     = misses;
+  ret.bytes_held = bytes_held;
+  return ret;
+}
+
+void nanonet::util::buffer_pool_trim() {
+  std::vector<char*> to_free[CLASSES];
+  if (local_cache* const l = local()) {
+    for (int c = 0; c < CLASSES; ++c) {
+      to_free[c].swap(l->free[c]);
+    }
+  }
+  {
+    global_pool& g = global();
+    std::lock_guard<std::mutex> lock{g.mutex};
+    for (int c = 0; c < CLASSES; ++c) {
+      to_free[c].insert(to_free[c].end(), g.free[c].begin(), g.free[c].end());
+      g.free[c].clear();
+    }
+  }
+
+  for (int c = 0; c < CLASSES; ++c) {
+    for (char* const p : to_free[c]) {
+      bytes_held -= class_size(c);
+      delete[] p;
+    }
+  }
+}
@@ -21,6 +21,8 @@
 
 #include "nanonet/math-util.h"
 
+#include <cmath>
+
 using nanonet::detail_::socketfd_t;
 using nanonet::detail_::invalid_socket;
 
@@ -93,6 +95,40 @@ socketfd_t nanonet::detail_::my_accept( socketfd_t const fd ) {
 
 }
 
+socketfd_t nanonet::detail_::my_accept4(
+    socketfd_t const fd, sockaddr* const a, socklen_t* const len,
+    bool const nonblocking) {
+
+  // A connection aborted before we got to it is not an error for us,
+  // just try the next one.
+  socketfd_t ret ;
+#if (BOOST_OS_LINUX)
+  const int flags = SOCK_CLOEXEC | (nonblocking ? SOCK_NONBLOCK : 0);
+  do { ret = ::accept4( fd , a , len , flags ) ; }
+  while( EINTR_repeat( ret ) || ( ret < 0 && ECONNABORTED == errno ) ) ;
+#else
+  do { ret = ::accept( fd , a , len ) ; }
+  while( EINTR_repeat( ret ) || ( ret < 0 && ECONNABORTED == errno ) ) ;
+#endif
+
+  if( nanonet::detail_::invalid_socket() == ret ) {
+    if( EAGAIN == errno || EWOULDBLOCK == errno ) {
+      return ret ;
+    }
+    throw_socket_error( "accept" ) ;
+  }
+
+#if (not BOOST_OS_LINUX)
+  // Some platforms inherit O_NONBLOCK from the listening socket
+  ::fcntl( ret , F_SETFD , FD_CLOEXEC ) ;
+  nanonet::detail_::bool_fcntl_option(
+      ret, O_NONBLOCK, "Setting nonblocking mode", nonblocking);
+#endif
+
+  return ret ;
+
+}
+
 socketfd_t nanonet::detail_::my_accept(const socketfd_t fd, const double timeout) {
   if (timeout < 0) {
     return nanonet::detail_::my_accept(fd);
@@ -109,11 +145,13 @@ socketfd_t nanonet::detail_::my_accept(const socketfd_t fd, const double timeout
   // OK, the poll() call succeeded and no timeout occurred.  This is the only
   // thing we're interested in, so we ignore the revents field.
 
-  // May throw if it fails
-  const socketfd_t ret = nanonet::detail_::my_accept(fd);
+  // May throw if it fails.  The returned connected socket is blocking.
+  const socketfd_t ret = nanonet::detail_::my_accept4(fd, nullptr, nullptr, false);
 
-  // Ensure that the returned connected socket is blocking
-  nanonet::detail_::bool_fcntl_option(ret, O_NONBLOCK, "Disabling nonblocking mode", false);
+  // The connection may have been reset in the meantime
+  if (nanonet::detail_::invalid_socket() == ret) {
+    nanonet::util::throw_timeout_exception();
+  }
 
   return ret;
 }
@@ -148,8 +186,11 @@ void nanonet::detail_::my_connect(
   { ret = ::connect( fd , a , len ) ; }
   while( EINTR_repeat( ret ) ) ;
 
-  // Success, even though unlikely given that the socket is nonblocking (?)
+  // Success, even though unlikely given that the socket is nonblocking
+  // (but common for Unix domain sockets)
   if (ret >= 0) {
+    nanonet::detail_::bool_fcntl_option(
+        fd, O_NONBLOCK, "Enabling nonblocking mode", false);
     return;
   }
 
@@ -182,6 +223,15 @@ void nanonet::detail_::my_connect(
       fd, O_NONBLOCK, "Enabling nonblocking mode", false);
 }
 
+bool nanonet::detail_::wait_readable(
+    const socketfd_t fd, const double timeout) {
+  if (timeout < 0) {
+    return true;
+  }
+  // Round up, don't busy-wait for timeouts below 1ms
+  return ::poll_one(fd, POLLIN, std::ceil(timeout * 1e3) / 1e3, "receive") > 0;
+}
+
 long nanonet::detail_::my_send( socketfd_t const fd , char const* p , long n ) {
 
   long ret ;
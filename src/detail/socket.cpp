@@ -23,5 +23,7 @@
 int nanonet::detail_::check_socktype( int const type )
 { always_assert( SOCK_DGRAM == type || SOCK_STREAM == type ) ; return type ; }
 
-int nanonet::detail_::check_family( int const family )
-{ always_assert( AF_INET == family || AF_INET6 == family ) ; return family ; }
+int nanonet::detail_::check_family( int const family ) {
+  always_assert( AF_INET == family || AF_INET6 == family || AF_UNIX == family ) ;
+  return family ;
+}
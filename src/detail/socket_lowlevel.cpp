@@ -9,6 +9,8 @@
 
 #include "nanonet/detail/platform_definition.h"
 
+#include <cstring>
+
 using nanonet::detail_::socketfd_t;
 
 namespace {
@@ -90,6 +92,29 @@ int nanonet::detail_::socketsend( socketfd_t const fd , char const* const data ,
   return send( fd , data , size , flags ) ;
 }
 
+int nanonet::detail_::socketsend_nonblocking(
+    socketfd_t const fd , char const* const data , std::size_t const size ) {
+#if (BOOST_OS_LINUX)
+  const int flags = MSG_NOSIGNAL | MSG_DONTWAIT ;
+#else
+  const int flags = MSG_DONTWAIT ;
+#endif
+  return send( fd , data , size , flags ) ;
+}
+
+long nanonet::detail_::socketsendv( socketfd_t const fd , 
+    ::iovec const* const iov , int const iovcnt ) {
+#if (BOOST_OS_LINUX)
+  const int flags = MSG_NOSIGNAL ;
+#else
+  const int flags = 0 ;
+#endif
+  ::msghdr msg{} ;
+  msg.msg_iov    = const_cast< ::iovec* >( iov ) ;
+  msg.msg_iovlen = iovcnt ;
+  return ::sendmsg( fd , &msg , flags ) ;
+}
+
 void nanonet::detail_::setup_stream_socket( socketfd_t const fd ) {
 #if (BOOST_OS_MACOS)
   bool_sockopt( fd , SO_NOSIGPIPE ) ;
@@ -97,3 +122,38 @@ void nanonet::detail_::setup_stream_socket( socketfd_t const fd ) {
   static_cast<void>(fd);
 #endif
 }
+
+void nanonet::detail_::receive_timestamps( 
+    socketfd_t const fd , bool const enable ) {
+#if (BOOST_OS_LINUX)
+  bool_sockopt( fd , SO_TIMESTAMPNS , enable ) ;
+#else
+  bool_sockopt( fd , SO_TIMESTAMP , enable ) ;
+#endif
+}
+
+double nanonet::detail_::receive_timestamp( ::msghdr const& msg ) {
+  if( msg.msg_controllen < sizeof( ::cmsghdr ) ) {
+    return 0 ;
+  }
+  for( ::cmsghdr const* cmsg = CMSG_FIRSTHDR( &msg ) ; cmsg ;
+       cmsg = CMSG_NXTHDR( const_cast< ::msghdr* >( &msg ) ,
+                           const_cast< ::cmsghdr* >( cmsg ) ) ) {
+    if( SOL_SOCKET != cmsg->cmsg_level ) {
+      continue ;
+    }
+#if (BOOST_OS_LINUX)
+    if( SCM_TIMESTAMPNS == cmsg->cmsg_type ) {
+      ::timespec ts ;
+      std::memcpy( &ts , CMSG_DATA( cmsg ) , sizeof( ts ) ) ;
+      return ts.tv_sec + 1e-9 * ts.tv_nsec ;
+    }
+#endif
+    if( SCM_TIMESTAMP == cmsg->cmsg_type ) {
+      ::timeval tv ;
+      std::memcpy( &tv , CMSG_DATA( cmsg ) , sizeof( tv ) ) ;
+      return tv.tv_sec + 1e-6 * tv.tv_usec ;
+    }
+  }
+  return 0 ;
+}
@@ -0,0 +1,188 @@
+//
+// Copyright 2015 KISS Technologies GmbH, Switzerland
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "nanonet/histogram.h"
+
+#include "nanonet/assert.h"
+
+#include <algorithm>
+#include <bit>
+
+#include <cmath>
+
+using nanonet::math::histogram;
+
+namespace {
+
+// Values beyond that go into the last bucket [us]
+constexpr std::uint64_t MAX_VALUE =
+    (std::uint64_t{1} << (histogram::MAX_EXPONENT + 1)) - 1;
+
+// @return x [s] in microseconds, clamped to [0, MAX_VALUE]
+std::uint64_t to_us(const double x) {
+  if (not (x > 0)) {
+    return 0;
+  }
+  const double us = std::round(x * 1e6);
+  if (us >= MAX_VALUE) {
+    return MAX_VALUE;
+  }
+  return static_cast<std::uint64_t>(us);
+}
+
+// Values below SUB_BUCKETS have a bucket of their own.  Above, the
+// bucket is given by the position e of the highest bit and the
+// following SUB_BUCKET_BITS bits.
+int bucket_us(const std::uint64_t v) {
+  if (v < histogram::SUB_BUCKETS) {
+    return static_cast<int>(v);
+  }
+  const int e = std::bit_width(v) - 1;
+  const int sub = static_cast<int>(v >> (e - histogram::SUB_BUCKET_BITS))
+                - histogram::SUB_BUCKETS;
+  return histogram::SUB_BUCKETS * (e - histogram::SUB_BUCKET_BITS + 1) + sub;
+}
+
+// Inverse of bucket_us(), the smallest value in bucket i [us]
+std::uint64_t lower_bound_us(const int i) {
+  if (i < histogram::SUB_BUCKETS) {
+    return i;
+  }
+  const int e = i / histogram::SUB_BUCKETS + histogram::SUB_BUCKET_BITS - 1;
+  const std::uint64_t sub = i % histogram::SUB_BUCKETS;
+  return (histogram::SUB_BUCKETS + sub) << (e - histogram::SUB_BUCKET_BITS);
+}
+
+} // anonymous namespace
+
+
+int nanonet::math::histogram::bucket(const double x) {
+  return bucket_us(to_us(x));
+}
+
+double nanonet::math::histogram::lower_bound(const int i) {
+  always_assert(0 <= i and i < BUCKETS);
+  return 1e-6 * lower_bound_us(i);
+}
+
+double nanonet::math::histogram::upper_bound(const int i) {
+  always_assert(0 <= i and i < BUCKETS);
+  if (BUCKETS - 1 == i) {
+    return 1e-6 * (MAX_VALUE + 1);
+  }
+  return 1e-6 * lower_bound_us(i + 1);
+}
+
+void nanonet::math::histogram::record(const double x) {
+  add(bucket(x), 1, 1e-6 * to_us(x));
+}
+
+void nanonet::math::histogram::add(
+    const int i, const std::uint64_t count, const double sum) {
+  always_assert(0 <= i and i < BUCKETS);
+  counts_[i] += count;
+  count_ += count;
+  sum_ += sum;
+}
+
+void nanonet::math::histogram::merge(histogram const& other) {
+  for (int i = 0; i < BUCKETS; ++i) {
+    counts_[i] += other.counts_[i];
+  }
+  count_ += other.count_;
+  sum_ += other.sum_;
+}
+
+double nanonet::math::histogram::mean() const {
+  if (0 == count_) {
+    return 0;
+  }
+  return sum_ / count_;
+}
+
+// Returns the middle of the bucket containing the value of the given
+// rank, which keeps the relative error below 1/32.
+double nanonet::math::histogram::quantile(const double q) const {
+  if (0 == count_) {
+    return 0;
+  }
+  const double qq = std::clamp(q, 0.0, 1.0);
+  const std::uint64_t rank = std::max<std::uint64_t>(
+      1, static_cast<std::uint64_t>(std::ceil(qq * count_)));
+
+  std::uint64_t seen = 0;
+  for (int i = 0; i < BUCKETS; ++i) {
+    seen += counts_[i];
+    if (seen >= rank) {
+      if (i < SUB_BUCKETS) {
+        return lower_bound(i);
+      }
+      return 0.5 * (lower_bound(i) + upper_bound(i));
+    }
+  }
+  // Not reached
+  return lower_bound(BUCKETS - 1);
+}
+
+int nanonet::math::this_thread_shard() {
+  // Unsigned, so that the index stays in [0, SHARDS) after wrapping
+  static std::atomic<unsigned> next{0};
+  thread_local const int shard =
+      next.fetch_add(1, std::memory_order_relaxed) % SHARDS;
+  return shard;
+}
+
+nanonet::math::sharded_histogram::sharded_histogram()
+: shards_(std::make_unique<shard[]>(SHARDS))
+{}
+
+void nanonet::math::sharded_histogram::record(const double x) {
+  shard& s = shards_[this_thread_shard()];
+  const std::uint64_t us = to_us(x);
+  s.counts[bucket_us(us)].fetch_add(1, std::memory_order_relaxed);
+  s.sum.fetch_add(us, std::memory_order_relaxed);
+}
+
+nanonet::math::histogram nanonet::math::sharded_histogram::snapshot() const {
+  histogram ret;
+  for (int j = 0; j < SHARDS; ++j) {
+    shard const& s = shards_[j];
+    for (int i = 0; i < histogram::BUCKETS; ++i) {
+      const std::uint64_t n = s.counts[i].load(std::memory_order_relaxed);
+      if (n) {
+        ret.add(i, n, 0);
+      }
+    }
+    ret.add(0, 0, 1e-6 * s.sum.load(std::memory_order_relaxed));
+  }
+  return ret;
+}
+
+nanonet::math::sharded_counter::sharded_counter()
+: shards_(std::make_unique<shard[]>(SHARDS))
+{}
+
+void nanonet::math::sharded_counter::add(const std::uint64_t n) {
+  shards_[this_thread_shard()].value.fetch_add(n, std::memory_order_relaxed);
+}
+
+std::uint64_t nanonet::math::sharded_counter::value() const {
+  std::uint64_t ret = 0;
+  for (int j = 0; j < SHARDS; ++j) {
+    ret += shards_[j].value.load(std::memory_order_relaxed);
+  }
+  return ret;
+}
@@ -24,11 +24,17 @@
 #include "nanonet/detail/socket_lowlevel.h"
 #include "nanonet/sys/syslogger.h"
 
+#include <algorithm>
 #include <string>
 #include <sstream>
 #include <exception>
 #include <stdexcept>
 
+#if (BOOST_OS_LINUX)
+#  include <netinet/udp.h>
+#endif
+
+#include <cstdint>
 #include <cstring>
 #include <cstdlib>
 #include <cassert>
@@ -57,10 +63,31 @@ long my_sendto
   return nanonet::detail_::my_sendto(fd, a.sockaddr_pointer(), a.length(), p, n);
 }
 
+// Removes the file of a Unix domain socket at a if nobody is listening
+// on it any more, e.g. left over from a previous run.
+// Returns true iff the file was removed.
+template< int type >
+bool remove_stale( address< type > const& a ) {
+  std::string const path = a.host() ;
+  if( AF_UNIX != a.family_detail_() || path.empty() || '@' == path[ 0 ] ) {
+    return false ;
+  }
+
+  nanonet::detail_::socket< type > probe( AF_UNIX ) ;
+  int ret ;
+  do { ret = ::connect( probe.fd() , a.sockaddr_pointer() , a.length() ) ; }
+  while( EINTR_repeat( ret ) ) ;
+
+  return ret < 0 && ECONNREFUSED == errno && 0 == ::unlink( path.c_str() ) ;
+}
+
 // Returns a socket bound to the first matching address in la
 // or throws.
+// reuse_port is ignored for Unix domain sockets, stale socket files
+// are replaced.
 template< int type > nanonet::detail_::socket< type >
-bound_socket( std::vector< address< type > > const& la ) {
+bound_socket( std::vector< address< type > > const& la ,
+              bool const reuse_port = false ) {
 
   std::string err ;
 
@@ -72,6 +99,18 @@ bound_socket( std::vector< address< type > > const& la ) {
     try {
 
       nanonet::detail_::socket< type > s( adr.family_detail_() ) ;
+      if( AF_UNIX == adr.family_detail_() ) {
+        if( ::bind( s.fd() , adr.sockaddr_pointer() , adr.length() ) < 0 ) {
+          int const err = errno ;
+          if( EADDRINUSE != err || !remove_stale( adr ) ) {
+            errno = err ;
+            throw_socket_error( "bind" ) ;
+          }
+          ::my_bind( s.fd() , adr ) ;
+        }
+        return s ;
+      }
+      if( reuse_port ) { bool_sockopt( s.fd() , SO_REUSEPORT ) ; }
       ::my_bind( s.fd() , adr ) ;
       return s ;
 
@@ -92,6 +131,8 @@ int nanonet::detail_::int_address_family(
       return AF_INET ;
     case nanonet::util::network::ipv6 :
       return AF_INET6 ;
+    case nanonet::util::network::unix_domain :
+      return AF_UNIX ;
     case nanonet::util::network::ip_unspec :
       return AF_UNSPEC ;
     default :
@@ -106,6 +147,8 @@ nanonet::detail_::from_int_address_family( int const afi ) {
       return nanonet::util::network::ipv4 ;
     case AF_INET6 :
       return nanonet::util::network::ipv6 ;
+    case AF_UNIX  :
+      return nanonet::util::network::unix_domain ;
     case AF_UNSPEC :
       return nanonet::util::network::ip_unspec ;
     default       :
@@ -168,23 +211,66 @@ void nanonet::detail_::socket_resource_traits::dispose
 ////////////////////////////////////////////////////////////////////////
 
 nanonet::util::network::acceptor::acceptor
-( address_list_type const& la , int const bl )
-: s( bound_socket< SOCK_STREAM >( la ) ) ,
+( address_list_type const& la , int const bl , bool const reuse_port )
+: s( bound_socket< SOCK_STREAM >( la , reuse_port ) ) ,
   local_( my_getsockname< SOCK_STREAM >( s.fd() ) )
 { nanonet::detail_::my_listen( s.fd() , bl ) ; }
 
 nanonet::util::network::acceptor::acceptor
-( std::string const& ls , int const bl )
-: s( bound_socket< SOCK_STREAM >( resolve_stream( ls ) ) ) ,
+( std::string const& ls , int const bl , bool const reuse_port )
+: s( bound_socket< SOCK_STREAM >( resolve_stream( ls ) , reuse_port ) ) ,
   local_( my_getsockname< SOCK_STREAM >( s.fd() ) )
 { nanonet::detail_::my_listen( s.fd() , bl ) ; }
 
 nanonet::util::network::acceptor::acceptor
-( std::string const& ln , std::string const& ls , int const bl )
-: s( bound_socket< SOCK_STREAM >( resolve_stream( ln , ls ) ) ) ,
+( std::string const& ln , std::string const& ls , int const bl ,
+  bool const reuse_port )
+: s( bound_socket< SOCK_STREAM >( resolve_stream( ln , ls ) , reuse_port ) ) ,
   local_( my_getsockname< SOCK_STREAM >( s.fd() ) )
 { nanonet::detail_::my_listen( s.fd() , bl ) ; }
 
+nanonet::util::network::acceptor::acceptor
+( nanonet::detail_::socketfd_t const listening )
+: s( 4711 , listening ) ,
+  local_( my_getsockname< SOCK_STREAM >( s.fd() ) ) {
+  // The mode is shared with the sender's descriptor
+  int const flags = ::fcntl( s.fd() , F_GETFL ) ;
+  if( flags < 0 ) { throw_socket_error( "fcntl" ) ; }
+  nonblocking_ = 0 != ( flags & O_NONBLOCK ) ;
+}
+
+long nanonet::util::network::acceptor::accept_batch(
+    std::vector< std::unique_ptr< connection > >& batch ,
+    long const max ,
+    bool const nonblocking ) {
+
+  if( !nonblocking_ ) {
+    nanonet::detail_::bool_fcntl_option(
+        fd() , O_NONBLOCK , "Enabling nonblocking mode" , true ) ;
+    nonblocking_ = true ;
+  }
+
+  long n = 0 ;
+  while( n < max ) {
+    connection::address_type peer ;
+    try {
+      nanonet::detail_::socketfd_t const cfd = nanonet::detail_::my_accept4(
+          fd() , peer.sockaddr_pointer() , peer.socklen_pointer() ,
+          nonblocking ) ;
+      if( nanonet::detail_::invalid_socket() == cfd ) { break ; }
+      batch.push_back( std::make_unique< connection >( cfd , peer ) ) ;
+    } catch( std::exception const& ) {
+      // Report errors with the next call unless they are transient
+      if( 0 == n ) { throw ; }
+      break ;
+    }
+    ++n ;
+  }
+
+  return n ;
+
+}
+
 std::shared_ptr<stream_socket_reader_writer>
 nanonet::util::network::connection::initialize( 
   address_list_type const& ra ,
@@ -292,8 +378,25 @@ nanonet::util::network::connection::connection
   peer_ ( my_getpeername< SOCK_STREAM >( fd() ) )
 { }
 
-void nanonet::util::network::connection::no_delay( bool b )
-{ bool_sockopt( fd() , TCP_NODELAY , b ) ; }
+nanonet::util::network::connection::connection
+( nanonet::detail_::socketfd_t const accepted )
+: s( std::make_shared<stream_socket_reader_writer>( 4711 , accepted ) ) ,
+  local_( my_getsockname< SOCK_STREAM >( fd() ) ) , 
+  peer_ ( my_getpeername< SOCK_STREAM >( fd() ) )
+{ }
+
+nanonet::util::network::connection::connection
+( nanonet::detail_::socketfd_t const accepted , address_type const& peer )
+: s( std::make_shared<stream_socket_reader_writer>( 4711 , accepted ) ) ,
+  local_( my_getsockname< SOCK_STREAM >( fd() ) ) , 
+  peer_ ( peer )
+{ }
+
+// Unix domain sockets don't delay anyway
+void nanonet::util::network::connection::no_delay( bool b ) {
+  if( AF_UNIX != local_.family_detail_() ) 
+  { bool_sockopt( fd() , TCP_NODELAY , b ) ; }
+}
 
 void nanonet::util::network::connection::   send_timeout( const double t )
 { nanonet::detail_::time_sockopt( fd() , SO_SNDTIMEO , t ) ; }
@@ -319,13 +422,127 @@ nanonet::util::network::peer( nanonet::util::network::instream const& ins ) {
 }
 #endif
 
+void nanonet::util::network::send_descriptors(
+    connection& c , std::string const& message ,
+    std::vector< nanonet::detail_::socketfd_t > const& fds ) {
+  always_assert( !message.empty() ) ;
+  always_assert( static_cast< long >( fds.size() ) <= MAX_DESCRIPTORS ) ;
+
+  ::iovec iov ;
+  iov.iov_base = const_cast< char* >( message.data() ) ;
+  iov.iov_len  = message.size() ;
+
+  // Aligned for cmsghdr
+  union {
+    char buf[ CMSG_SPACE( MAX_DESCRIPTORS * sizeof( int ) ) ] ;
+    ::cmsghdr align ;
+  } control ;
+  std::memset( &control , 0 , sizeof( control ) ) ;
+
+  ::msghdr msg ;
+  std::memset( &msg , 0 , sizeof( msg ) ) ;
+  msg.msg_iov    = &iov ;
+  msg.msg_iovlen = 1 ;
+  if( !fds.empty() ) {
+    msg.msg_control    = control.buf ;
+    msg.msg_controllen = CMSG_SPACE( fds.size() * sizeof( int ) ) ;
+    ::cmsghdr* const cmsg = CMSG_FIRSTHDR( &msg ) ;
+    cmsg->cmsg_level = SOL_SOCKET ;
+    cmsg->cmsg_type  = SCM_RIGHTS ;
+    cmsg->cmsg_len   = CMSG_LEN( fds.size() * sizeof( int ) ) ;
+    std::memcpy( CMSG_DATA( cmsg ) , fds.data() , fds.size() * sizeof( int ) ) ;
+  }
+
+  long ret ;
+  do { ret = ::sendmsg( c.fd() , &msg , 0 ) ; }
+  while( EINTR_repeat( ret ) ) ;
+
+  if( ret < 0 ) { throw_socket_error( "sendmsg" ) ; }
+  if( ret != static_cast< long >( message.size() ) ) {
+    throw std::runtime_error( "sendmsg: message truncated" ) ;
+  }
+}
+
+std::string nanonet::util::network::receive_descriptors(
+    connection& c , std::vector< nanonet::detail_::auto_fd >& fds ,
+    long const max_size ) {
+  std::string ret( max_size , '\0' ) ;
+
+  ::iovec iov ;
+  iov.iov_base = ret.data() ;
+  iov.iov_len  = ret.size() ;
+
+  union {
+    char buf[ CMSG_SPACE( MAX_DESCRIPTORS * sizeof( int ) ) ] ;
+    ::cmsghdr align ;
+  } control ;
+  std::memset( &control , 0 , sizeof( control ) ) ;
+
+  ::msghdr msg ;
+  std::memset( &msg , 0 , sizeof( msg ) ) ;
+  msg.msg_iov        = &iov ;
+  msg.msg_iovlen     = 1 ;
+  msg.msg_control    = control.buf ;
+  msg.msg_controllen = sizeof( control.buf ) ;
+
+#if (BOOST_OS_LINUX)
+  const int flags = MSG_CMSG_CLOEXEC ;
+#else
+  const int flags = 0 ;
+#endif
+
+  long n ;
+  do { n = ::recvmsg( c.fd() , &msg , flags ) ; }
+  while( EINTR_repeat( n ) ) ;
+
+  if( n < 0 ) { throw_socket_error( "recvmsg" ) ; }
+
+  // Take ownership first so that nothing leaks if we throw below
+  for( ::cmsghdr* cmsg = CMSG_FIRSTHDR( &msg ) ; cmsg ;
+       cmsg = CMSG_NXTHDR( &msg , cmsg ) ) {
+    if( SOL_SOCKET != cmsg->cmsg_level || SCM_RIGHTS != cmsg->cmsg_type ) {
+      continue ;
+    }
+    const long count = ( cmsg->cmsg_len - CMSG_LEN( 0 ) ) / sizeof( int ) ;
+    for( long i = 0 ; i < count ; ++i ) {
+      int fd ;
+      std::memcpy( &fd , CMSG_DATA( cmsg ) + i * sizeof( int ) , sizeof( int ) ) ;
+      fds.emplace_back( fd ) ;
+    }
+  }
+
+  if( msg.msg_flags & MSG_CTRUNC ) {
+    throw std::runtime_error( "recvmsg: too many descriptors received" ) ;
+  }
+
+  ret.resize( n ) ;
+  return ret ;
+}
+
 ////////////////////////////////////////////////////////////////////////
 // Datagram
 ////////////////////////////////////////////////////////////////////////
 
 void nanonet::util::network::datagram_socket::initialize() {
-  bool_sockopt( s.fd() , SO_BROADCAST ) ;
-  bool_sockopt( s.fd() , SO_REUSEADDR ) ;
+  address_type const a = local() ;
+  if( AF_UNIX != a.family_detail_() ) {
+    bool_sockopt( s.fd() , SO_BROADCAST ) ;
+    bool_sockopt( s.fd() , SO_REUSEADDR ) ;
+    return ;
+  }
+
+#if (BOOST_OS_LINUX)
+  // Unnamed sockets can't receive replies.  Binding to just the family
+  // makes the kernel choose a unique name in the abstract namespace.
+  if( a.host().empty() ) {
+    sockaddr_un un ;
+    std::memset( &un , 0 , sizeof( un ) ) ;
+    un.sun_family = AF_UNIX ;
+    nanonet::detail_::my_bind( 
+        s.fd() , reinterpret_cast< sockaddr const* >( &un ) , 
+        sizeof( sa_family_t ) ) ;
+  }
+#endif
 }
 
 // TODO: Use delegating constructors
@@ -376,6 +593,432 @@ nanonet::util::network::datagram_socket::connected(
   return ret ;
 }
 
+long nanonet::util::network::datagram_socket::receive_batch(
+    std::span< datagram_message > const messages ,
+    double const t ) {
+
+  long const size = messages.size() ;
+  if( 0 == size || !wait_readable( fd() , t ) ) { return 0 ; }
+
+  long ret = 0 ;
+  while( ret < size ) {
+    long const n = std::min( size - ret , MAX_BATCH ) ;
+    datagram_message* const m = &messages[ ret ] ;
+
+#if (BOOST_OS_LINUX)
+    ::mmsghdr msgs[ MAX_BATCH ] ;
+    ::iovec   iov [ MAX_BATCH ] ;
+    alignas( ::cmsghdr ) char control[ MAX_BATCH ][ TIMESTAMP_CONTROL_SIZE ] ;
+    std::memset( msgs , 0 , n * sizeof( ::mmsghdr ) ) ;
+    for( long i = 0 ; i < n ; ++i ) {
+      iov[ i ].iov_base = m[ i ].buffer.data() ;
+      iov[ i ].iov_len  = m[ i ].buffer.size() ;
+      m[ i ].address.set_maxlength() ;
+      msgs[ i ].msg_hdr.msg_name       = m[ i ].address.sockaddr_pointer() ;
+      msgs[ i ].msg_hdr.msg_namelen    = m[ i ].address.length() ;
+      msgs[ i ].msg_hdr.msg_iov        = &iov[ i ] ;
+      msgs[ i ].msg_hdr.msg_iovlen     = 1 ;
+      msgs[ i ].msg_hdr.msg_control    = control[ i ] ;
+      msgs[ i ].msg_hdr.msg_controllen = TIMESTAMP_CONTROL_SIZE ;
+    }
+
+    // Blocks for the first datagram only
+    int const flags = 0 == ret ? MSG_WAITFORONE : MSG_DONTWAIT ;
+    int received ;
+    do { received = ::recvmmsg( fd() , msgs , n , flags , nullptr ) ; }
+    while( EINTR_repeat( received ) ) ;
+
+    if( received < 0 ) {
+      if( EAGAIN == errno || EWOULDBLOCK == errno ) { break ; }
+      throw_socket_error( "recvmmsg" ) ;
+    }
+
+    for( long i = 0 ; i < received ; ++i ) {
+      m[ i ].size      = msgs[ i ].msg_len ;
+      m[ i ].truncated = msgs[ i ].msg_hdr.msg_flags & MSG_TRUNC ;
+      m[ i ].timestamp = receive_timestamp( msgs[ i ].msg_hdr ) ;
+      *m[ i ].address.socklen_pointer() = msgs[ i ].msg_hdr.msg_namelen ;
+    }
+#else
+    // One datagram at a time, blocks for the first one only
+    static_cast< void >( n ) ;
+    ::iovec iov ;
+    iov.iov_base = m->buffer.data() ;
+    iov.iov_len  = m->buffer.size() ;
+
+    alignas( ::cmsghdr ) char control[ TIMESTAMP_CONTROL_SIZE ] ;
+
+    ::msghdr msg ;
+    std::memset( &msg , 0 , sizeof( msg ) ) ;
+    m->address.set_maxlength() ;
+    msg.msg_name       = m->address.sockaddr_pointer() ;
+    msg.msg_namelen    = m->address.length() ;
+    msg.msg_iov        = &iov ;
+    msg.msg_iovlen     = 1 ;
+    msg.msg_control    = control ;
+    msg.msg_controllen = sizeof( control ) ;
+
+    long received ;
+    do {
+      received = ::recvmsg( fd() , &msg , 0 == ret ? 0 : MSG_DONTWAIT ) ;
+    } while( EINTR_repeat( received ) ) ;
+
+    if( received < 0 ) {
+      if( EAGAIN == errno || EWOULDBLOCK == errno ) { break ; }
+      throw_socket_error( "recvmsg" ) ;
+    }
+
+    *m->address.socklen_pointer() = msg.msg_namelen ;
+    m->size      = received ;
+    m->truncated = msg.msg_flags & MSG_TRUNC ;
+    m->timestamp = receive_timestamp( msg ) ;
+    received     = 1 ;
+#endif
+
+    ret += received ;
+    if( received < n ) { break ; }
+  }
+
+  return ret ;
+
+}
+
+long nanonet::util::network::datagram_socket::send_batch(
+    std::span< datagram_message const > const messages ,
+    bool const use_address ) {
+
+  long const size = messages.size() ;
+  long sent = 0 ;
+  long i = 0 ;
+  while( i < size ) {
+    long const n = std::min( size - i , MAX_BATCH ) ;
+    datagram_message const* const m = &messages[ i ] ;
+
+#if (BOOST_OS_LINUX)
+    ::mmsghdr msgs[ MAX_BATCH ] ;
+    ::iovec   iov [ MAX_BATCH ] ;
+    std::memset( msgs , 0 , n * sizeof( ::mmsghdr ) ) ;
+    for( long j = 0 ; j < n ; ++j ) {
+      always_assert( m[ j ].size <= m[ j ].buffer.size() ) ;
+      iov[ j ].iov_base = m[ j ].buffer.data() ;
+      iov[ j ].iov_len  = m[ j ].size ;
+      if( use_address ) {
+        msgs[ j ].msg_hdr.msg_name = 
+          const_cast< sockaddr* >( m[ j ].address.sockaddr_pointer() ) ;
+        msgs[ j ].msg_hdr.msg_namelen = m[ j ].address.length() ;
+      }
+      msgs[ j ].msg_hdr.msg_iov    = &iov[ j ] ;
+      msgs[ j ].msg_hdr.msg_iovlen = 1 ;
+    }
+
+    int ret ;
+    do { ret = ::sendmmsg( fd() , msgs , n , 0 ) ; }
+    while( EINTR_repeat( ret ) ) ;
+#else
+    // One datagram at a time
+    static_cast< void >( n ) ;
+    always_assert( m->size <= m->buffer.size() ) ;
+    long ret = use_address 
+      ? nanonet::detail_::my_sendto( 
+            fd() , m->address.sockaddr_pointer() , m->address.length() ,
+            m->buffer.data() , m->size )
+      : nanonet::detail_::my_send( fd() , m->buffer.data() , m->size ) ;
+    if( ret >= 0 ) { ret = 1 ; }
+#endif
+
+    if( ret < 0 ) {
+      // The first message was refused, skip it
+      if( ECONNREFUSED == errno ) { ++i ; continue ; }
+      throw_socket_error( "sendmmsg" ) ;
+    }
+
+    always_assert( ret > 0 ) ;
+    sent += ret ;
+    i    += ret ;
+  }
+
+  return sent ;
+
+}
+
+nanonet::util::network::datagram_socket::size_type
+nanonet::util::network::datagram_socket::receive_into(
+    address_type* const source_ret ,
+    double* const timestamp ,
+    char* const p ,
+    size_type const n ) {
+
+  address_type source ;
+  long err ;
+  if( nullptr == timestamp ) {
+    do {
+      source.set_maxlength() ;
+      err = ::recvfrom(
+          fd() , p , n , 0 ,
+          source.sockaddr_pointer() , source.socklen_pointer() ) ;
+    } while( EINTR_repeat( err ) ) ;
+
+    if( err < 0 ) { throw_socket_error( "recvfrom" ) ; }
+  } else {
+    ::iovec iov ;
+    iov.iov_base = p ;
+    iov.iov_len  = n ;
+
+    alignas( ::cmsghdr ) char control[ TIMESTAMP_CONTROL_SIZE ] ;
+
+    ::msghdr msg ;
+    std::memset( &msg , 0 , sizeof( msg ) ) ;
+    source.set_maxlength() ;
+    msg.msg_name       = source.sockaddr_pointer() ;
+    msg.msg_namelen    = source.length() ;
+    msg.msg_iov        = &iov ;
+    msg.msg_iovlen     = 1 ;
+    msg.msg_control    = control ;
+    msg.msg_controllen = sizeof( control ) ;
+
+    do { err = ::recvmsg( fd() , &msg , 0 ) ; }
+    while( EINTR_repeat( err ) ) ;
+
+    if( err < 0 ) { throw_socket_error( "recvmsg" ) ; }
+
+    *source.socklen_pointer() = msg.msg_namelen ;
+    *timestamp = receive_timestamp( msg ) ;
+  }
+
+  if( nullptr != source_ret ) { *source_ret = source ; }
+
+  assert( static_cast< size_type >( err ) <= n ) ;
+  return err ;
+
+}
+
+void nanonet::util::network::datagram_socket::send_from(
+    address_type const* const d ,
+    char const* const p ,
+    long const n ) {
+
+  long result ;
+  if( nullptr == d ) {
+    result = nanonet::detail_::my_send( fd() , p , n ) ;
+  } else {
+    // It appears we cannot send from an IPv4 socket to IPv6 or vice versa
+    // (tested MacOS X).  Hence, test for this condition and throw
+    // in case somebody tries.
+    if( d->family_detail_() != local().family_detail_() ) {
+      throw std::runtime_error( "datagram send: address family mismatch" ) ;
+    }
+    result = nanonet::detail_::my_sendto(
+        fd() , d->sockaddr_pointer() , d->length() , p , n ) ;
+  }
+
+  if( result < 0 ) {
+    if( errno == ECONNREFUSED ) { return ; }
+    throw_socket_error(
+        nullptr == d ? "send" : "send to " + d->host() + ":" + d->port() ) ;
+  }
+
+  always_assert( result == n ) ;
+
+}
+
+void nanonet::util::network::datagram_socket::send_segmented(
+    std::span< char const > const data ,
+    long const segment_size ) {
+  send_segmented_internal( nullptr , data , segment_size ) ;
+}
+
+void nanonet::util::network::datagram_socket::send_segmented(
+    std::span< char const > const data ,
+    long const segment_size ,
+    address_type const& destination ) {
+  send_segmented_internal( &destination , data , segment_size ) ;
+}
+
+void nanonet::util::network::datagram_socket::send_segmented_internal(
+    address_type const* const d ,
+    std::span< char const > const data ,
+    long const segment_size ) {
+  always_assert( segment_size >= 1 ) ;
+
+  long const size = data.size() ;
+  long i = 0 ;
+
+#if (BOOST_OS_LINUX)
+  // Maximum UDP payload over IPv4.  The kernel rejects larger GSO sends.
+  long const max_payload = 65507 ;
+  long const per_call = 
+    std::min( MAX_SEGMENTS , max_payload / segment_size ) * segment_size ;
+
+  int const family = local().family_detail_() ;
+  if( per_call > segment_size && AF_UNIX != family ) {
+    if( d && d->family_detail_() != family ) {
+      throw std::runtime_error( "datagram send: address family mismatch" ) ;
+    }
+
+    while( i < size ) {
+      long const n = std::min( size - i , per_call ) ;
+
+      ::iovec iov ;
+      iov.iov_base = const_cast< char* >( data.data() + i ) ;
+      iov.iov_len  = n ;
+
+      alignas( ::cmsghdr ) char control[ CMSG_SPACE( sizeof( std::uint16_t ) ) ] ;
+      std::memset( control , 0 , sizeof( control ) ) ;
+
+      ::msghdr msg ;
+      std::memset( &msg , 0 , sizeof( msg ) ) ;
+      if( d ) {
+        msg.msg_name    = const_cast< sockaddr* >( d->sockaddr_pointer() ) ;
+        msg.msg_namelen = d->length() ;
+      }
+      msg.msg_iov        = &iov ;
+      msg.msg_iovlen     = 1 ;
+      msg.msg_control    = control ;
+      msg.msg_controllen = sizeof( control ) ;
+
+      ::cmsghdr* const cmsg = CMSG_FIRSTHDR( &msg ) ;
+      cmsg->cmsg_level = SOL_UDP ;
+      cmsg->cmsg_type  = UDP_SEGMENT ;
+      cmsg->cmsg_len   = CMSG_LEN( sizeof( std::uint16_t ) ) ;
+      std::uint16_t const gso_size = segment_size ;
+      std::memcpy( CMSG_DATA( cmsg ) , &gso_size , sizeof( gso_size ) ) ;
+
+      long ret ;
+      do { ret = ::sendmsg( fd() , &msg , MSG_NOSIGNAL ) ; }
+      while( EINTR_repeat( ret ) ) ;
+
+      if( ret < 0 ) {
+        // No checksum offload on the device (EIO), segments larger than
+        // the path MTU (EINVAL) or no UDP_SEGMENT in the kernel: Send
+        // individually, errors are then reported as for send().
+        if( EIO == errno || EINVAL == errno || ENOPROTOOPT == errno ) {
+          break ;
+        }
+        if( ECONNREFUSED == errno ) { i += n ; continue ; }
+        throw_socket_error( "sendmsg" ) ;
+      }
+
+      always_assert( ret == n ) ;
+      i += n ;
+    }
+  }
+#endif
+
+  for( ; i < size ; i += segment_size ) {
+    send_from( d , data.data() + i , std::min( size - i , segment_size ) ) ;
+  }
+}
+
+void nanonet::util::network::datagram_socket::receive_offload(
+    bool const enable ) {
+#if (BOOST_OS_LINUX)
+  int const value = enable ;
+  if( ::setsockopt( fd() , SOL_UDP , UDP_GRO , &value , sizeof( value ) ) < 0 ) {
+    throw_socket_error( "setsockopt UDP_GRO" ) ;
+  }
+#else
+  static_cast< void >( enable ) ;
+#endif
+}
+
+bool nanonet::util::network::datagram_socket::receive_segments(
+    std::span< char > const buffer ,
+    datagram_segments& segments ,
+    double const t ) {
+
+  if( !wait_readable( fd() , t ) ) { return false ; }
+
+  ::iovec iov ;
+  iov.iov_base = buffer.data() ;
+  iov.iov_len  = buffer.size() ;
+
+  alignas( ::cmsghdr ) char control[ 
+      CMSG_SPACE( sizeof( int ) ) + TIMESTAMP_CONTROL_SIZE ] ;
+
+  ::msghdr msg ;
+  std::memset( &msg , 0 , sizeof( msg ) ) ;
+  segments.address.set_maxlength() ;
+  msg.msg_name       = segments.address.sockaddr_pointer() ;
+  msg.msg_namelen    = segments.address.length() ;
+  msg.msg_iov        = &iov ;
+  msg.msg_iovlen     = 1 ;
+  msg.msg_control    = control ;
+  msg.msg_controllen = sizeof( control ) ;
+
+  long n ;
+  do { n = ::recvmsg( fd() , &msg , 0 ) ; }
+  while( EINTR_repeat( n ) ) ;
+
+  if( n < 0 ) { throw_socket_error( "recvmsg" ) ; }
+
+  *segments.address.socklen_pointer() = msg.msg_namelen ;
+  segments.truncated = msg.msg_flags & MSG_TRUNC ;
+  segments.data = buffer.first( std::min< long >( n , buffer.size() ) ) ;
+  segments.segment_size = segments.data.size() ;
+  segments.timestamp = receive_timestamp( msg ) ;
+
+#if (BOOST_OS_LINUX)
+  for( ::cmsghdr* cmsg = CMSG_FIRSTHDR( &msg ) ; cmsg ;
+       cmsg = CMSG_NXTHDR( &msg , cmsg ) ) {
+    if( SOL_UDP == cmsg->cmsg_level && UDP_GRO == cmsg->cmsg_type ) {
+      int gso_size ;
+      std::memcpy( &gso_size , CMSG_DATA( cmsg ) , sizeof( gso_size ) ) ;
+      segments.segment_size = gso_size ;
+    }
+  }
+#endif
+
+  return true ;
+
+}
+
+void nanonet::util::network::datagram_socket::join_group(
+    std::string const& group ,
+    std::string const& interface ) {
+  group_membership( MCAST_JOIN_GROUP , group , interface ) ;
+}
+
+void nanonet::util::network::datagram_socket::leave_group(
+    std::string const& group ,
+    std::string const& interface ) {
+  group_membership( MCAST_LEAVE_GROUP , group , interface ) ;
+}
+
+void nanonet::util::network::datagram_socket::group_membership(
+    int const option ,
+    std::string const& group ,
+    std::string const& interface ) {
+
+  int const family = local().family_detail_() ;
+  if( AF_INET != family && AF_INET6 != family ) {
+    throw std::runtime_error( "multicast: not an IP socket" ) ;
+  }
+
+  // RFC 3678 protocol independent interface
+  ::group_req req ;
+  std::memset( &req , 0 , sizeof( req ) ) ;
+
+  if( !interface.empty() ) {
+    req.gr_interface = ::if_nametoindex( interface.c_str() ) ;
+    if( 0 == req.gr_interface ) {
+      throw_socket_error( "multicast: interface " + interface ) ;
+    }
+  }
+
+  address_type const a = resolve_datagram( 
+      group , "0" , from_int_address_family( family ) ).at( 0 ) ;
+  always_assert( a.length() <= sizeof( req.gr_group ) ) ;
+  std::memcpy( &req.gr_group , a.sockaddr_pointer() , a.length() ) ;
+
+  int const level = AF_INET == family ? IPPROTO_IP : IPPROTO_IPV6 ;
+  if( ::setsockopt( fd() , level , option , &req , sizeof( req ) ) < 0 ) {
+    throw_socket_error( 
+        std::string( MCAST_JOIN_GROUP == option ? "join" : "leave" ) 
+        + " multicast group " + group ) ;
+  }
+
+}
+
 void nanonet::util::network::datagram_socket::connect(
     std::string const& name ,
     std::string const& service ) {
@@ -172,23 +172,61 @@ long nanonet::detail_::posix_reader_writer::read(char* const buf, long const n)
 }
 
 
-long nanonet::detail_::posix_reader_writer::write(
-    char const* const buf, long const n) {
-  
-  long ret ;
+long nanonet::detail_::posix_reader_writer::read(
+    char* const buf1, long const n1, char* const buf2, long const n2) {
+
+  ::iovec const iov[ 2 ] = {
+    { buf1 , static_cast< std::size_t >( n1 ) } ,
+    { buf2 , static_cast< std::size_t >( n2 ) }
+  } ;
 
-  // TODO: partial send
-  do { ret = ::write( fd.get() , buf , n ) ; } 
+  long ret ;
+  do { ret = ::readv( fd.get() , iov , 2 ) ; } 
   while( EINTR_repeat( ret ) ) ;
 
-  if( ret < 0 ) 
-  { return -1 ; }
+  assert( -1 <= ret           ) ;
+  assert(       ret <= n1 + n2 ) ;
 
-  assert( n == ret ) ;
   return ret ;
 
 }
 
+
+long nanonet::detail_::posix_reader_writer::write(
+    char const* const buf, long const n) {
+  return write( buf , n , nullptr , 0 ) ;
+}
+
+long nanonet::detail_::posix_reader_writer::write(
+    char const* const buf1, long const n1,
+    char const* const buf2, long const n2) {
+
+  ::iovec iov[ 2 ] = {
+    { const_cast< char* >( buf1 ) , static_cast< std::size_t >( n1 ) } ,
+    { const_cast< char* >( buf2 ) , static_cast< std::size_t >( n2 ) }
+  } ;
+
+  // Skip empty buffers, retry on partial writes
+  long total = 0 ;
+  int i = 0 ;
+  advance_iovec( iov , i , 2 , 0 ) ;
+  while( i < 2 ) {
+    long ret ;
+    do { ret = ::writev( fd.get() , iov + i , 2 - i ) ; } 
+    while( EINTR_repeat( ret ) ) ;
+
+    if( ret <= 0 ) 
+    { return -1 ; }
+
+    total += ret ;
+    advance_iovec( iov , i , 2 , ret ) ;
+  }
+
+  assert( n1 + n2 == total ) ;
+  return total ;
+
+}
+
 ::timespec const nanonet::detail_::to_timespec( double const& t ) {
 
   ::timespec ret ;
@@ -0,0 +1,77 @@
+//
+// Copyright 2015 KISS Technologies GmbH, Switzerland
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "nanonet/rate-limiter.h"
+
+#include "nanonet/assert.h"
+
+#include <algorithm>
+#include <functional>
+
+
+nanonet::util::rate_limiter::rate_limiter(
+    double const rate, double const burst, long const capacity)
+: rate_(rate),
+  burst_(burst),
+  shard_capacity_((std::max(capacity, 1L) + SHARDS - 1) / SHARDS),
+  shards_(std::make_unique<shard[]>(SHARDS)) {
+  always_assert(rate > 0);
+  always_assert(burst >= 1);
+}
+
+bool nanonet::util::rate_limiter::allow(
+    std::string_view const key, double const now) {
+  shard& s = shards_[std::hash<std::string_view>{}(key) % SHARDS];
+  std::lock_guard<std::mutex> lock{s.mutex};
+
+  const auto it = s.index.find(key);
+  if (s.index.end() != it) {
+    s.lru.splice(s.lru.begin(), s.lru, it->second);
+  } else {
+    if (s.lru.size() >= shard_capacity_) {
+      // Forget the least recently seen key and reuse its node
+      s.index.erase(s.lru.back().key);
+      s.lru.splice(s.lru.begin(), s.lru, std::prev(s.lru.end()));
+    } else {
+      s.lru.emplace_front();
+    }
+    bucket& b = s.lru.front();
+    b.key.assign(key);
+    b.tokens = burst_;
+    b.last = now;
+    s.index.emplace(b.key, s.lru.begin());
+  }
+
+  bucket& b = s.lru.front();
+  if (now > b.last) {
+    b.tokens = std::min(burst_, b.tokens + (now - b.last) * rate_);
+    b.last = now;
+  }
+  if (b.tokens < 1) {
+    return false;
+  }
+  b.tokens -= 1;
+  return true;
+}
+
+long nanonet::util::rate_limiter::size() const {
+  long ret = 0;
+  for (int i = 0; i < SHARDS; ++i) {
+    std::lock_guard<std::mutex> lock{shards_[i].mutex};
+    ret += shards_[i].lru.size();
+  }
+  return ret;
+}
@@ -0,0 +1,250 @@
+//
+// Copyright 2015 KISS Technologies GmbH, Switzerland
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "nanonet/sys/event-loop.h"
+
+#include "nanonet/assert.h"
+#include "nanonet/math-util.h"
+
+#include "nanonet/detail/platform_definition.h"
+
+#include <array>
+#include <stdexcept>
+
+#if (BOOST_OS_LINUX)
+#  include <sys/epoll.h>
+#  include <sys/eventfd.h>
+#endif
+
+using nanonet::detail_::socketfd_t;
+
+namespace {
+
+// Maximum number of events per epoll_wait() call
+constexpr int MAX_EVENTS = 256;
+
+#if (BOOST_OS_LINUX)
+
+std::uint32_t to_epoll(const unsigned events) {
+  std::uint32_t ret = 0;
+  if (events & nanonet::util::event_loop::readable) { ret |= EPOLLIN ; }
+  if (events & nanonet::util::event_loop::writable) { ret |= EPOLLOUT; }
+  return ret;
+}
+
+unsigned from_epoll(const std::uint32_t events) {
+  unsigned ret = 0;
+  if (events & EPOLLIN ) { ret |= nanonet::util::event_loop::readable; }
+  if (events & EPOLLOUT) { ret |= nanonet::util::event_loop::writable; }
+  if (events & (EPOLLHUP | EPOLLERR | EPOLLRDHUP)) {
+    ret |= nanonet::util::event_loop::hangup;
+  }
+  return ret;
+}
+
+// Registration id in the upper, descriptor in the lower 32 bits
+std::uint64_t make_key(const std::uint64_t id, const socketfd_t fd) {
+  return (id << 32) | static_cast<std::uint32_t>(fd);
+}
+
+void epoll_control(
+    const socketfd_t epfd, const int op, const socketfd_t fd,
+    const unsigned events, const std::uint64_t id) {
+  ::epoll_event ev;
+  ev.events   = to_epoll(events) | EPOLLRDHUP;
+  ev.data.u64 = make_key(id, fd);
+  if (::epoll_ctl(epfd, op, fd, &ev) < 0) {
+    nanonet::detail_::strerror_exception("epoll_ctl");
+  }
+}
+
+#endif
+
+} // anonymous namespace
+
+
+#if (BOOST_OS_LINUX)
+
+nanonet::util::event_loop::event_loop()
+: poll_fd_(::epoll_create1(EPOLL_CLOEXEC)),
+  wake_fd_(::eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK)) {
+  if (not poll_fd_.valid()) {
+    nanonet::detail_::strerror_exception("epoll_create1");
+  }
+  if (not wake_fd_.valid()) {
+    nanonet::detail_::strerror_exception("eventfd");
+  }
+  // The wakeup descriptor has id 0 and is not in fds_
+  epoll_control(poll_fd_.get(), EPOLL_CTL_ADD, wake_fd_.get(), readable, 0);
+}
+
+#else
+
+nanonet::util::event_loop::event_loop() {
+  throw std::runtime_error("event_loop: not supported on this platform");
+}
+
+#endif
+
+nanonet::util::event_loop::~event_loop() {}
+
+void nanonet::util::event_loop::add(
+    const socketfd_t fd, const unsigned events, fd_callback cb) {
+  always_assert(fd >= 0);
+  always_assert(cb);
+  if (fds_.count(fd)) {
+    throw std::logic_error(
+        "event_loop: descriptor already registered: " + std::to_string(fd));
+  }
+  // Ids use 32 bits, 0 is reserved for the wakeup descriptor.
+  if (0 == (next_id_ & 0xffffffff)) {
+    ++next_id_;
+  }
+  const std::uint64_t id = next_id_++ & 0xffffffff;
+#if (BOOST_OS_LINUX)
+  epoll_control(poll_fd_.get(), EPOLL_CTL_ADD, fd, events, id);
+#endif
+  fds_.emplace(fd, std::make_unique<registration>(
+      registration{id, std::move(cb)}));
+}
+
+void nanonet::util::event_loop::modify(
+    const socketfd_t fd, const unsigned events) {
+  const auto it = fds_.find(fd);
+  if (fds_.end() == it) {
+    throw std::logic_error(
+        "event_loop: modifying unregistered descriptor: " + std::to_string(fd));
+  }
+#if (BOOST_OS_LINUX)
+  epoll_control(poll_fd_.get(), EPOLL_CTL_MOD, fd, events, it->second->id);
+#else
+  static_cast<void>(events);
+#endif
+}
+
+void nanonet::util::event_loop::remove(const socketfd_t fd) {
+  const auto it = fds_.find(fd);
+  if (fds_.end() == it) {
+    return;
+  }
+  removed_.push_back(std::move(it->second));
+  fds_.erase(it);
+#if (BOOST_OS_LINUX)
+  // Failure is harmless here, e.g. if the descriptor has been closed
+  // already.  The kernel drops closed descriptors automatically.
+  ::epoll_event ev;
+  ::epoll_ctl(poll_fd_.get(), EPOLL_CTL_DEL, fd, &ev);
+#endif
+}
+
+void nanonet::util::event_loop::post(task t) {
+  {
+    std::lock_guard<std::mutex> lock{mutex_};
+    posted_.push_back(std::move(t));
+  }
+#if (BOOST_OS_LINUX)
+  const std::uint64_t one = 1;
+  // EAGAIN means that the counter is saturated, i.e. a wakeup is pending.
+  static_cast<void>(::write(wake_fd_.get(), &one, sizeof(one)));
+#endif
+}
+
+void nanonet::util::event_loop::stop() {
+  {
+    std::lock_guard<std::mutex> lock{mutex_};
+    stopped_ = true;
+  }
+  post([] {});
+}
+
+bool nanonet::util::event_loop::stopped() const {
+  std::lock_guard<std::mutex> lock{mutex_};
+  return stopped_;
+}
+
+long nanonet::util::event_loop::run_posted() {
+  std::vector<task> tasks;
+  {
+    std::lock_guard<std::mutex> lock{mutex_};
+    tasks.swap(posted_);
+  }
+  for (auto& t : tasks) {
+    t();
+  }
+  return static_cast<long>(tasks.size());
+}
+
+long nanonet::util::event_loop::run_once(const double timeout) {
+#if (BOOST_OS_LINUX)
+  const int timeout_ms = timeout < 0
+    ? -1
+    : nanonet::math::round_to_integer<int>(timeout * 1e3);
+
+  std::array<::epoll_event, MAX_EVENTS> events;
+
+  int n = 0;
+  do { n = ::epoll_wait(poll_fd_.get(), &events[0], MAX_EVENTS, timeout_ms); }
+  while (nanonet::detail_::EINTR_repeat(n));
+
+  if (n < 0) {
+    nanonet::detail_::strerror_exception("epoll_wait");
+  }
+
+  long ret = 0;
+  bool woken = false;
+  for (int i = 0; i < n; ++i) {
+    const std::uint64_t key = events[i].data.u64;
+    const std::uint64_t id  = key >> 32;
+    const socketfd_t    fd  = static_cast<socketfd_t>(key & 0xffffffff);
+
+    if (0 == id) {
+      woken = true;
+      continue;
+    }
+
+    // Skip if the descriptor has been removed (and possibly reused)
+    // by a previous callback.
+    const auto it = fds_.find(fd);
+    if (fds_.end() == it or it->second->id != id) {
+      continue;
+    }
+
+    // Keep a reference, the registration stays alive until the end
+    // of the batch even if the callback removes it.
+    registration const& r = *it->second;
+    r.cb(from_epoll(events[i].events));
+    ++ret;
+  }
+
+  if (woken) {
+    std::uint64_t count = 0;
+    static_cast<void>(::read(wake_fd_.get(), &count, sizeof(count)));
+    ret += run_posted();
+  }
+
+  removed_.clear();
+  return ret;
+#else
+  static_cast<void>(timeout);
+  return 0;
+#endif
+}
+
+void nanonet::util::event_loop::run() {
+  while (not stopped()) {
+    run_once(-1);
+  }
+}
@@ -0,0 +1,461 @@
+//
+// Copyright 2015 KISS Technologies GmbH, Switzerland
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "nanonet/sys/io-ring.h"
+
+#include "nanonet/assert.h"
+
+#include "nanonet/detail/platform_definition.h"
+
+#include <atomic>
+#include <stdexcept>
+#include <vector>
+
+#include <cmath>
+#include <cstring>
+
+#if (BOOST_OS_LINUX) && defined(NANONET_IO_URING)
+#  define NANONET_HAVE_IO_URING 1
+#  include <linux/io_uring.h>
+#  include <poll.h>
+#  include <signal.h>
+#  include <sys/mman.h>
+#  include <sys/socket.h>
+#  include <sys/syscall.h>
+#  include <unistd.h>
+#else
+#  define NANONET_HAVE_IO_URING 0
+#endif
+
+using nanonet::detail_::socketfd_t;
+
+#if (NANONET_HAVE_IO_URING)
+
+namespace {
+
+// Shared memory mapping, unmapped on destruction
+struct mapping {
+  mapping() {}
+  mapping(void* const p, std::size_t const n) : p_(p), n_(n) {}
+
+  mapping           (mapping const&) = delete;
+  mapping& operator=(mapping const&) = delete;
+
+  ~mapping() { if (p_) { ::munmap(p_, n_); } }
+
+  void reset(void* const p, std::size_t const n) {
+    if (p_) { ::munmap(p_, n_); }
+    p_ = p;
+    n_ = n;
+  }
+
+  char* get() const { return static_cast<char*>(p_); }
+
+private:
+  void* p_ = nullptr;
+  std::size_t n_ = 0;
+};
+
+void* checked_mmap(
+    std::size_t const n, int const flags, int const fd, off_t const offset) {
+  void* const ret = ::mmap(
+      nullptr, n, PROT_READ | PROT_WRITE, flags, fd, offset);
+  if (MAP_FAILED == ret) {
+    nanonet::detail_::strerror_exception("io_ring: mmap");
+  }
+  return ret;
+}
+
+template<typename T> T* at(char* const base, unsigned const offset) {
+  return reinterpret_cast<T*>(base + offset);
+}
+
+template<typename T> T load_acquire(T* const p) {
+  return std::atomic_ref<T>(*p).load(std::memory_order_acquire);
+}
+
+template<typename T> void store_release(T* const p, T const value) {
+  std::atomic_ref<T>(*p).store(value, std::memory_order_release);
+}
+
+int io_uring_setup(unsigned const entries, ::io_uring_params* const p) {
+  return static_cast<int>(::syscall(__NR_io_uring_setup, entries, p));
+}
+
+int io_uring_enter(
+    int const fd, unsigned const to_submit, unsigned const min_complete,
+    unsigned const flags, void* const arg, std::size_t const argsz) {
+  return static_cast<int>(::syscall(
+      __NR_io_uring_enter, fd, to_submit, min_complete, flags, arg, argsz));
+}
+
+int io_uring_register(
+    int const fd, unsigned const opcode, void* const arg,
+    unsigned const nr_args) {
+  return static_cast<int>(::syscall(
+      __NR_io_uring_register, fd, opcode, arg, nr_args));
+}
+
+} // anonymous namespace
+
+struct nanonet::util::io_ring::impl {
+  explicit impl(unsigned entries);
+
+  ::io_uring_sqe* get_sqe();
+  void submit(unsigned min_complete, ::__kernel_timespec* ts);
+
+  nanonet::detail_::auto_fd fd;
+  ::io_uring_params p;
+
+  mapping sq_ring;
+  mapping cq_ring_separate;
+  mapping sqes_map;
+
+  // Pointers into the rings
+  unsigned* sq_head = nullptr;
+  unsigned* sq_tail = nullptr;
+  unsigned* sq_array = nullptr;
+  unsigned  sq_mask = 0;
+  ::io_uring_sqe* sqes = nullptr;
+
+  unsigned* cq_head = nullptr;
+  unsigned* cq_tail = nullptr;
+  unsigned  cq_mask = 0;
+  ::io_uring_cqe* cqes = nullptr;
+
+  // Our copy of the submission queue tail and the number of queued
+  // but not yet submitted entries
+  unsigned tail = 0;
+  unsigned queued = 0;
+
+  // Provided buffers.  The ring is accessed as an array because in C++,
+  // io_uring_buf_ring::bufs is at the wrong offset with some kernel
+  // headers.  The tail overlaps the reserved field of the first entry.
+  mapping buf_ring_map;
+  ::io_uring_buf* buf_ring = nullptr;
+  std::vector<char> buffers;
+  unsigned buffer_size = 0;
+  unsigned buf_mask = 0;
+  unsigned short buf_tail = 0;
+};
+
+nanonet::util::io_ring::impl::impl(unsigned const entries) {
+  std::memset(&p, 0, sizeof(p));
+  // Multishot requests can produce many completions per submission
+  p.flags = IORING_SETUP_CQSIZE;
+  p.cq_entries = 4 * entries;
+
+  fd.reset(io_uring_setup(entries, &p));
+  if (not fd.valid()) {
+    nanonet::detail_::strerror_exception("io_uring_setup");
+  }
+
+  std::size_t sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+  std::size_t const cq_size =
+      p.cq_off.cqes + p.cq_entries * sizeof(::io_uring_cqe);
+  bool const single = p.features & IORING_FEAT_SINGLE_MMAP;
+  if (single) {
+    sq_size = std::max(sq_size, cq_size);
+  }
+
+  sq_ring.reset(checked_mmap(sq_size, MAP_SHARED | MAP_POPULATE,
+                             fd.get(), IORING_OFF_SQ_RING), sq_size);
+  char* cq_base = sq_ring.get();
+  if (not single) {
+    cq_ring_separate.reset(checked_mmap(cq_size, MAP_SHARED | MAP_POPULATE,
+                                        fd.get(), IORING_OFF_CQ_RING), cq_size);
+    cq_base = cq_ring_separate.get();
+  }
+
+  std::size_t const sqes_size = p.sq_entries * sizeof(::io_uring_sqe);
+  sqes_map.reset(checked_mmap(sqes_size, MAP_SHARED | MAP_POPULATE,
+                              fd.get(), IORING_OFF_SQES), sqes_size);
+
+  char* const sq_base = sq_ring.get();
+  sq_head  = at<unsigned>(sq_base, p.sq_off.head);
+  sq_tail  = at<unsigned>(sq_base, p.sq_off.tail);
+  sq_array = at<unsigned>(sq_base, p.sq_off.array);
+  sq_mask  = *at<unsigned>(sq_base, p.sq_off.ring_mask);
+  sqes     = reinterpret_cast<::io_uring_sqe*>(sqes_map.get());
+
+  cq_head  = at<unsigned>(cq_base, p.cq_off.head);
+  cq_tail  = at<unsigned>(cq_base, p.cq_off.tail);
+  cq_mask  = *at<unsigned>(cq_base, p.cq_off.ring_mask);
+  cqes     = at<::io_uring_cqe>(cq_base, p.cq_off.cqes);
+
+  tail = *sq_tail;
+}
+
+::io_uring_sqe* nanonet::util::io_ring::impl::get_sqe() {
+  if (tail - load_acquire(sq_head) >= p.sq_entries) {
+    // Full: Submit what we have, completions are reaped by wait()
+    submit(0, nullptr);
+    if (tail - load_acquire(sq_head) >= p.sq_entries) {
+      throw std::runtime_error("io_ring: submission queue overflow");
+    }
+  }
+
+  unsigned const index = tail & sq_mask;
+  ::io_uring_sqe* const ret = &sqes[index];
+  std::memset(ret, 0, sizeof(*ret));
+  sq_array[index] = index;
+  ++tail;
+  ++queued;
+  return ret;
+}
+
+void nanonet::util::io_ring::impl::submit(
+    unsigned const min_complete, ::__kernel_timespec* const ts) {
+  store_release(sq_tail, tail);
+
+  ::io_uring_getevents_arg arg;
+  std::memset(&arg, 0, sizeof(arg));
+  arg.sigmask_sz = _NSIG / 8;
+  arg.ts = reinterpret_cast<std::uint64_t>(ts);
+
+  unsigned flags = IORING_ENTER_EXT_ARG;
+  if (min_complete > 0) {
+    flags |= IORING_ENTER_GETEVENTS;
+  }
+
+  int const n = io_uring_enter(
+      fd.get(), queued, min_complete, flags, &arg, sizeof(arg));
+  if (n >= 0) {
+    queued -= std::min(static_cast<unsigned>(n), queued);
+    return;
+  }
+
+  // Timeouts, signals and a full completion queue are no errors here,
+  // wait() just reaps what's there.
+  if (ETIME == errno or EINTR == errno or EBUSY == errno or EAGAIN == errno) {
+    return;
+  }
+  nanonet::detail_::strerror_exception("io_uring_enter");
+}
+
+bool nanonet::util::io_ring::completion::more() const {
+  return flags & IORING_CQE_F_MORE;
+}
+
+bool nanonet::util::io_ring::completion::has_buffer() const {
+  return flags & IORING_CQE_F_BUFFER;
+}
+
+unsigned nanonet::util::io_ring::completion::buffer() const {
+  return flags >> IORING_CQE_BUFFER_SHIFT;
+}
+
+bool nanonet::util::io_ring::available() {
+  static const bool ret = [] {
+    try {
+      io_ring r(2);
+      // Provided buffer rings and multishot receive need kernel 6.0
+      r.provide_buffers(1, 64);
+      return true;
+    } catch (std::exception const&) {
+      return false;
+    }
+  }();
+  return ret;
+}
+
+nanonet::util::io_ring::io_ring(unsigned const entries)
+: impl_(std::make_unique<impl>(entries))
+{}
+
+nanonet::util::io_ring::~io_ring() {}
+
+void nanonet::util::io_ring::provide_buffers(
+    unsigned const count, unsigned const size) {
+  always_assert(not impl_->buf_ring);
+  always_assert(count > 0 and count <= 32768);
+  always_assert(0 == (count & (count - 1)));
+  always_assert(size > 0);
+
+  std::size_t const ring_size = count * sizeof(::io_uring_buf);
+  impl_->buf_ring_map.reset(
+      checked_mmap(ring_size, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0), ring_size);
+
+  ::io_uring_buf_reg reg;
+  std::memset(&reg, 0, sizeof(reg));
+  reg.ring_addr = reinterpret_cast<std::uint64_t>(impl_->buf_ring_map.get());
+  reg.ring_entries = count;
+  reg.bgid = 0;
+  if (io_uring_register(
+          impl_->fd.get(), IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+    nanonet::detail_::strerror_exception("io_uring_register: buffer ring");
+  }
+
+  impl_->buf_ring =
+      reinterpret_cast<::io_uring_buf*>(impl_->buf_ring_map.get());
+  impl_->buffers.resize(static_cast<std::size_t>(count) * size);
+  impl_->buffer_size = size;
+  impl_->buf_mask = count - 1;
+  impl_->buf_tail = 0;
+
+  for (unsigned id = 0; id < count; ++id) {
+    recycle_buffer(id);
+  }
+}
+
+char* nanonet::util::io_ring::buffer_data(unsigned const id) {
+  return &impl_->buffers[static_cast<std::size_t>(id) * impl_->buffer_size];
+}
+
+void nanonet::util::io_ring::recycle_buffer(unsigned const id) {
+  ::io_uring_buf& b = impl_->buf_ring[impl_->buf_tail & impl_->buf_mask];
+  b.addr = reinterpret_cast<std::uint64_t>(buffer_data(id));
+  b.len  = impl_->buffer_size;
+  b.bid  = static_cast<std::uint16_t>(id);
+  ++impl_->buf_tail;
+  store_release(&impl_->buf_ring[0].resv, impl_->buf_tail);
+}
+
+void nanonet::util::io_ring::accept_multishot(
+    socketfd_t const fd, std::uint64_t const user_data) {
+  ::io_uring_sqe* const sqe = impl_->get_sqe();
+  sqe->opcode = IORING_OP_ACCEPT;
+  sqe->fd = fd;
+  sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+  sqe->accept_flags = SOCK_CLOEXEC;
+  sqe->user_data = user_data;
+}
+
+void nanonet::util::io_ring::recv_multishot(
+    socketfd_t const fd, std::uint64_t const user_data) {
+  always_assert(impl_->buf_ring);
+  ::io_uring_sqe* const sqe = impl_->get_sqe();
+  sqe->opcode = IORING_OP_RECV;
+  sqe->fd = fd;
+  sqe->ioprio = IORING_RECV_MULTISHOT;
+  sqe->flags = IOSQE_BUFFER_SELECT;
+  sqe->buf_group = 0;
+  sqe->user_data = user_data;
+}
+
+void nanonet::util::io_ring::send(
+    socketfd_t const fd, const char* const buf, long const n,
+    std::uint64_t const user_data) {
+  ::io_uring_sqe* const sqe = impl_->get_sqe();
+  sqe->opcode = IORING_OP_SEND;
+  sqe->fd = fd;
+  sqe->addr = reinterpret_cast<std::uint64_t>(buf);
+  sqe->len = static_cast<std::uint32_t>(n);
+  sqe->msg_flags = MSG_NOSIGNAL;
+  sqe->user_data = user_data;
+}
+
+void nanonet::util::io_ring::read(
+    socketfd_t const fd, void* const buf, unsigned const n,
+    std::uint64_t const user_data) {
+  ::io_uring_sqe* const sqe = impl_->get_sqe();
+  sqe->opcode = IORING_OP_READ;
+  sqe->fd = fd;
+  sqe->addr = reinterpret_cast<std::uint64_t>(buf);
+  sqe->len = n;
+  sqe->off = static_cast<std::uint64_t>(-1);
+  sqe->user_data = user_data;
+}
+
+void nanonet::util::io_ring::poll_readable(
+    socketfd_t const fd, std::uint64_t const user_data) {
+  ::io_uring_sqe* const sqe = impl_->get_sqe();
+  sqe->opcode = IORING_OP_POLL_ADD;
+  sqe->fd = fd;
+  sqe->poll32_events = POLLIN;
+  sqe->user_data = user_data;
+}
+
+void nanonet::util::io_ring::cancel(
+    std::uint64_t const target, std::uint64_t const user_data) {
+  ::io_uring_sqe* const sqe = impl_->get_sqe();
+  sqe->opcode = IORING_OP_ASYNC_CANCEL;
+  sqe->fd = -1;
+  sqe->addr = target;
+  sqe->user_data = user_data;
+}
+
+long nanonet::util::io_ring::wait(
+    double const timeout, completion_handler const& h) {
+  impl& r = *impl_;
+
+  bool const ready = load_acquire(r.cq_tail) != *r.cq_head;
+  if (ready) {
+    // Just submit
+    if (r.queued > 0) {
+      r.submit(0, nullptr);
+    }
+  } else if (timeout < 0) {
+    r.submit(1, nullptr);
+  } else {
+    ::__kernel_timespec ts;
+    ts.tv_sec  = static_cast<long long>(timeout);
+    ts.tv_nsec = static_cast<long long>(std::fmod(timeout, 1.0) * 1e9);
+    r.submit(1, &ts);
+  }
+
+  long ret = 0;
+  while (true) {
+    unsigned const head = *r.cq_head;
+    if (head == load_acquire(r.cq_tail)) {
+      break;
+    }
+    ::io_uring_cqe const& cqe = r.cqes[head & r.cq_mask];
+    completion c;
+    c.user_data = cqe.user_data;
+    c.res       = cqe.res;
+    c.flags     = cqe.flags;
+    // Free the slot before calling the handler
+    store_release(r.cq_head, head + 1);
+
+    h(c);
+    ++ret;
+  }
+  return ret;
+}
+
+#else // NANONET_HAVE_IO_URING
+
+struct nanonet::util::io_ring::impl {};
+
+bool nanonet::util::io_ring::completion::more      () const { return false; }
+bool nanonet::util::io_ring::completion::has_buffer() const { return false; }
+unsigned nanonet::util::io_ring::completion::buffer() const { return 0; }
+
+bool nanonet::util::io_ring::available() { return false; }
+
+nanonet::util::io_ring::io_ring(unsigned) {
+  throw std::runtime_error(
+      "io_ring: not supported, build with -DNANONET_IO_URING=ON on Linux");
+}
+
+nanonet::util::io_ring::~io_ring() {}
+
+void nanonet::util::io_ring::provide_buffers(unsigned, unsigned) {}
+char* nanonet::util::io_ring::buffer_data(unsigned) { return nullptr; }
+void nanonet::util::io_ring::recycle_buffer(unsigned) {}
+void nanonet::util::io_ring::accept_multishot(socketfd_t, std::uint64_t) {}
+void nanonet::util::io_ring::recv_multishot(socketfd_t, std::uint64_t) {}
+void nanonet::util::io_ring::send(
+    socketfd_t, const char*, long, std::uint64_t) {}
+void nanonet::util::io_ring::read(socketfd_t, void*, unsigned, std::uint64_t) {}
+void nanonet::util::io_ring::poll_readable(socketfd_t, std::uint64_t) {}
+void nanonet::util::io_ring::cancel(std::uint64_t, std::uint64_t) {}
+long nanonet::util::io_ring::wait(double, completion_handler const&) {
+  return 0;
+}
+
+#endif // NANONET_HAVE_IO_URING
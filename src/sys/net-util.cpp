@@ -26,6 +26,8 @@ nanonet::util::network::address_family(
     return nanonet::util::network::ipv4;
   } else if ( "ip6" == desc || "ipv6" == desc ) {
     return nanonet::util::network::ipv6;
+  } else if ( "unix" == desc ) {
+    return nanonet::util::network::unix_domain;
   } else if ( "unspec" == desc || "any" == desc ) {
     if ( allow_unspec ) {
       return nanonet::util::network::ip_unspec;
@@ -38,6 +40,10 @@ nanonet::util::network::address_family(
   }
 }
 
+bool nanonet::util::network::is_unix_service(std::string const& service) {
+  return 0 == service.rfind( UNIX_SERVICE_PREFIX , 0 ) ;
+}
+
 void nanonet::util::network::check_port(const long long n)
 {
   if( n < 0 || n > 65535 )
@@ -16,19 +16,45 @@
 
 #include "nanonet/sys/server.h"
 
+#include "nanonet/buffer-pool.h"
+#include "nanonet/dispatch.h"
+#include "nanonet/http.h"
 #include "nanonet/math-util.h"
+#include "nanonet/rate-limiter.h"
+#include "nanonet/timer-wheel.h"
 #include "nanonet/util.h"
+#include "nanonet/xdr.h"
 
+#include "nanonet/sys/event-loop.h"
+#include "nanonet/sys/io-ring.h"
 #include "nanonet/sys/util.h"
 #include "nanonet/sys/syslogger.h"
 
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <charconv>
+#include <chrono>
+#include <condition_variable>
 #include <exception>
 #include <iostream>
+#include <limits>
 #include <functional>
+#include <mutex>
+#include <sstream>
 #include <stdexcept>
 #include <string>
 #include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <cstring>
+
+#if (BOOST_OS_LINUX)
+#  include <pthread.h>
+#  include <sys/eventfd.h>
+#endif
 
 using namespace nanonet::util          ;
 using namespace nanonet::util::log     ;
@@ -43,7 +69,194 @@ std::string nanonet::util::this_thread_id_paren() {
 
 namespace {
 
-using count_sentry = nanonet::util::increment_sentry<std::atomic_long>;
+// The handler of a server, either line or frame based
+struct connection_handler {
+  input_handler_type line;
+  frame_handler_type frame;
+  coroutine_handler_type coroutine;
+};
+
+// Limits the number of connections being served, see
+// server_parameters::max_connections.  Each admitted connection holds
+// a ticket, which counts it in status.connections_current.
+struct admission_control {
+  struct ticket {
+    explicit ticket(admission_control& a) : ac(&a) {}
+
+    ticket(ticket&& other) noexcept : ac(other.ac) { other.ac = nullptr; }
+
+    ticket& operator=(ticket&& other) noexcept {
+      std::swap(ac, other.ac);
+      return *this;
+    }
+
+    ~ticket() {
+      if (ac) {
+        ac->release();
+      }
+    }
+
+  private:
+    admission_control* ac;
+  };
+
+  admission_control(
+      server_parameters const& params, server_status& status_in)
+  : max(params.max_connections),
+    status(status_in)
+  {}
+
+  // @return true iff another connection may be admitted
+  bool has_room() const {
+    return max <= 0 or status.connections_current < max;
+  }
+
+  // @return A ticket if there is room for another connection
+  std::optional<ticket> try_admit();
+
+  // Waits until there is room for another connection, but at most
+  // timeout [s]
+  void wait_for_room(double timeout);
+
+private:
+  void release();
+
+  const long max;
+  server_status& status;
+  std::mutex mutex;
+  std::condition_variable cv;
+};
+
+std::optional<admission_control::ticket> admission_control::try_admit() {
+  if (max <= 0) {
+    ++status.connections_current;
+    return ticket(*this);
+  }
+  std::lock_guard<std::mutex> lock{mutex};
+  if (not has_room()) {
+    return std::nullopt;
+  }
+  ++status.connections_current;
+  return ticket(*this);
+}
+
+void admission_control::wait_for_room(double const timeout) {
+  std::unique_lock<std::mutex> lock{mutex};
+  cv.wait_for(lock, std::chrono::duration<double>(timeout),
+              [this] { return has_room(); });
+}
+
+void admission_control::release() {
+  if (max <= 0) {
+    --status.connections_current;
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lock{mutex};
+    --status.connections_current;
+  }
+  cv.notify_all();
+}
+
+using count_sentry = admission_control::ticket;
+
+// Keeps track of the connection threads.  On shutdown, wakes up the
+// ones waiting for input by shutting down the read side of their
+// sockets and waits until all of them have exited.
+struct connection_tracker {
+  // Registration of a connection thread, removed on destruction
+  struct entry {
+    entry(connection_tracker& t, std::uint64_t const id_in)
+    : tracker(&t), id(id_in) {}
+
+    entry(entry&& other) noexcept
+    : tracker(other.tracker), id(other.id) {
+      other.tracker = nullptr;
+    }
+
+    entry& operator=(entry&&) = delete;
+
+    ~entry() {
+      if (tracker) {
+        tracker->remove(id);
+      }
+    }
+
+    // Excludes the socket from wake_all(), call this before it's
+    // closed or if it should stay open on shutdown.
+    void detach_socket() {
+      if (tracker) {
+        tracker->detach_socket(id);
+      }
+    }
+
+  private:
+    connection_tracker* tracker;
+    std::uint64_t id;
+  };
+
+  entry add(nanonet::detail_::socketfd_t fd);
+
+  // Shuts down the read side of all sockets not detached
+  void wake_all();
+
+  // Waits until all entries are gone, logs progress to sl
+  void wait(std::ostream& sl);
+
+private:
+  void remove(std::uint64_t id);
+  void detach_socket(std::uint64_t id);
+
+  std::mutex mutex;
+  std::condition_variable cv;
+  std::unordered_map<std::uint64_t, nanonet::detail_::socketfd_t> sockets;
+  std::uint64_t next_id = 0;
+};
+
+connection_tracker::entry connection_tracker::add(nanonet::detail_::socketfd_t const fd) {
+  std::lock_guard<std::mutex> lock{mutex};
+  const std::uint64_t id = next_id++;
+  sockets.emplace(id, fd);
+  return entry(*this, id);
+}
+
+void connection_tracker::wake_all() {
+  std::lock_guard<std::mutex> lock{mutex};
+  for (auto const& id_fd : sockets) {
+    if (id_fd.second >= 0) {
+      nanonet::detail_::socket_shutdown_read(id_fd.second);
+    }
+  }
+}
+
+void connection_tracker::wait(std::ostream& sl) {
+  std::unique_lock<std::mutex> lock{mutex};
+  for (long n = 0; not sockets.empty(); n += 10) {
+    sl << prio::NOTICE 
+       << "Waiting for "
+       << sockets.size()
+       << " connection(s) to exit: Time [s]: " << n
+       << std::endl;
+    cv.wait_for(lock, std::chrono::seconds(10),
+                [this] { return sockets.empty(); });
+  }
+}
+
+void connection_tracker::remove(std::uint64_t const id) {
+  std::lock_guard<std::mutex> lock{mutex};
+  sockets.erase(id);
+  if (sockets.empty()) {
+    cv.notify_all();
+  }
+}
+
+void connection_tracker::detach_socket(std::uint64_t const id) {
+  std::lock_guard<std::mutex> lock{mutex};
+  const auto it = sockets.find(id);
+  if (sockets.end() != it) {
+    it->second = -1;
+  }
+}
 
 // A thread for each incoming connection
 struct connection_thread {
@@ -54,13 +267,16 @@ struct connection_thread {
 
   connection_thread(
       std::unique_ptr<nanonet::util::network::connection> c,
+      connection_tracker::entry tracked_in,
       count_sentry sentry_in,
       server_parameters const& params,
-      input_handler_type const& handler,
+      connection_handler const& handler,
       std::optional<os_writer> const welcome,
       std::reference_wrapper<nanonet::util::running_flag> running_in,
       std::reference_wrapper<nanonet::util::server_status> status_in)
-    : c{std::move(c)},
+    : tracked(std::move(tracked_in)),
+      accepted_at(std::chrono::steady_clock::now()),
+      c{std::move(c)},
       sentry(std::move(sentry_in)),
       params{params},
       handler{handler},
@@ -69,19 +285,39 @@ struct connection_thread {
       status(status_in)
   {}
 
+  // Counts the connection in connections_queued until it's served
+  void queue() {
+    ++status.get().connections_queued;
+    queued = true;
+  }
+
   // Connection count must be handled in operator(), or the move
   // constructors must be made aware of it.
-  void operator()();
+  void operator()() {
+    if (queued) {
+      --status.get().connections_queued;
+    }
+    serve();
+    tracked.detach_socket();
+    record_statistics();
+  }
 
 private:
+  void serve();
+  void record_statistics();
 
+  // Declared first and hence destroyed last, so that the tracker
+  // only considers the connection done when all is cleaned up.
+  connection_tracker::entry tracked;
+  std::chrono::steady_clock::time_point accepted_at;
   std::unique_ptr<connection> c;
   count_sentry sentry;
   server_parameters params;
-  input_handler_type handler;
+  connection_handler handler;
   std::optional<os_writer> welcome;
   std::reference_wrapper<nanonet::util::running_flag> running;
   std::reference_wrapper<nanonet::util::server_status> status;
+  bool queued = false;
 };
 
 
@@ -96,6 +332,9 @@ struct connection_rates {
   /// Updates cps values in provided status
   void update_status(server_status&) const;
 
+  /// @return Fast estimate at time now [s] without updating
+  double fast(double now) const { return re_fast.estimate(now); }
+
 private:
   nanonet::math::rate_estimator re_slow  ;
   nanonet::math::rate_estimator re_medium;
@@ -103,12 +342,227 @@ private:
 };
 
 
+// Load thresholds for entering and leaving the degraded and shedding
+// states, see server_parameters::shed_cps
+constexpr double DEGRADED_ENTER = 0.75;
+constexpr double DEGRADED_EXIT  = 0.6 ;
+constexpr double SHEDDING_ENTER = 1.0 ;
+constexpr double SHEDDING_EXIT  = 0.9 ;
+
+// Minimum interval between summaries of rejected connections [s]
+constexpr double REJECT_LOG_INTERVAL = 1.0;
+
+// Moves the server between the load states based on its connection
+// rate and counts, see server_parameters::shed_cps.  Thread safe.
+struct overload_controller {
+  overload_controller(
+      server_parameters const& params, server_status& status_in)
+  : cps(params.shed_cps),
+    connections(params.shed_connections),
+    queued(params.shed_queued),
+    name(params.server_name),
+    status(status_in)
+  {}
+
+  bool enabled() const {
+    return cps > 0 or connections > 0 or queued > 0;
+  }
+
+  // Updates the state given the fast connection rate estimate [1/s]
+  // @return The new state
+  load_state update(double cps_fast);
+
+  // Updates the state
+  // @return true iff a new connection should be shed
+  bool shed(double cps_fast);
+
+private:
+  const double cps;
+  const long connections;
+  const long queued;
+  const std::string name;
+  server_status& status;
+
+  std::mutex mutex;
+  double load = 0;
+  // Spreads the connections shed while degraded evenly
+  double shed_debt = 0;
+};
+
+load_state overload_controller::update(double const cps_fast) {
+  double l = 0;
+  if (cps > 0) {
+    l = std::max(l, cps_fast / cps);
+  }
+  if (connections > 0) {
+    l = std::max(l, static_cast<double>(status.connections_current)
+                    / connections);
+  }
+  if (queued > 0) {
+    l = std::max(l, static_cast<double>(status.connections_queued) / queued);
+  }
+
+  std::unique_lock<std::mutex> lock{mutex};
+  load = l;
+  const load_state old = status.load;
+  load_state next = old;
+  switch (old) {
+    case load_state::normal:
+      if (l >= SHEDDING_ENTER) {
+        next = load_state::shedding;
+      } else if (l >= DEGRADED_ENTER) {
+        next = load_state::degraded;
+      }
+      break;
+    case load_state::degraded:
+      if (l >= SHEDDING_ENTER) {
+        next = load_state::shedding;
+      } else if (l < DEGRADED_EXIT) {
+        next = load_state::normal;
+      }
+      break;
+    case load_state::shedding:
+      if (l < DEGRADED_EXIT) {
+        next = load_state::normal;
+      } else if (l < SHEDDING_EXIT) {
+        next = load_state::degraded;
+      }
+      break;
+  }
+
+  if (next == old) {
+    return next;
+  }
+  status.load = next;
+  shed_debt = 0;
+  lock.unlock();
+
+  static const char* const names[] = { "normal", "degraded", "shedding" };
+  syslogger sl{name + " overload"};
+  sl << (load_state::normal == next ? prio::NOTICE : prio::WARNING)
+     << "Load " << l << ", state " << names[static_cast<int>(old)]
+     << " -> " << names[static_cast<int>(next)]
+     << std::endl;
+  return next;
+}
+
+// Logs how many connections were shed, rate limited or rejected, at
+// most once per REJECT_LOG_INTERVAL and not per connection, so that a
+// connection storm doesn't turn into a storm of syslog writes.  The
+// counts come from server_status.  Thread safe.
+struct reject_summary {
+  reject_summary(
+      server_parameters const& params, server_status const& status_in)
+  : enabled(params.log_connections),
+    name(params.server_name),
+    status(status_in)
+  {}
+
+  // Logs the rest
+  ~reject_summary() { update(std::numeric_limits<double>::infinity()); }
+
+  // Call after counting a connection closed early at time now [s]
+  void update(double now);
+
+private:
+  const bool enabled;
+  const std::string name;
+  server_status const& status;
+
+  // Earliest time of the next summary [s]
+  std::atomic<double> next_log{0};
+
+  // Counts already logged, protected by mutex
+  std::mutex mutex;
+  long long shed = 0;
+  long long rate_limited = 0;
+  long long rejected = 0;
+};
+
+void reject_summary::update(double const now) {
+  if (not enabled or now < next_log.load(std::memory_order_relaxed)) {
+    return;
+  }
+
+  long long new_shed;
+  long long new_rate_limited;
+  long long new_rejected;
+  {
+    std::unique_lock<std::mutex> lock{mutex, std::try_to_lock};
+    // Another thread is logging
+    if (not lock.owns_lock()
+        or now < next_log.load(std::memory_order_relaxed)) {
+      return;
+    }
+    next_log.store(now + REJECT_LOG_INTERVAL, std::memory_order_relaxed);
+    new_shed         = status.connections_shed         - shed;
+    new_rate_limited = status.connections_rate_limited - rate_limited;
+    new_rejected     = status.connections_rejected     - rejected;
+    shed         += new_shed;
+    rate_limited += new_rate_limited;
+    rejected     += new_rejected;
+  }
+
+  if (0 == new_shed and 0 == new_rate_limited and 0 == new_rejected) {
+    return;
+  }
+  syslogger sl{name + " reject"};
+  sl << prio::WARNING << "Connections closed early: "
+     << new_shed << " shed, "
+     << new_rate_limited << " rate limited, "
+     << new_rejected << " rejected (busy)"
+     << std::endl;
+}
+
+bool overload_controller::shed(double const cps_fast) {
+  const load_state state = update(cps_fast);
+  if (load_state::normal == state) {
+    return false;
+  }
+  if (load_state::shedding == state) {
+    return true;
+  }
+
+  // Degraded: Shed a share growing linearly with the load
+  std::lock_guard<std::mutex> lock{mutex};
+  shed_debt += std::clamp(
+      (load - DEGRADED_EXIT) / (SHEDDING_ENTER - DEGRADED_EXIT), 0.0, 1.0);
+  if (shed_debt < 1) {
+    return false;
+  }
+  shed_debt -= 1;
+  return true;
+}
+
+// Records the time since construction in a histogram on destruction
+struct histogram_timer {
+  explicit histogram_timer(nanonet::math::sharded_histogram& h_in)
+  : h(h_in),
+    start(std::chrono::steady_clock::now())
+  {}
+
+  ~histogram_timer() {
+    h.record(std::chrono::duration<double>(
+        std::chrono::steady_clock::now() - start).count());
+  }
+
+private:
+  nanonet::math::sharded_histogram& h;
+  std::chrono::steady_clock::time_point start;
+};
+
+// @return Time [s] since t
+double seconds_since(std::chrono::steady_clock::time_point const t) {
+  return std::chrono::duration<double>(
+      std::chrono::steady_clock::now() - t).count();
+}
+
 void handle_connection(
     std::ostream& sl, 
     const server_parameters& params,
-    const nanonet::util::server_status& status,
+    nanonet::util::server_status& status,
     std::optional<os_writer> const welcome,
-    input_handler_type const& handler,
+    connection_handler const& handler,
     std::istream& is,
     std::ostream& os,
     nanonet::util::running_flag& running) {
@@ -117,15 +571,30 @@ void handle_connection(
     (welcome.value())(os, status);
   }
 
+  if (handler.frame) {
+    std::vector<char> frame;
+    while (running.running()
+           and nanonet::xdr::read_frame(is, frame, params.max_frame_size)) {
+      status.lines_received.add(1);
+      const histogram_timer timer(status.handler_time);
+      if (not handler.frame(frame, is, os, sl, status)) {
+        break;
+      }
+    }
+    return;
+  }
+
   std::string line;
   while (running.running() and nanonet::util::getline(is, line, params.max_line_length)) {
-    if (not handler(line, is, os, sl, status)) {
+    status.lines_received.add(1);
+    const histogram_timer timer(status.handler_time);
+    if (not handler.line(line, is, os, sl, status)) {
       break;
     }
   }
 }
 
-void connection_thread::operator()() { 
+void connection_thread::serve() { 
   if (not running.get().running()) {
     return;
   }
@@ -156,6 +625,8 @@ void connection_thread::operator()() {
 
   // Inner try
   } catch (nanonet::util::shutdown_exception const& e) {
+    // Keep the connection open for the client to close
+    tracked.detach_socket();
     running.get().shutdown();
     sl << prio::NOTICE << "Shutdown requested in connection from: " 
        << c->peer() << std::endl;
@@ -168,64 +639,1887 @@ void connection_thread::operator()() {
       sl << prio::NOTICE << "Client closed connection, ready for shutdown"
          << std::endl;
     }
-  } catch (std::exception const& e) {
-    sl << prio::ERR << "In connection from " << c->peer()
-       << ": " 
-       << e.what() << std::endl;
+  } catch (std::exception const& e) {
+    sl << prio::ERR << "In connection from " << c->peer()
+       << ": " 
+       << e.what() << std::endl;
+  }
+
+  // Outer try
+  } catch (std::exception const& e) {
+    sl << prio::CRIT 
+       << "WTF: Communication couldn't be set up in connection from "
+       << c->peer()
+       << ": " 
+       << e.what() << std::endl;
+  }
+}
+
+void connection_thread::record_statistics() {
+  auto const& s = *c->socket();
+  status.get().bytes_received.add(s.bytes_read());
+  status.get().bytes_sent.add(s.bytes_written());
+  if (s.bytes_written() > 0) {
+    status.get().time_to_first_byte.record(
+        std::chrono::duration<double>(s.first_write() - accepted_at).count());
+  }
+  status.get().connection_lifetime.record(seconds_since(accepted_at));
+}
+
+////////////////////////////////////////////////////////////////////////
+// Event driven connection handling, see server_parameters::event_threads
+////////////////////////////////////////////////////////////////////////
+
+// Wake up at least this often to check timeouts and the running flag [s]
+constexpr double EVENT_LOOP_TICK = 1.0;
+
+// Size of the per-thread receive buffer
+constexpr long EVENT_READ_BUFFER_SIZE = 65536;
+
+// Coroutine writes suspend while more output than that is pending [bytes]
+constexpr std::size_t COROUTINE_OUTPUT_HIGH_WATER = 65536;
+
+// Submission queue size for the io_uring accept loop
+constexpr unsigned ACCEPT_RING_ENTRIES = 16;
+
+// Maximum number of connections accepted per wakeup
+constexpr long ACCEPT_BATCH_SIZE = 64;
+
+// Checks the running flag at least this often while waiting for room
+// for another connection [s]
+constexpr double ADMISSION_WAIT_TICK = 0.1;
+
+// I/O timeout on the handoff control connection [s]
+constexpr double HANDOFF_TIMEOUT = 5.0;
+
+// Sent with the listening sockets, followed by the number of listener
+// shards and metrics listeners (0 or 1)
+constexpr char const* HANDOFF_GREETING = "NANONET-HANDOFF";
+
+// I/O timeout for metrics requests [s]
+constexpr double METRICS_TIMEOUT = 5.0;
+
+// An istream buffer on input that has been received but not yet
+// consumed by the line framing or the handler.
+struct input_view_streambuf : std::streambuf {
+  void set(char* const begin, char* const end) { setg(begin, begin, end); }
+  long consumed() const { return gptr() - eback(); }
+};
+
+// An ostream buffer appending to a connection's pending output
+struct output_string_streambuf : std::streambuf {
+  void set(std::string* const out) { out_ = out; }
+
+protected:
+  int_type overflow(int_type const c) override {
+    if (traits_type::eof() != c) {
+      out_->push_back(traits_type::to_char_type(c));
+    }
+    return traits_type::not_eof(c);
+  }
+
+  std::streamsize xsputn(const char* const s, std::streamsize const n) override {
+    out_->append(s, n);
+    return n;
+  }
+
+private:
+  std::string* out_ = nullptr;
+};
+
+// Resolution of the connection deadlines [s]
+constexpr double DEADLINE_RESOLUTION = 0.01;
+
+// The deadlines of a connection served by an event loop thread
+enum deadline_kind : std::uint64_t {
+  IDLE_DEADLINE, READ_DEADLINE, WRITE_DEADLINE, DEADLINE_KINDS
+};
+
+const char* const TIMEOUT_REASONS[DEADLINE_KINDS] = {
+  "Connection timed out (idle): ",
+  "Connection timed out (read): ",
+  "Connection timed out (write): "
+};
+
+typedef std::array<nanonet::util::timer_wheel::timer_id, DEADLINE_KINDS>
+    deadline_timers;
+
+void count_timeout(server_status& status, deadline_kind const kind) {
+  switch (kind) {
+    case IDLE_DEADLINE : ++status.timeouts_idle ; break;
+    case READ_DEADLINE : ++status.timeouts_read ; break;
+    case WRITE_DEADLINE: ++status.timeouts_write; break;
+    default: break;
+  }
+}
+
+// Idle, read and write deadlines of the connections of an event loop
+// thread in a timer wheel, so (re)arming is O(1) and only expired
+// connections are looked at.
+struct connection_deadlines {
+  explicit connection_deadlines(server_parameters const& params)
+  : wheel(DEADLINE_RESOLUTION, nanonet::util::utc()),
+    timeouts{params.timeout, params.read_timeout, params.write_timeout}
+  {}
+
+  // @return Timers for a new connection on fd, the idle one armed
+  deadline_timers add(nanonet::detail_::socketfd_t const fd) {
+    deadline_timers ret;
+    for (std::uint64_t k = 0; k < DEADLINE_KINDS; ++k) {
+      ret[k] = wheel.add(static_cast<std::uint64_t>(fd) * DEADLINE_KINDS + k);
+    }
+    activity(ret);
+    return ret;
+  }
+
+  void remove(deadline_timers const& t) {
+    for (const auto id : t) {
+      wheel.remove(id);
+    }
+  }
+
+  // Data has been received or sent
+  void activity(deadline_timers const& t) {
+    wheel.arm(t[IDLE_DEADLINE],
+              nanonet::util::utc() + timeouts[IDLE_DEADLINE]);
+  }
+
+  // The read deadline runs while a line or frame is incomplete.  It
+  // restarts when one has been completed.
+  void reading(deadline_timers const& t, bool incomplete, bool restart) {
+    update(t, READ_DEADLINE, incomplete, restart);
+  }
+
+  // The write deadline runs while output is pending.  It restarts
+  // when some has been sent.
+  void writing(deadline_timers const& t, bool pending, bool progress) {
+    update(t, WRITE_DEADLINE, pending, progress);
+  }
+
+  // Calls f(fd, kind) for the connections with an expired deadline,
+  // once per connection.  f may close the connection.
+  template<typename F> void expire(F const& f) {
+    expired.clear();
+    wheel.expire(nanonet::util::utc(),
+        [this](nanonet::util::timer_wheel::timer_id,
+               std::uint64_t const user_data) {
+      expired.push_back(user_data);
+    });
+
+    // Sorts by fd, then by kind
+    std::sort(expired.begin(), expired.end());
+    for (std::size_t i = 0; i < expired.size(); ++i) {
+      const std::uint64_t fd = expired[i] / DEADLINE_KINDS;
+      if (i > 0 and expired[i - 1] / DEADLINE_KINDS == fd) {
+        continue;
+      }
+      f(static_cast<nanonet::detail_::socketfd_t>(fd),
+        static_cast<deadline_kind>(expired[i] % DEADLINE_KINDS));
+    }
+  }
+
+  // @return How long to wait for events at most [s]
+  double wait_time(double const max) const {
+    return std::clamp(wheel.next_expiry() - nanonet::util::utc(), 0.0, max);
+  }
+
+private:
+  void update(deadline_timers const& t, deadline_kind const kind,
+              bool const active, bool const restart) {
+    if (timeouts[kind] <= 0) {
+      return;
+    }
+    const auto id = t[kind];
+    if (not active) {
+      wheel.disarm(id);
+    } else if (restart or not wheel.armed(id)) {
+      wheel.arm(id, nanonet::util::utc() + timeouts[kind]);
+    }
+  }
+
+  nanonet::util::timer_wheel wheel;
+  std::array<double, DEADLINE_KINDS> timeouts;
+
+  // Reused by expire()
+  std::vector<std::uint64_t> expired;
+};
+
+// State of a connection served by an event loop or io_uring worker
+struct event_connection {
+  event_connection(std::unique_ptr<connection> c_in, count_sentry sentry_in)
+  : c(std::move(c_in)),
+    sentry(std::move(sentry_in))
+  {}
+
+  std::unique_ptr<connection> c;
+  count_sentry sentry;
+
+  std::chrono::steady_clock::time_point accepted_at =
+      std::chrono::steady_clock::now();
+  bool sent_any = false;
+
+  // Received input not yet consumed
+  std::string in;
+
+  // Pending output and the number of bytes thereof already sent
+  std::string out;
+  std::size_t out_sent = 0;
+
+  // Events we're currently interested in (epoll)
+  unsigned interest = nanonet::util::event_loop::readable;
+
+  // Output currently owned by the kernel and requests in flight
+  // (io_uring)
+  std::string sending;
+  bool recv_armed = false;
+  bool send_in_flight = false;
+
+  deadline_timers timers = {};
+
+  // Close as soon as the pending output has been sent
+  bool closing = false;
+
+  // Shutdown requested; discard input until the client closes
+  bool draining = false;
+
+  // Closed, waiting for requests in flight (io_uring)
+  bool closed = false;
+};
+
+// A thread serving connections handed over by the event_engine
+struct engine_worker {
+  virtual ~engine_worker() {}
+
+  // Thread safe: Hands the connection over to this worker
+  virtual void add(std::shared_ptr<event_connection> ec) = 0;
+
+  // Thread function, returns after shutdown when the last connection
+  // has been closed.
+  virtual void run() = 0;
+};
+
+// Connection handling common to the epoll and io_uring workers: Line
+// or frame framing, handler calls and timeouts.  One thread serves many
+// connections.
+struct worker_base : engine_worker {
+  worker_base(
+      std::string const& name,
+      server_parameters const& params_in,
+      connection_handler const& handler_in,
+      std::optional<os_writer> const welcome_in,
+      nanonet::util::running_flag& running_in,
+      nanonet::util::server_status& status_in)
+  : params(params_in),
+    handler(handler_in),
+    welcome(welcome_in),
+    running(running_in),
+    status(status_in),
+    sl(name),
+    deadlines(params_in)
+  {}
+
+protected:
+  // Closes the connection on fd after trying to send pending output
+  virtual void close(nanonet::detail_::socketfd_t fd, const char* reason) = 0;
+
+  void greet(nanonet::detail_::socketfd_t fd,
+             std::shared_ptr<event_connection> const& ec);
+  void process_input(event_connection& ec);
+  std::size_t process_lines(event_connection& ec);
+  std::size_t process_frames(event_connection& ec);
+  void call_handler(event_connection& ec, std::string const& line);
+  void call_handler(event_connection& ec, std::span<const char> frame);
+  template<typename F> void guard_handler(event_connection& ec, F const& f);
+  void client_closed(nanonet::detail_::socketfd_t fd,
+                     event_connection const& ec);
+  void log_closing(event_connection const& ec, const char* reason);
+  void record_sent(event_connection& ec, long n);
+  void record_closed(event_connection const& ec);
+  void timed_out(nanonet::detail_::socketfd_t fd, deadline_kind kind);
+  void close_on_shutdown();
+
+  // Runs poll(timeout) until shutdown and no more connections
+  void loop_until_done(std::function<void(double)> const& poll);
+
+  server_parameters params;
+  connection_handler handler;
+  std::optional<os_writer> welcome;
+  nanonet::util::running_flag& running;
+  nanonet::util::server_status& status;
+
+  syslogger sl;
+  std::unordered_map<
+    nanonet::detail_::socketfd_t,
+    std::shared_ptr<event_connection>> connections;
+  connection_deadlines deadlines;
+
+private:
+  // Reused for all connections
+  std::string line;
+  input_view_streambuf ibuf;
+  output_string_streambuf obuf;
+  std::istream is{&ibuf};
+  std::ostream os{&obuf};
+};
+
+// Registers the connection and writes the welcome message to its output
+void worker_base::greet(
+    nanonet::detail_::socketfd_t const fd,
+    std::shared_ptr<event_connection> const& ec) {
+  ec->timers = deadlines.add(fd);
+  connections.emplace(fd, ec);
+
+  if (params.log_connections) {
+    sl << prio::NOTICE << "New connection from " << ec->c->peer()
+       << "; currently " << status.connections_current
+       << "/total " << status.connections_total
+       << " connection(s)"
+       << std::endl;
+  }
+
+  if (welcome) {
+    obuf.set(&ec->out);
+    try {
+      (welcome.value())(os, status);
+    } catch (std::exception const& e) {
+      sl << prio::ERR << "In connection from " << ec->c->peer()
+         << ": " << e.what() << std::endl;
+      ec->closing = true;
+    }
+    os.clear();
+  }
+}
+
+// Passes complete lines or frames to the handler and keeps the rest
+void worker_base::process_input(event_connection& ec) {
+  const std::size_t consumed =
+      handler.frame ? process_frames(ec) : process_lines(ec);
+  ec.in.erase(0, consumed);
+  deadlines.reading(ec.timers, not ec.in.empty(), consumed > 0);
+}
+
+// Line framing as in nanonet::util::getline():  Lines longer than
+// max_line_length run over into the next line, an incomplete line at
+// EOF is dropped.
+// @return Number of bytes consumed
+std::size_t worker_base::process_lines(event_connection& ec) {
+  const std::size_t max = params.max_line_length;
+  std::size_t pos = 0;
+
+  while (running.running() and not ec.closing and not ec.draining) {
+    char* const begin = &ec.in[0] + pos;
+    const std::size_t avail = ec.in.size() - pos;
+
+    const char* const nl =
+        nanonet::util::find_char(begin, '\n', std::min(avail, max));
+
+    std::size_t length = 0;
+    std::size_t consumed = 0;
+    if (nl) {
+      length = nl - begin;
+      consumed = length + 1;
+    } else if (avail >= max) {
+      length = max;
+      consumed = max;
+    } else {
+      break;
+    }
+
+    line.assign(begin, length);
+    pos += consumed;
+
+    // The handler may consume more input from is
+    ibuf.set(&ec.in[0] + pos, &ec.in[0] + ec.in.size());
+    is.clear();
+    call_handler(ec, line);
+    pos += ibuf.consumed();
+  }
+
+  return pos;
+}
+
+// Frame framing as in nanonet::xdr::read_frame(), but the handler
+// gets the frame in place.  Frames larger than max_frame_size close the
+// connection, an incomplete frame at EOF is dropped.
+// @return Number of bytes consumed
+std::size_t worker_base::process_frames(event_connection& ec) {
+  const std::size_t max = params.max_frame_size;
+  std::size_t pos = 0;
+
+  while (running.running() and not ec.closing and not ec.draining) {
+    const char* begin = &ec.in[0] + pos;
+    const std::size_t avail = ec.in.size() - pos;
+    if (avail < nanonet::xdr::FRAME_HEADER_SIZE) {
+      break;
+    }
+
+    const std::size_t size = nanonet::xdr::read_integer<false, 32>(begin);
+    if (size > max) {
+      sl << prio::ERR << "In connection from " << ec.c->peer()
+         << ": Frame size " << size << " exceeds maximum of " << max
+         << std::endl;
+      ec.closing = true;
+      break;
+    }
+
+    const std::size_t total =
+        nanonet::xdr::FRAME_HEADER_SIZE + size + nanonet::xdr::padsize(size);
+    if (avail < total) {
+      break;
+    }
+    pos += total;
+
+    // The handler may consume more input from is
+    ibuf.set(&ec.in[0] + pos, &ec.in[0] + ec.in.size());
+    is.clear();
+    call_handler(ec, std::span<const char>(begin, size));
+    pos += ibuf.consumed();
+  }
+
+  return pos;
+}
+
+void worker_base::call_handler(event_connection& ec, std::string const& l) {
+  guard_handler(ec, [&] { return handler.line(l, is, os, sl, status); });
+}
+
+void worker_base::call_handler(
+    event_connection& ec, std::span<const char> const frame) {
+  guard_handler(ec, [&] { return handler.frame(frame, is, os, sl, status); });
+}
+
+// Calls f() with output going to ec, handles its return value and
+// exceptions
+template<typename F>
+void worker_base::guard_handler(event_connection& ec, F const& f) {
+  obuf.set(&ec.out);
+  status.lines_received.add(1);
+  const histogram_timer timer(status.handler_time);
+  try {
+    if (not f()) {
+      ec.closing = true;
+    }
+  } catch (nanonet::util::shutdown_exception const& e) {
+    running.shutdown();
+    sl << prio::NOTICE << "Shutdown requested in connection from: "
+       << ec.c->peer() << std::endl;
+
+    if (params.shutdown_wait_for_client_close) {
+      sl << prio::NOTICE << "Waiting for client to close the connection..."
+         << std::endl;
+      ec.draining = true;
+      ec.in.clear();
+    } else {
+      ec.closing = true;
+    }
+  } catch (std::exception const& e) {
+    sl << prio::ERR << "In connection from " << ec.c->peer()
+       << ": "
+       << e.what() << std::endl;
+    ec.closing = true;
+  }
+  os.clear();
+}
+
+void worker_base::client_closed(
+    nanonet::detail_::socketfd_t const fd, event_connection const& ec) {
+  if (ec.draining) {
+    sl << prio::NOTICE << "Client closed connection, ready for shutdown"
+       << std::endl;
+  }
+  close(fd, "Connection closing: ");
+}
+
+void worker_base::log_closing(
+    event_connection const& ec, const char* const reason) {
+  if (params.log_connections) {
+    sl << prio::NOTICE << reason << ec.c->peer() << std::endl;
+  }
+}
+
+void worker_base::record_sent(event_connection& ec, long const n) {
+  deadlines.activity(ec.timers);
+  deadlines.writing(ec.timers, true, true);
+  if (not ec.sent_any) {
+    ec.sent_any = true;
+    status.time_to_first_byte.record(seconds_since(ec.accepted_at));
+  }
+  status.bytes_sent.add(n);
+}
+
+void worker_base::record_closed(event_connection const& ec) {
+  status.connection_lifetime.record(seconds_since(ec.accepted_at));
+}
+
+void worker_base::timed_out(
+    nanonet::detail_::socketfd_t const fd, deadline_kind const kind) {
+  count_timeout(status, kind);
+  close(fd, TIMEOUT_REASONS[kind]);
+}
+
+// Closes all connections except those waiting for the client to close
+void worker_base::close_on_shutdown() {
+  std::vector<nanonet::detail_::socketfd_t> closed;
+  for (auto const& fd_ec : connections) {
+    event_connection const& ec = *fd_ec.second;
+    if (not ec.draining and not ec.closed) {
+      closed.push_back(fd_ec.first);
+    }
+  }
+
+  for (const auto fd : closed) {
+    close(fd, "Connection closing on shutdown: ");
+  }
+}
+
+void worker_base::loop_until_done(std::function<void(double)> const& poll) {
+  try {
+    while (running.running() or not connections.empty()) {
+      poll(deadlines.wait_time(EVENT_LOOP_TICK));
+
+      deadlines.expire([this](nanonet::detail_::socketfd_t const fd,
+                              deadline_kind const kind) {
+        timed_out(fd, kind);
+      });
+      if (not running.running()) {
+        close_on_shutdown();
+      }
+    }
+  } catch (std::exception const& e) {
+    sl << prio::CRIT << "WTF: Event loop terminated: " << e.what()
+       << std::endl;
+  }
+}
+
+// Worker based on nanonet::util::event_loop (epoll):  Reads and
+// writes when the socket is ready.
+struct event_worker : worker_base {
+  template<typename... ARGS>
+  event_worker(ARGS&&... args)
+  : worker_base(std::forward<ARGS>(args)...),
+    read_buffer(EVENT_READ_BUFFER_SIZE)
+  {}
+
+  void add(std::shared_ptr<event_connection> ec) override {
+    loop.post([this, ec] { register_connection(ec); });
+  }
+
+  void run() override {
+    // Wake up on shutdown.  The descriptor stays readable, so we
+    // only need to see it once.
+    const auto wfd = running.wait_fd();
+    loop.add(wfd, nanonet::util::event_loop::readable,
+        [this, wfd](unsigned) { loop.remove(wfd); });
+    loop_until_done([this](double const t) { loop.run_once(t); });
+  }
+
+private:
+  void register_connection(std::shared_ptr<event_connection> const& ec);
+  void on_event(nanonet::detail_::socketfd_t fd, unsigned events);
+  bool flush(event_connection& ec);
+  void finish(nanonet::detail_::socketfd_t fd, event_connection& ec);
+  void close(nanonet::detail_::socketfd_t fd, const char* reason) override;
+
+  nanonet::util::event_loop loop;
+  std::vector<char> read_buffer;
+};
+
+void event_worker::register_connection(
+    std::shared_ptr<event_connection> const& ec) {
+  const auto fd = ec->c->fd();
+  greet(fd, ec);
+  loop.add(fd, ec->interest,
+      [this, fd](unsigned const events) { on_event(fd, events); });
+  finish(fd, *ec);
+}
+
+void event_worker::on_event(
+    nanonet::detail_::socketfd_t const fd, unsigned const events) {
+  const auto it = connections.find(fd);
+  if (connections.end() == it) {
+    return;
+  }
+  // Keep alive until we're done, close() erases it from connections
+  const std::shared_ptr<event_connection> ecp = it->second;
+  event_connection& ec = *ecp;
+
+  if (events & nanonet::util::event_loop::writable) {
+    if (not flush(ec)) {
+      close(fd, "Write error, connection closing: ");
+      return;
+    }
+  }
+
+  if (not (events & (nanonet::util::event_loop::readable
+                   | nanonet::util::event_loop::hangup))) {
+    finish(fd, ec);
+    return;
+  }
+
+  // Drain the socket.  Errors are treated like EOF.
+  bool eof = false;
+  while (true) {
+    const long n = ec.c->socket()->read(&read_buffer[0], read_buffer.size());
+    if (n > 0) {
+      deadlines.activity(ec.timers);
+      status.bytes_received.add(n);
+      if (not ec.draining) {
+        ec.in.append(&read_buffer[0], n);
+      }
+      if (n < static_cast<long>(read_buffer.size())) {
+        break;
+      }
+    } else if (n < 0 and (EAGAIN == errno or EWOULDBLOCK == errno)) {
+      break;
+    } else {
+      eof = true;
+      break;
+    }
+  }
+
+  process_input(ec);
+
+  if (eof) {
+    // The peer may only have shut down its write side
+    client_closed(fd, ec);
+    return;
+  }
+
+  finish(fd, ec);
+}
+
+// Sends as much pending output as possible.
+// @return false on errors
+bool event_worker::flush(event_connection& ec) {
+  while (ec.out_sent < ec.out.size()) {
+    long n = 0;
+    do {
+      n = nanonet::detail_::socketsend(
+          ec.c->fd(),
+          ec.out.data() + ec.out_sent, ec.out.size() - ec.out_sent);
+    } while (nanonet::detail_::EINTR_repeat(n));
+
+    if (n < 0) {
+      if (EAGAIN == errno or EWOULDBLOCK == errno) {
+        break;
+      }
+      return false;
+    }
+    ec.out_sent += n;
+    record_sent(ec, n);
+  }
+
+  if (ec.out_sent == ec.out.size()) {
+    ec.out.clear();
+    ec.out_sent = 0;
+  }
+  return true;
+}
+
+// Sends output and either closes the connection or waits for more
+// events, reading only if there's no output pending.
+void event_worker::finish(
+    nanonet::detail_::socketfd_t const fd, event_connection& ec) {
+  if (not flush(ec)) {
+    close(fd, "Write error, connection closing: ");
+    return;
+  }
+
+  const bool pending = not ec.out.empty();
+  if (ec.closing and not pending) {
+    close(fd, "Connection closing: ");
+    return;
+  }
+  deadlines.writing(ec.timers, pending, false);
+
+  const unsigned interest = pending ? nanonet::util::event_loop::writable
+                                    : nanonet::util::event_loop::readable;
+  if (interest != ec.interest) {
+    loop.modify(fd, interest);
+    ec.interest = interest;
+  }
+}
+
+void event_worker::close(
+    nanonet::detail_::socketfd_t const fd, const char* const reason) {
+  const auto it = connections.find(fd);
+  if (connections.end() == it) {
+    return;
+  }
+  // Best effort, the socket is non-blocking
+  flush(*it->second);
+  log_closing(*it->second, reason);
+  nanonet::detail_::socket_shutdown_write(fd);
+  loop.remove(fd);
+  record_closed(*it->second);
+  deadlines.remove(it->second->timers);
+  // Closes the socket and decrements the connection count
+  connections.erase(it);
+}
+
+#if (BOOST_OS_LINUX)
+
+// Worker based on nanonet::util::io_ring:  Multishot receive into
+// provided buffers, sends and new connections are submitted in one
+// batch per loop iteration.
+struct ring_worker : worker_base {
+  template<typename... ARGS>
+  ring_worker(ARGS&&... args)
+  : worker_base(std::forward<ARGS>(args)...),
+    ring(RING_ENTRIES),
+    wake_fd(::eventfd(0, EFD_CLOEXEC)) {
+    if (not wake_fd.valid()) {
+      nanonet::detail_::strerror_exception("eventfd");
+    }
+    ring.provide_buffers(RING_BUFFERS, RING_BUFFER_SIZE);
+    arm_wake();
+    ring.poll_readable(running.wait_fd(), key(SHUTDOWN, running.wait_fd()));
+  }
+
+  void add(std::shared_ptr<event_connection> ec) override {
+    {
+      std::lock_guard<std::mutex> lock{mutex};
+      posted.push_back(std::move(ec));
+    }
+    const std::uint64_t one = 1;
+    static_cast<void>(::write(wake_fd.get(), &one, sizeof(one)));
+  }
+
+  void run() override {
+    loop_until_done([this](double const t) {
+      ring.wait(t, [this](nanonet::util::io_ring::completion const& c) {
+        on_completion(c);
+      });
+    });
+  }
+
+private:
+  static constexpr unsigned RING_ENTRIES     = 1024;
+  static constexpr unsigned RING_BUFFERS     = 1024;
+  static constexpr unsigned RING_BUFFER_SIZE = 4096;
+
+  // Request types, user data is (op << 32) | fd
+  enum op : std::uint64_t { WAKE = 1, RECV, SEND, CANCEL, SHUTDOWN };
+
+  static std::uint64_t key(const op o, const nanonet::detail_::socketfd_t fd) {
+    return (static_cast<std::uint64_t>(o) << 32)
+         | static_cast<std::uint32_t>(fd);
+  }
+
+  void arm_wake() {
+    ring.read(wake_fd.get(), &wake_count, sizeof(wake_count),
+              key(WAKE, wake_fd.get()));
+  }
+
+  void on_completion(nanonet::util::io_ring::completion const& c);
+  void on_recv(nanonet::detail_::socketfd_t fd, event_connection& ec,
+               nanonet::util::io_ring::completion const& c);
+  void on_send(nanonet::detail_::socketfd_t fd, event_connection& ec,
+               int res);
+  void flush(nanonet::detail_::socketfd_t fd, event_connection& ec);
+  void finish(nanonet::detail_::socketfd_t fd, event_connection& ec);
+  void close(nanonet::detail_::socketfd_t fd, const char* reason) override;
+  void release(nanonet::detail_::socketfd_t fd, event_connection const& ec);
+
+  nanonet::util::io_ring ring;
+
+  // Wakes up the ring for new connections in posted
+  nanonet::detail_::auto_fd wake_fd;
+  std::uint64_t wake_count = 0;
+  std::mutex mutex;
+  std::vector<std::shared_ptr<event_connection>> posted;
+};
+
+void ring_worker::on_completion(nanonet::util::io_ring::completion const& c) {
+  const op o = static_cast<op>(c.user_data >> 32);
+  const auto fd =
+      static_cast<nanonet::detail_::socketfd_t>(c.user_data & 0xffffffff);
+
+  if (WAKE == o) {
+    std::vector<std::shared_ptr<event_connection>> added;
+    {
+      std::lock_guard<std::mutex> lock{mutex};
+      added.swap(posted);
+    }
+    for (auto const& ec : added) {
+      const auto efd = ec->c->fd();
+      greet(efd, ec);
+      ring.recv_multishot(efd, key(RECV, efd));
+      ec->recv_armed = true;
+      finish(efd, *ec);
+    }
+    arm_wake();
+    return;
+  }
+  if (SHUTDOWN == o) {
+    // loop_until_done() takes care of the rest
+    return;
+  }
+
+  const auto it = connections.find(fd);
+  if (connections.end() == it) {
+    if (c.has_buffer()) {
+      ring.recycle_buffer(c.buffer());
+    }
+    return;
+  }
+  // Keep alive until we're done, release() erases it from connections
+  const std::shared_ptr<event_connection> ecp = it->second;
+
+  if (RECV == o) {
+    on_recv(fd, *ecp, c);
+  } else if (SEND == o) {
+    on_send(fd, *ecp, c.res);
+  }
+  release(fd, *ecp);
+}
+
+void ring_worker::on_recv(
+    nanonet::detail_::socketfd_t const fd, event_connection& ec,
+    nanonet::util::io_ring::completion const& c) {
+  if (not c.more()) {
+    ec.recv_armed = false;
+  }
+  if (c.has_buffer()) {
+    if (c.res > 0) {
+      status.bytes_received.add(c.res);
+    }
+    if (c.res > 0 and not ec.closed and not ec.draining) {
+      ec.in.append(ring.buffer_data(c.buffer()), c.res);
+    }
+    ring.recycle_buffer(c.buffer());
+  }
+  if (ec.closed) {
+    return;
+  }
+
+  if (-ENOBUFS == c.res) {
+    // Out of buffers, try again
+    ring.recv_multishot(fd, key(RECV, fd));
+    ec.recv_armed = true;
+    return;
+  }
+  if (c.res <= 0) {
+    // Errors are treated like EOF
+    client_closed(fd, ec);
+    return;
+  }
+
+  deadlines.activity(ec.timers);
+  process_input(ec);
+  if (not ec.recv_armed) {
+    ring.recv_multishot(fd, key(RECV, fd));
+    ec.recv_armed = true;
+  }
+  finish(fd, ec);
+}
+
+void ring_worker::on_send(
+    nanonet::detail_::socketfd_t const fd, event_connection& ec,
+    int const res) {
+  ec.send_in_flight = false;
+  if (res < 0) {
+    ec.sending.clear();
+    ec.out.clear();
+    close(fd, "Write error, connection closing: ");
+    return;
+  }
+
+  ec.out_sent += res;
+  record_sent(ec, res);
+  if (ec.out_sent == ec.sending.size()) {
+    ec.sending.clear();
+    ec.out_sent = 0;
+  }
+  finish(fd, ec);
+}
+
+// Submits a send unless one is in flight.  The kernel owns sending
+// until the completion, new output is collected in out meanwhile.
+void ring_worker::flush(
+    nanonet::detail_::socketfd_t const fd, event_connection& ec) {
+  if (ec.send_in_flight) {
+    return;
+  }
+  if (ec.sending.empty()) {
+    ec.sending.swap(ec.out);
+    ec.out_sent = 0;
+  }
+  if (ec.sending.empty()) {
+    return;
+  }
+  ring.send(fd, ec.sending.data() + ec.out_sent,
+            ec.sending.size() - ec.out_sent, key(SEND, fd));
+  ec.send_in_flight = true;
+}
+
+void ring_worker::finish(
+    nanonet::detail_::socketfd_t const fd, event_connection& ec) {
+  flush(fd, ec);
+  if (ec.closing and not ec.closed and not ec.send_in_flight) {
+    close(fd, "Connection closing: ");
+    return;
+  }
+  deadlines.writing(ec.timers, ec.send_in_flight, false);
+}
+
+// Cancels the receive and lets pending output go out first.  A second
+// close (e.g. on timeout) aborts the connection.
+void ring_worker::close(
+    nanonet::detail_::socketfd_t const fd, const char* const reason) {
+  const auto it = connections.find(fd);
+  if (connections.end() == it) {
+    return;
+  }
+  event_connection& ec = *it->second;
+  if (ec.closed) {
+    nanonet::detail_::socket_shutdown_read (fd);
+    nanonet::detail_::socket_shutdown_write(fd);
+    return;
+  }
+
+  ec.closed = true;
+  log_closing(ec, reason);
+  if (ec.recv_armed) {
+    ring.cancel(key(RECV, fd), key(CANCEL, fd));
+  }
+  flush(fd, ec);
+  release(fd, ec);
+}
+
+// Erases a closed connection once no more requests are in flight.
+// Called again by on_completion() after close(), and fd may already
+// belong to a new connection then.
+void ring_worker::release(
+    nanonet::detail_::socketfd_t const fd, event_connection const& ec) {
+  const auto it = connections.find(fd);
+  if (connections.end() == it or it->second.get() != &ec) {
+    return;
+  }
+  if (ec.closed and not ec.recv_armed and not ec.send_in_flight) {
+    nanonet::detail_::socket_shutdown_write(fd);
+    record_closed(ec);
+    deadlines.remove(ec.timers);
+    // Closes the socket and decrements the connection count
+    connections.erase(it);
+  }
+}
+
+#endif // BOOST_OS_LINUX
+
+} // end anonymous namespace
+
+// State of a connection served by a coroutine_worker
+struct nanonet::util::co_connection::state {
+  enum class waiting_for { nothing, line, some, write };
+
+  state(std::unique_ptr<connection> c_in,
+        count_sentry sentry_in,
+        server_parameters const& params_in,
+        server_status& status_in,
+        std::ostream& log_in,
+        connection_deadlines& deadlines_in)
+  : c(std::move(c_in)),
+    sentry(std::move(sentry_in)),
+    params(params_in),
+    status(status_in),
+    log(log_in),
+    deadlines(deadlines_in)
+  {}
+
+  // Erases input consumed by the previous read
+  void discard_consumed() {
+    in.erase(0, consumed);
+    consumed = 0;
+  }
+
+  // @return true iff in contains a line as defined by getline()
+  bool line_ready() const {
+    const std::size_t max = params.max_line_length;
+    return in.size() >= max
+        or nanonet::util::find_char(in.data(), '\n', in.size());
+  }
+
+  // @return true iff the pending read or write can complete
+  bool ready() const {
+    switch (waiting) {
+      case waiting_for::line   : return eof or line_ready();
+      case waiting_for::some   : return eof or not in.empty();
+      case waiting_for::write  :
+        return failed or out.size() < COROUTINE_OUTPUT_HIGH_WATER;
+      case waiting_for::nothing: return false;
+    }
+    return false;
+  }
+
+  // @return Events of interest, read only if there's no output pending
+  unsigned wanted() const {
+    return out.empty() ? nanonet::util::event_loop::readable
+                       : nanonet::util::event_loop::writable;
+  }
+
+  // Sends as much pending output as possible without blocking.  On
+  // errors, discards the output and sets failed.
+  void flush();
+
+  // Ends input and output, e.g. on timeout
+  void fail() {
+    eof = true;
+    failed = true;
+    out.clear();
+    out_sent = 0;
+  }
+
+  std::unique_ptr<connection> c;
+  count_sentry sentry;
+  server_parameters const& params;
+  server_status& status;
+  std::ostream& log;
+  connection_deadlines& deadlines;
+  deadline_timers timers = {};
+
+  std::chrono::steady_clock::time_point accepted_at =
+      std::chrono::steady_clock::now();
+  bool sent_any = false;
+
+  // Received input and the part of it consumed by the last read
+  std::string in;
+  std::size_t consumed = 0;
+
+  // Output not sent yet
+  std::string out;
+  std::size_t out_sent = 0;
+
+  // End of input, timeout or shutdown; reads return end of input
+  bool eof = false;
+
+  // Write error or timeout; writes fail
+  bool failed = false;
+
+  // Shutdown requested; discard input until the client closes
+  bool draining = false;
+
+  // The pending operation and the coroutine waiting for it
+  waiting_for waiting = waiting_for::nothing;
+  std::coroutine_handle<> waiter;
+  unsigned interest = nanonet::util::event_loop::readable;
+
+  co_connection conn{*this};
+
+  // Declared last, the coroutine frames refer to the above
+  co_task<> task;
+};
+
+void nanonet::util::co_connection::state::flush() {
+  std::size_t sent = 0;
+  while (out_sent < out.size()) {
+    long res = 0;
+    do {
+      res = nanonet::detail_::socketsend(
+          c->fd(), out.data() + out_sent, out.size() - out_sent);
+    } while (nanonet::detail_::EINTR_repeat(res));
+
+    if (res < 0) {
+      if (EAGAIN == errno or EWOULDBLOCK == errno) {
+        break;
+      }
+      failed = true;
+      out.clear();
+      out_sent = 0;
+      return;
+    }
+    out_sent += res;
+    sent += res;
+  }
+
+  if (out_sent == out.size()) {
+    out.clear();
+    out_sent = 0;
+  }
+
+  if (sent > 0) {
+    deadlines.activity(timers);
+    deadlines.writing(timers, true, true);
+    if (not sent_any) {
+      sent_any = true;
+      status.time_to_first_byte.record(seconds_since(accepted_at));
+    }
+    status.bytes_sent.add(sent);
+  }
+}
+
+bool nanonet::util::co_connection::line_awaiter::await_ready() {
+  s.discard_consumed();
+  return s.eof or s.line_ready();
+}
+
+void nanonet::util::co_connection::line_awaiter::await_suspend(
+    std::coroutine_handle<> const h) {
+  s.waiting = state::waiting_for::line;
+  s.waiter = h;
+}
+
+std::optional<std::string_view>
+nanonet::util::co_connection::line_awaiter::await_resume() {
+  s.waiting = state::waiting_for::nothing;
+
+  // Line framing as in worker_base::process_input()
+  const std::size_t max = s.params.max_line_length;
+  const char* const nl = nanonet::util::find_char(
+      s.in.data(), '\n', std::min(s.in.size(), max));
+
+  std::size_t length = 0;
+  if (nl) {
+    length = nl - s.in.data();
+    s.consumed = length + 1;
+  } else if (s.in.size() >= max) {
+    length = max;
+    s.consumed = max;
+  } else {
+    return std::nullopt;
+  }
+
+  s.status.lines_received.add(1);
+  s.deadlines.reading(s.timers, false, false);
+  return std::string_view(s.in.data(), length);
+}
+
+bool nanonet::util::co_connection::read_awaiter::await_ready() {
+  s.discard_consumed();
+  return s.eof or not s.in.empty();
+}
+
+void nanonet::util::co_connection::read_awaiter::await_suspend(
+    std::coroutine_handle<> const h) {
+  s.waiting = state::waiting_for::some;
+  s.waiter = h;
+}
+
+long nanonet::util::co_connection::read_awaiter::await_resume() {
+  s.waiting = state::waiting_for::nothing;
+  const std::size_t n = std::min(s.in.size(), buffer.size());
+  std::memcpy(buffer.data(), s.in.data(), n);
+  s.consumed = n;
+  return n;
+}
+
+// Queues the data, the worker sends it once the coroutine waits for
+// input or finishes.  Only sends right away if too much is pending.
+bool nanonet::util::co_connection::write_awaiter::await_ready() {
+  if (s.failed) {
+    return true;
+  }
+  s.out.append(data.data(), data.size());
+  if (s.out.size() >= COROUTINE_OUTPUT_HIGH_WATER) {
+    s.flush();
+  }
+  return s.failed or s.out.size() < COROUTINE_OUTPUT_HIGH_WATER;
+}
+
+void nanonet::util::co_connection::write_awaiter::await_suspend(
+    std::coroutine_handle<> const h) {
+  s.waiting = state::waiting_for::write;
+  s.waiter = h;
+}
+
+bool nanonet::util::co_connection::write_awaiter::await_resume() {
+  s.waiting = state::waiting_for::nothing;
+  return not s.failed;
+}
+
+nanonet::util::network::connection::address_type
+nanonet::util::co_connection::peer() const {
+  return s_.c->peer();
+}
+
+nanonet::util::server_status const&
+nanonet::util::co_connection::status() const {
+  return s_.status;
+}
+
+std::ostream& nanonet::util::co_connection::log() const {
+  return s_.log;
+}
+
+namespace {
+
+// Worker based on nanonet::util::event_loop (epoll) for coroutine
+// handlers:  Resumes a connection's coroutine when its pending read or
+// write can complete.
+struct coroutine_worker : engine_worker {
+  coroutine_worker(
+      std::string const& name,
+      server_parameters const& params_in,
+      coroutine_handler_type const& handler_in,
+      nanonet::util::running_flag& running_in,
+      nanonet::util::server_status& status_in)
+  : params(params_in),
+    handler(handler_in),
+    running(running_in),
+    status(status_in),
+    sl(name),
+    read_buffer(EVENT_READ_BUFFER_SIZE),
+    deadlines(params_in)
+  {}
+
+  void add(std::shared_ptr<event_connection> ec) override {
+    loop.post([this, ec] { start(*ec); });
+  }
+
+  void run() override;
+
+private:
+  typedef nanonet::util::co_connection::state state;
+
+  void start(event_connection& ec);
+  void on_event(nanonet::detail_::socketfd_t fd, unsigned events);
+  void receive(state& s);
+  void resume(nanonet::detail_::socketfd_t fd, state& s);
+  void finished(nanonet::detail_::socketfd_t fd, state& s);
+  void timed_out(nanonet::detail_::socketfd_t fd, deadline_kind kind);
+  void end_on_shutdown();
+  void close(nanonet::detail_::socketfd_t fd, const char* reason);
+
+  server_parameters params;
+  coroutine_handler_type handler;
+  nanonet::util::running_flag& running;
+  nanonet::util::server_status& status;
+
+  syslogger sl;
+  nanonet::util::event_loop loop;
+  std::vector<char> read_buffer;
+  connection_deadlines deadlines;
+  std::unordered_map<
+    nanonet::detail_::socketfd_t,
+    std::unique_ptr<state>> connections;
+};
+
+void coroutine_worker::run() {
+  // Wake up on shutdown.  The descriptor stays readable, so we
+  // only need to see it once.
+  const auto wfd = running.wait_fd();
+  loop.add(wfd, nanonet::util::event_loop::readable,
+      [this, wfd](unsigned) { loop.remove(wfd); });
+
+  try {
+    while (running.running() or not connections.empty()) {
+      loop.run_once(deadlines.wait_time(EVENT_LOOP_TICK));
+
+      deadlines.expire([this](nanonet::detail_::socketfd_t const fd,
+                              deadline_kind const kind) {
+        timed_out(fd, kind);
+      });
+      if (not running.running()) {
+        end_on_shutdown();
+      }
+    }
+  } catch (std::exception const& e) {
+    sl << prio::CRIT << "WTF: Event loop terminated: " << e.what()
+       << std::endl;
+  }
+}
+
+// Registers the connection and runs its coroutine up to the first
+// suspension
+void coroutine_worker::start(event_connection& ec) {
+  const auto fd = ec.c->fd();
+  auto sp = std::make_unique<state>(
+      std::move(ec.c), std::move(ec.sentry), params, status, sl, deadlines);
+  state& s = *sp;
+  s.timers = deadlines.add(fd);
+  connections.emplace(fd, std::move(sp));
+
+  if (params.log_connections) {
+    sl << prio::NOTICE << "New connection from " << s.c->peer()
+       << "; currently " << status.connections_current
+       << "/total " << status.connections_total
+       << " connection(s)"
+       << std::endl;
+  }
+
+  loop.add(fd, s.interest,
+      [this, fd](unsigned const events) { on_event(fd, events); });
+
+  try {
+    s.task = handler(s.conn);
+  } catch (std::exception const& e) {
+    sl << prio::ERR << "In connection from " << s.c->peer()
+       << ": " << e.what() << std::endl;
+    close(fd, "Connection closing: ");
+    return;
+  }
+  s.task.start();
+  resume(fd, s);
+}
+
+void coroutine_worker::on_event(
+    nanonet::detail_::socketfd_t const fd, unsigned const events) {
+  const auto it = connections.find(fd);
+  if (connections.end() == it) {
+    return;
+  }
+  state& s = *it->second;
+
+  if (not s.out.empty()) {
+    if (events & (nanonet::util::event_loop::writable
+                | nanonet::util::event_loop::hangup)) {
+      s.flush();
+    }
+  } else if (events & (nanonet::util::event_loop::readable
+                     | nanonet::util::event_loop::hangup)) {
+    receive(s);
+  }
+
+  if (s.draining) {
+    if (s.eof) {
+      sl << prio::NOTICE << "Client closed connection, ready for shutdown"
+         << std::endl;
+      close(fd, "Connection closing: ");
+    }
+    return;
+  }
+
+  resume(fd, s);
+}
+
+// Drains the socket.  Errors are treated like EOF.
+void coroutine_worker::receive(state& s) {
+  while (true) {
+    const long n = s.c->socket()->read(&read_buffer[0], read_buffer.size());
+    if (n > 0) {
+      deadlines.activity(s.timers);
+      status.bytes_received.add(n);
+      if (not s.draining) {
+        s.in.append(&read_buffer[0], n);
+      }
+      if (n < static_cast<long>(read_buffer.size())) {
+        break;
+      }
+    } else if (n < 0 and (EAGAIN == errno or EWOULDBLOCK == errno)) {
+      break;
+    } else {
+      s.eof = true;
+      break;
+    }
+  }
+}
+
+// Resumes the coroutine as long as its pending operation can complete
+// and sends its output.  Then waits for the events it needs or cleans
+// up if it's finished and all output is sent.
+void coroutine_worker::resume(
+    nanonet::detail_::socketfd_t const fd, state& s) {
+  do {
+    while (s.waiter and s.ready()) {
+      std::exchange(s.waiter, nullptr).resume();
+    }
+    s.flush();
+  } while (s.waiter and s.ready());
+
+  deadlines.reading(s.timers,
+      state::waiting_for::line == s.waiting and not s.in.empty(), false);
+  deadlines.writing(s.timers, not s.out.empty(), false);
+
+  if (s.task.done() and s.out.empty()) {
+    finished(fd, s);
+    return;
+  }
+
+  const unsigned interest = s.wanted();
+  if (interest != s.interest) {
+    loop.modify(fd, interest);
+    s.interest = interest;
+  }
+}
+
+// Handles the coroutine's result and closes the connection unless
+// waiting for the client to close it.
+void coroutine_worker::finished(
+    nanonet::detail_::socketfd_t const fd, state& s) {
+  try {
+    s.task.get();
+  } catch (nanonet::util::shutdown_exception const& e) {
+    running.shutdown();
+    sl << prio::NOTICE << "Shutdown requested in connection from: "
+       << s.c->peer() << std::endl;
+
+    if (params.shutdown_wait_for_client_close and not s.eof) {
+      sl << prio::NOTICE << "Waiting for client to close the connection..."
+         << std::endl;
+      s.draining = true;
+      s.in.clear();
+      if (nanonet::util::event_loop::readable != s.interest) {
+        loop.modify(fd, nanonet::util::event_loop::readable);
+        s.interest = nanonet::util::event_loop::readable;
+      }
+      return;
+    }
+  } catch (std::exception const& e) {
+    sl << prio::ERR << "In connection from " << s.c->peer()
+       << ": " << e.what() << std::endl;
+  }
+  close(fd, "Connection closing: ");
+}
+
+// Ends input and output, or closes the connection if waiting for the
+// client to close it
+void coroutine_worker::timed_out(
+    nanonet::detail_::socketfd_t const fd, deadline_kind const kind) {
+  state& s = *connections.at(fd);
+  count_timeout(status, kind);
+  if (s.draining) {
+    close(fd, TIMEOUT_REASONS[kind]);
+    return;
+  }
+  if (params.log_connections) {
+    sl << prio::NOTICE << TIMEOUT_REASONS[kind] << s.c->peer() << std::endl;
+  }
+  s.fail();
+  resume(fd, s);
+}
+
+// Ends the input of all connections except those waiting for the
+// client to close
+void coroutine_worker::end_on_shutdown() {
+  std::vector<nanonet::detail_::socketfd_t> ended;
+  for (auto const& fd_s : connections) {
+    state const& s = *fd_s.second;
+    if (not s.draining and not s.eof) {
+      ended.push_back(fd_s.first);
+    }
+  }
+
+  for (const auto fd : ended) {
+    state& s = *connections.at(fd);
+    s.eof = true;
+    resume(fd, s);
+  }
+}
+
+void coroutine_worker::close(
+    nanonet::detail_::socketfd_t const fd, const char* const reason) {
+  const auto it = connections.find(fd);
+  if (connections.end() == it) {
+    return;
+  }
+  state& s = *it->second;
+  if (params.log_connections) {
+    sl << prio::NOTICE << reason << s.c->peer() << std::endl;
+  }
+  loop.remove(fd);
+  status.connection_lifetime.record(seconds_since(s.accepted_at));
+  deadlines.remove(s.timers);
+
+  // Destroys the coroutine frames, closes the socket and decrements
+  // the connection count
+  connections.erase(it);
+}
+
+// A set of workers, connections are distributed round-robin
+struct event_engine {
+  event_engine(
+      server_parameters const& params,
+      connection_handler const& handler,
+      std::optional<os_writer> const welcome,
+      nanonet::util::running_flag& running,
+      nanonet::util::server_status& status,
+      bool const use_io_ring_in)
+  : use_io_ring(use_io_ring_in) {
+    always_assert(params.event_threads > 0);
+    for (long i = 0; i < params.event_threads; ++i) {
+      const std::string name =
+          params.server_name + " event loop #" + std::to_string(i);
+      if (handler.coroutine) {
+        workers.push_back(std::make_unique<coroutine_worker>(
+            name, params, handler.coroutine, running, status));
+        continue;
+      }
+#if (BOOST_OS_LINUX)
+      if (use_io_ring) {
+        workers.push_back(std::make_unique<ring_worker>(
+            name, params, handler, welcome, running, status));
+        continue;
+      }
+#endif
+      workers.push_back(std::make_unique<event_worker>(
+          name, params, handler, welcome, running, status));
+    }
+    for (auto& w : workers) {
+      threads.push_back(std::thread([&w] { w->run(); }));
+    }
+  }
+
+  // Waits for all workers to exit, i.e. until the running flag is
+  // false and all connections have been closed.
+  ~event_engine() {
+    for (auto& t : threads) {
+      t.join();
+    }
+  }
+
+  // @return Whether add() needs non-blocking sockets.  epoll needs them,
+  // io_uring would return EAGAIN for them instead of waiting.
+  bool nonblocking() const { return not use_io_ring; }
+
+  // Hands c to the next worker, see nonblocking().  Thread safe, the
+  // accept threads of several listen shards may call it concurrently.
+  void add(std::unique_ptr<connection> c, count_sentry sentry) {
+    auto ec = std::make_shared<event_connection>(
+        std::move(c), std::move(sentry));
+    const std::size_t i =
+        next.fetch_add(1, std::memory_order_relaxed) % workers.size();
+    workers[i]->add(std::move(ec));
+  }
+
+private:
+  bool use_io_ring;
+  std::vector<std::unique_ptr<engine_worker>> workers;
+  std::vector<std::thread> threads;
+  std::atomic<std::size_t> next{0};
+};
+
+struct server_thread {
+  server_thread           (server_thread&&) = default;
+  server_thread& operator=(server_thread&&) = default;
+  server_thread(
+      std::vector<acceptor>&& acceptors_in,
+      std::optional<acceptor>&& metrics_acceptor_in,
+      std::optional<acceptor>&& handoff_acceptor_in,
+      connection_handler const& handler_in,
+      std::optional<os_writer> const welcome_in,
+      const server_parameters& params_in,
+      std::reference_wrapper<nanonet::util::running_flag> running_in)
+  : acceptors(std::move(acceptors_in)),
+    metrics_acceptor(std::move(metrics_acceptor_in)),
+    handoff_acceptor(std::move(handoff_acceptor_in)),
+    handler(handler_in),
+    welcome(welcome_in),
+    params(params_in),
+    running(running_in)
+  {}
+
+  void operator()();
+
+private:
+  // One per listener shard
+  std::vector<acceptor> acceptors;
+  // If metrics_service is given
+  std::optional<acceptor> metrics_acceptor;
+  // If handoff_service is given
+  std::optional<acceptor> handoff_acceptor;
+  connection_handler handler;
+  std::optional<os_writer> welcome;
+  server_parameters params;
+  std::reference_wrapper<nanonet::util::running_flag> running;
+};
+
+void log_params(
+    std::ostream& sl, 
+    server_parameters const& params, 
+    bool const production) {
+
+  sl << prio::NOTICE << "Starting service: " << params.server_name << std::endl;
+  sl << prio::NOTICE << "Mode: " 
+     << (production ? "Production" : "Test") << std::endl;
+  sl << prio::NOTICE << "Maximum backlog: " << params.backlog << std::endl;
+  sl << prio::NOTICE << "Connection timeout [s]: " 
+                     << params.timeout << std::endl;
+  sl << prio::NOTICE << "Maximum line length: " 
+                     << params.max_line_length << std::endl;
+  sl << prio::NOTICE << "Running in background: "
+                     << params.background
+                     << std::endl;
+  if (production and params.event_threads > 0) {
+    sl << prio::NOTICE << "Event loop threads: "
+                       << params.event_threads
+                       << std::endl;
+    sl << prio::NOTICE << "Read/write timeout [s]: "
+                       << params.read_timeout << "/"
+                       << params.write_timeout
+                       << std::endl;
+  }
+  if (production and params.handler_threads > 0
+      and 0 == params.event_threads) {
+    sl << prio::NOTICE << "Handler threads: "
+                       << params.handler_threads
+                       << std::endl;
+  }
+  if (production and params.max_connections > 0) {
+    static const char* const policies[] = { "queue", "reject", "close" };
+    sl << prio::NOTICE << "Maximum connections: "
+                       << params.max_connections
+                       << " (overflow: "
+                       << policies[static_cast<int>(params.overflow)]
+                       << ")"
+                       << std::endl;
+  }
+  if (production and params.peer_rate > 0) {
+    sl << prio::NOTICE << "Connections per client [1/s]: "
+                       << params.peer_rate
+                       << " (burst: " << params.peer_burst
+                       << ", clients tracked: " << params.peer_table_size
+                       << ")"
+                       << std::endl;
+  }
+  if (production and (params.shed_cps > 0 or params.shed_connections > 0
+                     or params.shed_queued > 0)) {
+    sl << prio::NOTICE << "Load shedding capacity: "
+                       << params.shed_cps << " connections/s, "
+                       << params.shed_connections << " connections, "
+                       << params.shed_queued << " queued"
+                       << std::endl;
+  }
+  if (production and not params.metrics_service.empty()) {
+    sl << prio::NOTICE << "Metrics: port "
+                       << params.metrics_service
+                       << ", path "
+                       << params.metrics_path
+                       << std::endl;
+  }
+  if (production and not params.handoff_service.empty()) {
+    sl << prio::NOTICE << "Handoff: "
+                       << params.handoff_service
+                       << ", drain timeout [s]: "
+                       << params.handoff_drain_timeout
+                       << std::endl;
+  }
+  if (production and params.listen_shards > 1) {
+    sl << prio::NOTICE << "Listener shards: "
+                       << params.listen_shards
+                       << (params.pin_listen_shards ? " (pinned)" : "")
+                       << std::endl;
+  }
+}
+
+// Pins the calling thread to the given CPU modulo the number of CPUs
+void pin_to_cpu(std::ostream& sl, long const cpu) {
+#if (BOOST_OS_LINUX)
+  const long n = std::max(1u, std::thread::hardware_concurrency());
+  ::cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(cpu % n, &set);
+  const int err = ::pthread_setaffinity_np(::pthread_self(), sizeof(set), &set);
+  if (err) {
+    nanonet::util::log::log_error(
+        sl, "Failed to pin thread to CPU " + std::to_string(cpu % n),
+        nanonet::detail_::get_strerror_message(err));
+  }
+#else
+  static_cast<void>(sl);
+  static_cast<void>(cpu);
+#endif
+}
+
+// @return The client's IP address without the port, as raw bytes.
+// Unix domain clients are generally unnamed and share an empty key.
+std::string_view address_key(connection::address_type const& a) {
+  if (AF_UNIX == a.family_detail_()) {
+    return std::string_view();
+  }
+  if (AF_INET6 == a.family_detail_()) {
+    return std::string_view(
+        reinterpret_cast<const char*>(&a.as_sockaddr_in6().sin6_addr),
+        sizeof(in6_addr));
+  }
+  return std::string_view(
+      reinterpret_cast<const char*>(&a.as_sockaddr_in().sin_addr),
+      sizeof(in_addr));
+}
+
+// Sends the busy message if requested, closes the connection on
+// return.  Doesn't wait, the message is cut off where it doesn't fit
+// into the socket's send buffer.  Counted and logged by the caller, see
+// reject_summary.
+void reject(
+    connection& c,
+    server_parameters const& params,
+    server_status const& status) {
+  if (overflow_policy::reject != params.overflow or not params.busy_message) {
+    return;
+  }
+
+  std::ostringstream os;
+  try {
+    (params.busy_message.value())(os, status);
+  } catch (std::exception const&) {
+    return;
+  }
+  // Best effort, the client may be gone already
+  const std::string_view message = os.view();
+  static_cast<void>(nanonet::detail_::socketsend_nonblocking(
+      c.fd(), message.data(), message.size()));
+}
+
+// Waits at most timeout [s] for an incoming connection on a or for
+// shutdown of running or accepting.
+// @return true iff a connection is ready to be accepted
+bool wait_for_connection(
+    acceptor& a, nanonet::util::running_flag const& running,
+    nanonet::util::running_flag const& accepting,
+    double const timeout) {
+  ::pollfd fds[3];
+  fds[0].fd = a.fd();
+  fds[0].events = POLLIN;
+  fds[0].revents = 0;
+  fds[1].fd = running.wait_fd();
+  fds[1].events = POLLIN;
+  fds[1].revents = 0;
+  fds[2].fd = accepting.wait_fd();
+  fds[2].events = POLLIN;
+  fds[2].revents = 0;
+
+  const int timeout_ms = timeout < 0
+    ? -1
+    : nanonet::math::round_to_integer<int>(timeout * 1e3);
+
+  int res = 0;
+  do { res = ::poll(fds, 3, timeout_ms); }
+  while (nanonet::detail_::EINTR_repeat(res));
+
+  if (res < 0) {
+    nanonet::detail_::strerror_exception("poll");
+  }
+  return running.running() and accepting.running()
+     and (fds[0].revents & POLLIN);
+}
+
+// Answers HTTP GET requests on a with write_metrics() until shutdown
+// or handoff.
+// Requests are handled one after the other, scrapes are infrequent.
+void serve_metrics(
+    acceptor& a,
+    server_parameters const& params,
+    nanonet::util::running_flag const& running,
+    nanonet::util::running_flag const& accepting,
+    std::ostream& sl) {
+  std::string line;
+  while (running.running() and accepting.running()) {
+    try {
+      if (not wait_for_connection(
+              a, running, accepting, params.accept_timeout)) {
+        continue;
+      }
+      connection c(a, 0);
+      c.timeout(METRICS_TIMEOUT);
+      instream is(c);
+      onstream os(c);
+
+      if (not nanonet::util::getline(is, line, params.max_line_length)) {
+        continue;
+      }
+      const auto req = nanonet::http::parse_get_request(line, is, &sl);
+      if (params.metrics_path == req.abs_path) {
+        nanonet::http::write_http_header_200(
+            os, "text/plain; version=0.0.4");
+        nanonet::util::write_metrics(os);
+      } else {
+        nanonet::http::write_http_header_404(os, req.abs_path);
+      }
+      os.flush();
+    } catch (const nanonet::util::timeout_exception&) {
+      // Client gone or too slow
+    } catch (std::exception const& e) {
+      nanonet::util::log::log_error(sl, "Failed to serve metrics", e.what());
+    }
   }
+}
 
-  // Outer try
-  } catch (std::exception const& e) {
-    sl << prio::CRIT 
-       << "WTF: Communication couldn't be set up in connection from "
-       << c->peer()
-       << ": " 
-       << e.what() << std::endl;
+// Listening sockets taken over from another server
+struct handoff_listeners {
+  std::vector<acceptor> acceptors;
+  std::optional<acceptor> metrics_acceptor;
+};
+
+// Closes a and removes its socket file, if any
+void close_unix_acceptor(std::optional<acceptor>& a) {
+  if (not a) {
+    return;
+  }
+  const std::string path = a->local().host();
+  a.reset();
+  if (not path.empty() and '@' != path[0]) {
+    ::unlink(path.c_str());
   }
 }
 
-struct server_thread {
-  server_thread           (server_thread&&) = default;
-  server_thread& operator=(server_thread&&) = default;
-  server_thread(
-      acceptor&& a_in,
-      input_handler_type const& handler_in,
-      std::optional<os_writer> const welcome_in,
-      const server_parameters& params_in,
-      std::reference_wrapper<nanonet::util::running_flag> running_in)
-  : a(std::move(a_in)),
-    handler(handler_in),
-    welcome(welcome_in),
-    params(params_in),
-    running(running_in)
-  {}
+// Asks the server at params.handoff_service for its listening sockets
+// and waits until it has released the handoff socket.
+// @return The listeners or nullopt if no server is running there
+std::optional<handoff_listeners> take_over(
+    server_parameters const& params, std::ostream& sl) {
+  std::unique_ptr<connection> c;
+  try {
+    c = std::make_unique<connection>(
+        "", params.handoff_service, HANDOFF_TIMEOUT);
+  } catch (std::exception const& e) {
+    sl << prio::NOTICE << "No server to take over from at "
+                       << params.handoff_service << ": " << e.what()
+                       << std::endl;
+    return std::nullopt;
+  }
+  c->timeout(HANDOFF_TIMEOUT);
 
-  void operator()();
+  std::vector<nanonet::detail_::auto_fd> fds;
+  const std::string message = receive_descriptors(*c, fds);
 
-private:
-  acceptor a;
-  input_handler_type handler;
-  std::optional<os_writer> welcome;
-  server_parameters params;
-  std::reference_wrapper<nanonet::util::running_flag> running;
-};
+  std::istringstream iss(message);
+  std::string greeting;
+  long n_listeners = 0;
+  long n_metrics = 0;
+  iss >> greeting >> n_listeners >> n_metrics;
+  if (not iss
+      or HANDOFF_GREETING != greeting
+      or n_listeners < 1
+      or n_metrics < 0 or n_metrics > 1
+      or static_cast<long>(fds.size()) != n_listeners + n_metrics) {
+    throw std::runtime_error(
+        "Invalid handoff from " + params.handoff_service + ": "
+      + std::to_string(fds.size()) + " descriptors, message: " + message);
+  }
 
-void log_params(
-    std::ostream& sl, 
-    server_parameters const& params, 
-    bool const production) {
+  handoff_listeners ret;
+  for (long i = 0; i < n_listeners; ++i) {
+    ret.acceptors.emplace_back(fds[i].release());
+  }
+  if (n_metrics) {
+    ret.metrics_acceptor.emplace(fds[n_listeners].release());
+  }
 
-  sl << prio::NOTICE << "Starting service: " << params.server_name << std::endl;
-  sl << prio::NOTICE << "Mode: " 
-     << (production ? "Production" : "Test") << std::endl;
-  sl << prio::NOTICE << "Maximum backlog: " << params.backlog << std::endl;
-  sl << prio::NOTICE << "Connection timeout [s]: " 
-                     << params.timeout << std::endl;
-  sl << prio::NOTICE << "Maximum line length: " 
-                     << params.max_line_length << std::endl;
-  sl << prio::NOTICE << "Running in background: "
-                     << params.background
+  // The other server stops accepting now, and closes the control
+  // connection once we can bind to the handoff socket
+  send_descriptors(*c, "OK\n", {});
+  char buf[64];
+  long n = 0;
+  do { n = ::recv(c->fd(), buf, sizeof(buf), 0); }
+  while (n > 0 or nanonet::detail_::EINTR_repeat(n));
+
+  sl << prio::NOTICE << "Took over " << n_listeners
+                     << " listener(s) from " << params.handoff_service
                      << std::endl;
+  return ret;
+}
+
+// Passes our listening sockets on to the server on the other end of c.
+// @return true iff it has taken them over and we should stop accepting
+bool hand_off(
+    connection& c,
+    std::vector<acceptor> const& acceptors,
+    std::optional<acceptor> const& metrics_acceptor) {
+  std::vector<nanonet::detail_::socketfd_t> fds;
+  for (auto const& a : acceptors) {
+    fds.push_back(a.fd());
+  }
+  if (metrics_acceptor) {
+    fds.push_back(metrics_acceptor->fd());
+  }
+
+  std::ostringstream oss;
+  oss << HANDOFF_GREETING << ' ' << acceptors.size()
+                          << ' ' << (metrics_acceptor ? 1 : 0) << '\n';
+  send_descriptors(c, oss.str(), fds);
+
+  std::vector<nanonet::detail_::auto_fd> none;
+  return "OK\n" == receive_descriptors(c, none);
 }
 
 void server_thread::operator()() {
@@ -233,30 +2527,168 @@ void server_thread::operator()() {
 
   log_params(sl, params, true);
 
-  sl << prio::NOTICE << "Listening for incoming connections on " 
-                     << a.local() 
-                     << std::endl;
+  for (auto const& a : acceptors) {
+    sl << prio::NOTICE << "Listening for incoming connections on " 
+                       << a.local() 
+                       << std::endl;
+  }
+
+  // Shut down after handing off our listeners, connections drain
+  nanonet::util::running_flag accepting;
+
+  // Metrics on their own thread so that scrapes don't wait for the
+  // accept loop and vice versa
+  std::thread metrics_thread;
+  if (metrics_acceptor) {
+    sl << prio::NOTICE << "Serving metrics on "
+                       << metrics_acceptor->local()
+                       << std::endl;
+    metrics_thread = std::thread([this, &accepting] {
+      syslogger msl{params.server_name + " metrics"};
+      serve_metrics(*metrics_acceptor, params, running, accepting, msl);
+    });
+  }
+
+  // Handoff requests on their own thread as well
+  std::thread handoff_thread;
+  if (handoff_acceptor) {
+    sl << prio::NOTICE << "Accepting handoff requests on "
+                       << handoff_acceptor->local()
+                       << std::endl;
+    handoff_thread = std::thread([this, &accepting] {
+      syslogger hsl{params.server_name + " handoff"};
+      while (running.get().running() and accepting.running()) {
+        try {
+          if (not wait_for_connection(
+                  *handoff_acceptor, running, accepting,
+                  params.accept_timeout)) {
+            continue;
+          }
+          connection c(*handoff_acceptor, 0);
+          c.timeout(HANDOFF_TIMEOUT);
+          if (hand_off(c, acceptors, metrics_acceptor)) {
+            hsl << prio::NOTICE << "Listeners handed off, "
+                                   "stopping to accept connections"
+                << std::endl;
+            accepting.shutdown();
+            // Before c is closed, see take_over()
+            close_unix_acceptor(handoff_acceptor);
+          }
+        } catch (std::exception const& e) {
+          nanonet::util::log::log_error(hsl, "Handoff failed", e.what());
+        }
+      }
+      close_unix_acceptor(handoff_acceptor);
+    });
+  }
 
-  // Status for this server
+  // Status for this server, shared by all shards
   nanonet::util::server_status status(params);
 
-  // Connection rate estimators
+  // Connection threads
+  ::connection_tracker tracker;
+
+  // Connection count and limit
+  ::admission_control admission(params, status);
+
+  // Connection rate estimators, shared by all shards
   ::connection_rates re(params);
+  std::mutex re_mutex;
 
-  // Loop: Handle incoming connections on acceptor a
-  // This loop terminates only when running becomes false.
-  // Any exceptions cause a retry after 1s.
-  while (running.get().running()) {
+  // Load shedding if requested
+  ::overload_controller overload(params, status);
+
+  // Log of shed, rate limited and rejected connections
+  ::reject_summary rejects(params, status);
+
+  // Connection rates per client address if limited
+  std::unique_ptr<nanonet::util::rate_limiter> peer_limiter;
+  if (params.peer_rate > 0) {
+    peer_limiter = std::make_unique<nanonet::util::rate_limiter>(
+        params.peer_rate, params.peer_burst, params.peer_table_size);
+  }
+
+  // Event loops if requested, otherwise one thread per connection
+  const bool use_io_ring =
+          params.event_threads > 0
+      and not handler.coroutine
+      and nanonet::util::io_ring::available();
+  std::unique_ptr<::event_engine> engine;
+  if (params.event_threads > 0) {
+    sl << prio::NOTICE << "Event loop I/O: "
+       << (use_io_ring ? "io_uring" : "epoll") << std::endl;
+    engine = std::make_unique<::event_engine>(
+        params, handler, welcome, running, status, use_io_ring);
+  }
+
+  // Handler thread pool if requested, otherwise one thread per connection
+  std::unique_ptr<nanonet::dispatch::thread_pool> pool;
+  if (not engine and params.handler_threads > 0) {
+    pool = std::make_unique<nanonet::dispatch::thread_pool>(
+        params.handler_threads);
+  }
+
+  const auto accepted = [&](std::unique_ptr<connection> c) {
+    const double now = nanonet::util::utc();
+    {
+      std::lock_guard<std::mutex> lock{re_mutex};
+      re.update(now);
+      re.update_status(status);
+    }
+
+    // Closed right away, no busy message while overloaded
+    if (overload.enabled() and overload.shed(status.cps_estimate_fast)) {
+      ++status.connections_shed;
+      rejects.update(now);
+      return;
+    }
+
+    // Before anything is allocated for the connection
+    if (peer_limiter
+        and not peer_limiter->allow(address_key(c->peer()), now)) {
+      ++status.connections_rate_limited;
+      rejects.update(now);
+      return;
+    }
+
+    auto ticket = admission.try_admit();
+    if (not ticket
+        and overflow_policy::queue == params.overflow) {
+      // Only with io_uring, which accepts on its own
+      while (running.get().running() and not ticket) {
+        admission.wait_for_room(ADMISSION_WAIT_TICK);
+        ticket = admission.try_admit();
+      }
+      if (not ticket) {
+        return;
+      }
+    }
+    if (not ticket) {
+      ++status.connections_rejected;
+      rejects.update(now);
+      reject(*c, params, status);
+      return;
+    }
+
+    ++status.connections_total;
+
+    if (engine) {
+      engine->add(std::move(c), std::move(*ticket));
+      return;
+    }
 
-  try {
-    std::unique_ptr<connection> c(new connection(a, params.accept_timeout));
     // Set connection timeout and pass it to the handler thread
     c->timeout(params.timeout);
-    
-    re.update(nanonet::util::utc());
-    re.update_status(status);
-    ++status.connections_total;
-    connection_thread ct(std::move(c), count_sentry(status.connections_current), params, handler, welcome, running, status);
+    c->buffer_size(params.buffer_size);
+    auto tracked = tracker.add(c->fd());
+    connection_thread ct(std::move(c), std::move(tracked), std::move(*ticket), params, handler, welcome, running, status);
+
+    if (pool) {
+      ct.queue();
+      pool->dispatch(nanonet::dispatch::task(std::move(ct)));
+      return;
+    }
+
     // sl << prio::NOTICE 
     //    << "Starting connection thread..."
     //    << std::endl;
@@ -267,12 +2699,94 @@ void server_thread::operator()() {
     //    << "Detaching connection thread..."
     //    << std::endl;
 
-    // We detach, *but* keep a count of them.  Connections should either time out
-    // or exit if running becomes false.
-    // FIXME(maybe): We should keep track of the threads here and properly
-    // join them.  However, the solution with count_sentry seems to be
-    // sound as well.
+    // We detach, *but* keep track of them.  Connections should either
+    // time out or exit if running becomes false, the tracker waits
+    // for them on shutdown.
     t.detach();
+  };
+
+  // Accept loop for one shard
+  const auto accept_loop = [&](acceptor& a, std::ostream& asl, const long shard) {
+  if (params.pin_listen_shards) {
+    pin_to_cpu(asl, shard);
+  }
+
+  // With io_uring, one multishot accept request delivers all incoming
+  // connections.
+  // A poll request on the running flag wakes it up on shutdown.
+  std::unique_ptr<nanonet::util::io_ring> ring;
+  bool accept_armed = false;
+  if (use_io_ring) {
+    ring = std::make_unique<nanonet::util::io_ring>(ACCEPT_RING_ENTRIES);
+    ring->poll_readable(running.get().wait_fd(), 1);
+    ring->poll_readable(accepting.wait_fd(), 1);
+  }
+
+  // Connections accepted per wakeup
+  std::vector<std::unique_ptr<connection>> batch;
+
+  // Loop: Handle incoming connections on acceptor a
+  // This loop terminates as soon as running or accepting becomes false.
+  // Any exceptions cause a retry after 1s.
+  while (running.get().running() and accepting.running()) {
+
+  try {
+    if (ring) {
+      if (not accept_armed) {
+        ring->accept_multishot(a.fd(), 0);
+        accept_armed = true;
+      }
+      ring->wait(params.accept_timeout,
+          [&](nanonet::util::io_ring::completion const& c) {
+        if (1 == c.user_data) {
+          return;
+        }
+        if (not c.more()) {
+          accept_armed = false;
+        }
+        if (c.res < 0) {
+          nanonet::detail_::strerror_exception("accept", -c.res);
+        }
+        accepted(std::make_unique<connection>(c.res));
+      });
+      continue;
+    }
+
+    // Leave new connections in the backlog while we're full
+    if (overflow_policy::queue == params.overflow
+        and not admission.has_room()) {
+      admission.wait_for_room(ADMISSION_WAIT_TICK);
+      continue;
+    }
+
+    // ... or shedding.  The estimate decays while we don't accept.
+    if (overload.enabled()) {
+      double cps_fast = 0;
+      {
+        std::lock_guard<std::mutex> lock{re_mutex};
+        cps_fast = re.fast(nanonet::util::utc());
+      }
+      if (load_state::shedding == overload.update(cps_fast)
+          and overflow_policy::queue == params.overflow) {
+        running.get().wait_for_shutdown(ADMISSION_WAIT_TICK);
+        continue;
+      }
+    }
+
+    if (wait_for_connection(a, running, accepting, params.accept_timeout)) {
+      // Drain the backlog, but only as far as we have room
+      long max = ACCEPT_BATCH_SIZE;
+      if (overflow_policy::queue == params.overflow
+          and params.max_connections > 0) {
+        max = std::clamp(
+            params.max_connections - status.connections_current, 1L, max);
+      }
+      batch.clear();
+      a.accept_batch(batch, max, engine and engine->nonblocking());
+      for (auto& c : batch) {
+        accepted(std::move(c));
+      }
+    }
   } catch (const nanonet::util::timeout_exception&) {
     // Just continue...
     // sl << prio::NOTICE
@@ -282,36 +2796,65 @@ void server_thread::operator()() {
     //    << std::endl;
   } catch (std::exception const& e) {
     nanonet::util::log::log_error(
-        sl, "Failed to handle incoming connection", e.what());
+        asl, "Failed to handle incoming connection", e.what());
     // Avoid busy loop in case of persistent errors
-    nanonet::util::sleep(1);
+    running.get().wait_for_shutdown(1);
+  }
+
+  } // while (running and accepting)
+  };
+
+  // Shards 1, 2, ... get their own thread, shard 0 runs here
+  std::vector<std::thread> shard_threads;
+  for (std::size_t i = 1; i < acceptors.size(); ++i) {
+    shard_threads.push_back(std::thread([&, i] {
+      syslogger ssl{params.server_name + " listen shard #" + std::to_string(i)};
+      accept_loop(acceptors[i], ssl, i);
+    }));
+  }
+  accept_loop(acceptors[0], sl, 0);
+  for (auto& t : shard_threads) {
+    t.join();
+  }
+  if (metrics_thread.joinable()) {
+    metrics_thread.join();
+  }
+  if (handoff_thread.joinable()) {
+    handoff_thread.join();
   }
 
-  } // while (running)
+  // Give the connections time to finish after a handoff
+  if (not accepting.running()) {
+    sl << prio::NOTICE 
+       << "Draining " << status.connections_current << " connection(s)..."
+       << std::endl;
+    const double deadline =
+        nanonet::util::utc() + params.handoff_drain_timeout;
+    while (    running.get().running()
+           and status.connections_current > 0
+           and nanonet::util::utc() < deadline) {
+      running.get().wait_for_shutdown(ADMISSION_WAIT_TICK);
+    }
+    running.get().shutdown();
+  }
 
   sl << prio::NOTICE 
      << "Service loop terminated and shutdown initiated..."
      << std::endl;
- 
-  for (long n = 0; ; ++n) {
-    const long count = status.connections_current;
-    if (0 == count) {
-      sl << prio::NOTICE 
-         << "Service shutdown complete"
-         << std::endl;
-      break;
-    }
 
-    if (0 == n % 10) {
-      sl << prio::NOTICE 
-         << "Waiting for "
-         << count 
-         << " connection(s) to exit: Time [s]: " << n
-         << std::endl;
-    }
+  tracker.wake_all();
 
-    nanonet::util::sleep(1);
-  }
+  // Joins the event loops once their connections are closed
+  engine.reset();
+
+  // Runs the queued connections, which exit immediately
+  pool.reset();
+
+  tracker.wait(sl);
+
+  sl << prio::NOTICE 
+     << "Service shutdown complete"
+     << std::endl;
 }
 
 } // end anonymous namespace
@@ -335,13 +2878,20 @@ void ::connection_rates::update_status(server_status& s) const {
   s.cps_estimate_fast   = re_fast  .estimate();
 }
 
-nanonet::util::server_manager nanonet::util::run_server(
-    input_handler_type const& handler,
+namespace {
+
+nanonet::util::server_manager run_server_impl(
+    connection_handler const& handler,
     nanonet::util::running_flag& running,
     std::optional<os_writer> const welcome,
     server_parameters const& params,
     std::ostream* sl) {
   if ("test:stdio" == params.service) {
+    if (handler.coroutine) {
+      throw std::runtime_error(
+          "Coroutine handlers are not supported in test mode: "
+        + params.server_name);
+    }
     if (not sl) {
       sl = &std::cout;
     }
@@ -373,6 +2923,9 @@ nanonet::util::server_manager nanonet::util::run_server(
     always_assert(sl);
     long listen_retries = 0;
 
+    // Kept across retries, the other server doesn't listen any more
+    std::optional<handoff_listeners> taken;
+
     while (true) {
       always_assert(sl);
       if (not running.running()) {
@@ -382,8 +2935,39 @@ nanonet::util::server_manager nanonet::util::run_server(
         break;
       }
       try {
-        acceptor acc(params.bind_address, params.service, params.backlog);
-        server_thread st(std::move(acc), handler, welcome, params, running);
+        std::optional<acceptor> handoff_acceptor;
+        if (not params.handoff_service.empty()) {
+          if (not taken) {
+            taken = take_over(params, *sl);
+          }
+          handoff_acceptor.emplace(params.handoff_service);
+        }
+
+        std::vector<acceptor> acceptors;
+        std::optional<acceptor> metrics_acceptor;
+        if (taken) {
+          acceptors = std::move(taken->acceptors);
+          metrics_acceptor = std::move(taken->metrics_acceptor);
+          taken.reset();
+        } else {
+          // With more than one shard, the kernel distributes incoming
+          // connections over the acceptors.
+          const long shards =
+              nanonet::util::network::is_unix_service(params.service)
+            ? 1 : std::max(1L, params.listen_shards);
+          for (long i = 0; i < shards; ++i) {
+            acceptors.emplace_back(
+                params.bind_address, params.service, params.backlog,
+                shards > 1);
+          }
+        }
+        if (not metrics_acceptor and not params.metrics_service.empty()) {
+          metrics_acceptor.emplace(
+              params.bind_address, params.metrics_service, params.backlog);
+        }
+        server_thread st(
+            std::move(acceptors), std::move(metrics_acceptor),
+            std::move(handoff_acceptor), handler, welcome, params, running);
 
         if (params.background) {
           *sl << prio::NOTICE 
@@ -425,6 +3009,42 @@ nanonet::util::server_manager nanonet::util::run_server(
   return nanonet::util::server_manager(params.server_name, sl);
 }
 
+} // end anonymous namespace
+
+nanonet::util::server_manager nanonet::util::run_server(
+    input_handler_type const& handler,
+    nanonet::util::running_flag& running,
+    std::optional<os_writer> const welcome,
+    server_parameters const& params,
+    std::ostream* sl) {
+  return run_server_impl(
+      connection_handler{handler, nullptr, nullptr},
+      running, welcome, params, sl);
+}
+
+nanonet::util::server_manager nanonet::util::run_server(
+    frame_handler_type const& handler,
+    nanonet::util::running_flag& running,
+    std::optional<os_writer> const welcome,
+    server_parameters const& params,
+    std::ostream* sl) {
+  return run_server_impl(
+      connection_handler{nullptr, handler, nullptr},
+      running, welcome, params, sl);
+}
+
+nanonet::util::server_manager nanonet::util::run_server(
+    coroutine_handler_type const& handler,
+    nanonet::util::running_flag& running,
+    server_parameters const& params,
+    std::ostream* sl) {
+  server_parameters p = params;
+  p.event_threads = std::max(1L, p.event_threads);
+  return run_server_impl(
+      connection_handler{nullptr, nullptr, handler},
+      running, std::nullopt, p, sl);
+}
+
 nanonet::util::server_manager::~server_manager() {
   if (thread_.joinable()) {
     if (logstream_) {
@@ -447,3 +3067,287 @@ nanonet::util::server_manager::~server_manager() {
     // from
   }
 }
+
+#if (BOOST_OS_LINUX)
+
+nanonet::util::running_flag::running_flag()
+: wake_fd_(::eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK)) {
+  if (not wake_fd_.valid()) {
+    nanonet::detail_::strerror_exception("eventfd");
+  }
+}
+
+#else
+
+nanonet::util::running_flag::running_flag() {
+  int fds[2];
+  if (::pipe(fds) < 0) {
+    nanonet::detail_::strerror_exception("pipe");
+  }
+  wake_fd_.reset(fds[0]);
+  wake_write_fd_.reset(fds[1]);
+}
+
+#endif
+
+void nanonet::util::running_flag::shutdown() {
+  {
+    std::lock_guard<std::mutex> lock{mutex_};
+    if (not running_) {
+      return;
+    }
+    running_ = false;
+  }
+  cv_.notify_all();
+
+  // The descriptor stays readable since nobody reads from it
+  const std::uint64_t one = 1;
+  const auto fd = wake_write_fd_.valid() ? wake_write_fd_.get()
+                                         : wake_fd_.get();
+  static_cast<void>(::write(fd, &one, sizeof(one)));
+}
+
+void nanonet::util::running_flag::wait_for_shutdown(
+    double const timeout) const {
+  std::unique_lock<std::mutex> lock{mutex_};
+  cv_.wait_for(lock, std::chrono::duration<double>(timeout),
+               [this] { return not running_; });
+}
+
+namespace {
+
+// Live server_status instances, see write_metrics()
+struct status_registry {
+  std::mutex mutex;
+  std::vector<server_status const*> statuses;
+};
+
+status_registry& registry() {
+  static status_registry ret;
+  return ret;
+}
+
+void register_status(server_status const* const s) {
+  std::lock_guard<std::mutex> lock{registry().mutex};
+  registry().statuses.push_back(s);
+}
+
+void unregister_status(server_status const* const s) {
+  std::lock_guard<std::mutex> lock{registry().mutex};
+  auto& v = registry().statuses;
+  v.erase(std::remove(v.begin(), v.end(), s), v.end());
+}
+
+// A gauge or counter of a server_status
+struct scalar_metric {
+  const char* name;
+  const char* type;
+  const char* help;
+  double (*value)(server_status const&);
+};
+
+const scalar_metric SCALAR_METRICS[] = {
+  { "nanonet_connections", "gauge",
+    "Current number of connections",
+    [](server_status const& s) -> double { return s.connections_current; } },
+  { "nanonet_connections_total", "counter",
+    "Total number of connections",
+    [](server_status const& s) -> double { return s.connections_total; } },
+  { "nanonet_connections_rejected_total", "counter",
+    "Connections rejected because max_connections was reached",
+    [](server_status const& s) -> double { return s.connections_rejected; } },
+  { "nanonet_connections_rate_limited_total", "counter",
+    "Connections closed because their client exceeded the rate limit",
+    [](server_status const& s) -> double { return s.connections_rate_limited; } },
+  { "nanonet_connections_shed_total", "counter",
+    "Connections shed because of overload",
+    [](server_status const& s) -> double { return s.connections_shed; } },
+  { "nanonet_load_state", "gauge",
+    "Load state: 0 normal, 1 degraded, 2 shedding",
+    [](server_status const& s) -> double {
+      return static_cast<int>(s.load.load()); } },
+  { "nanonet_connections_queued", "gauge",
+    "Connections waiting for a handler thread",
+    [](server_status const& s) -> double { return s.connections_queued; } },
+  { "nanonet_timeouts_idle_total", "counter",
+    "Connections timed out without input or output",
+    [](server_status const& s) -> double { return s.timeouts_idle; } },
+  { "nanonet_timeouts_read_total", "counter",
+    "Connections timed out receiving a line or frame",
+    [](server_status const& s) -> double { return s.timeouts_read; } },
+  { "nanonet_timeouts_write_total", "counter",
+    "Connections timed out sending output",
+    [](server_status const& s) -> double { return s.timeouts_write; } },
+  { "nanonet_connections_per_second_slow", "gauge",
+    "Connections per second, long averaging",
+    [](server_status const& s) -> double { return s.cps_estimate_slow; } },
+  { "nanonet_connections_per_second_medium", "gauge",
+    "Connections per second, medium averaging",
+    [](server_status const& s) -> double { return s.cps_estimate_medium; } },
+  { "nanonet_connections_per_second_fast", "gauge",
+    "Connections per second, fast averaging",
+    [](server_status const& s) -> double { return s.cps_estimate_fast; } },
+  { "nanonet_received_bytes_total", "counter",
+    "Bytes received",
+    [](server_status const& s) -> double { return s.bytes_received.value(); } },
+  { "nanonet_sent_bytes_total", "counter",
+    "Bytes sent",
+    [](server_status const& s) -> double { return s.bytes_sent.value(); } },
+  { "nanonet_received_lines_total", "counter",
+    "Input lines or frames passed to the handler",
+    [](server_status const& s) -> double { return s.lines_received.value(); } },
+};
+
+// A histogram of a server_status, exported as a summary
+struct histogram_metric {
+  const char* name;
+  const char* help;
+  nanonet::math::sharded_histogram server_status::* histogram;
+};
+
+const histogram_metric HISTOGRAM_METRICS[] = {
+  { "nanonet_handler_seconds",
+    "Time spent in the handler per input line or frame",
+    &server_status::handler_time },
+  { "nanonet_time_to_first_byte_seconds",
+    "Time from accepting a connection until the first byte is sent",
+    &server_status::time_to_first_byte },
+  { "nanonet_connection_lifetime_seconds",
+    "Lifetime of closed connections",
+    &server_status::connection_lifetime },
+};
+
+// Process wide buffer pool statistics
+struct pool_metric {
+  const char* name;
+  const char* type;
+  const char* help;
+  double (*value)(nanonet::util::buffer_pool_statistics const&);
+};
+
+const pool_metric POOL_METRICS[] = {
+  { "nanonet_buffer_pool_hits_total", "counter",
+    "Stream buffers taken from the buffer pool",
+    [](nanonet::util::buffer_pool_statistics const& s) -> double {
+      return s.hits; } },
+  { "nanonet_buffer_pool_misses_total", "counter",
+    "Stream buffers allocated from the system",
+    [](nanonet::util::buffer_pool_statistics const& s) -> double {
+      return s.misses; } },
+  { "nanonet_buffer_pool_held_bytes", "gauge",
+    "Free memory held in the buffer pool",
+    [](nanonet::util::buffer_pool_statistics const& s) -> double {
+      return s.bytes_held; } },
+};
+
+// Exported quantiles, label and value
+const std::pair<const char*, double> QUANTILES[] = {
+  { "0.5"  , 0.5   },
+  { "0.9"  , 0.9   },
+  { "0.99" , 0.99  },
+  { "0.999", 0.999 },
+};
+
+// Without going through a locale or allocating
+void write_number(std::ostream& os, double const x) {
+  char buf[32];
+  const auto res = std::to_chars(buf, buf + sizeof(buf), x);
+  os.write(buf, res.ptr - buf);
+}
+
+void write_family(
+    std::ostream& os, const char* const name,
+    const char* const type, const char* const help) {
+  os << "# HELP " << name << ' ' << help << '\n'
+     << "# TYPE " << name << ' ' << type << '\n';
+}
+
+// Writes {server="<name>"} or {server="<name>",quantile="<q>"},
+// escaping the name as required by the format
+void write_labels(
+    std::ostream& os, server_status const& s,
+    const char* const quantile = nullptr) {
+  os << "{server=\"";
+  for (const char c : s.name) {
+    switch (c) {
+      case '\\': os << "\\\\"; break;
+      case '"' : os << "\\\""; break;
+      case '\n': os << "\\n" ; break;
+      default  : os << c     ; break;
+    }
+  }
+  os << '"';
+  if (quantile) {
+    os << ",quantile=\"" << quantile << '"';
+  }
+  os << '}';
+}
+
+} // end anonymous namespace
+
+nanonet::util::server_status::server_status() {
+  register_status(this);
+}
+
+nanonet::util::server_status::server_status(const server_parameters& params)
+: name(params.server_name) {
+  register_status(this);
+}
+
+nanonet::util::server_status::~server_status() {
+  unregister_status(this);
+}
+
+void nanonet::util::write_metrics(std::ostream& os) {
+  // Format under the lock, write after releasing it: os may block
+  std::ostringstream out;
+  {
+    std::lock_guard<std::mutex> lock{registry().mutex};
+    auto const& statuses = registry().statuses;
+
+    for (auto const& m : SCALAR_METRICS) {
+      write_family(out, m.name, m.type, m.help);
+      for (auto const* const s : statuses) {
+        out << m.name;
+        write_labels(out, *s);
+        out << ' ';
+        write_number(out, m.value(*s));
+        out << '\n';
+      }
+    }
+
+    for (auto const& m : HISTOGRAM_METRICS) {
+      write_family(out, m.name, "summary", m.help);
+      for (auto const* const s : statuses) {
+        const nanonet::math::histogram h = (s->*m.histogram).snapshot();
+        for (auto const& q : QUANTILES) {
+          out << m.name;
+          write_labels(out, *s, q.first);
+          out << ' ';
+          write_number(out, h.quantile(q.second));
+          out << '\n';
+        }
+        out << m.name << "_sum";
+        write_labels(out, *s);
+        out << ' ';
+        write_number(out, h.sum());
+        out << '\n';
+        out << m.name << "_count";
+        write_labels(out, *s);
+        out << ' ';
+        write_number(out, h.count());
+        out << '\n';
+      }
+    }
+  }
+
+  const auto pool = nanonet::util::buffer_pool_stats();
+  for (auto const& m : POOL_METRICS) {
+    write_family(out, m.name, m.type, m.help);
+    out << m.name << ' ';
+    write_number(out, m.value(pool));
+    out << '\n';
+  }
+
+  os << out.view();
+}
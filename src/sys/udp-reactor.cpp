@@ -0,0 +1,87 @@
+//
+// Copyright 2015 KISS Technologies GmbH, Switzerland
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "nanonet/sys/udp-reactor.h"
+
+#include "nanonet/assert.h"
+
+#include "nanonet/detail/socket_lowlevel.h"
+
+#include <stdexcept>
+#include <utility>
+
+
+nanonet::util::network::udp_reactor::udp_reactor(
+    const long batch_size, const long max_size)
+: buffer_(batch_size * max_size),
+  messages_(batch_size) {
+  always_assert(batch_size >= 1);
+  always_assert(max_size >= 1);
+  for (long i = 0; i < batch_size; ++i) {
+    messages_[i].buffer = std::span<char>(&buffer_[i * max_size], max_size);
+  }
+}
+
+nanonet::util::network::datagram_socket&
+nanonet::util::network::udp_reactor::add(datagram_socket s, callback cb) {
+  always_assert(cb);
+  nanonet::detail_::bool_fcntl_option(
+      s.fd(), O_NONBLOCK, "udp_reactor: enabling nonblocking mode", true);
+
+  const auto fd = s.fd();
+  if (feeds_.count(fd)) {
+    throw std::logic_error(
+        "udp_reactor: socket already registered: " + std::to_string(fd));
+  }
+  auto f = std::make_unique<feed>(feed{std::move(s), std::move(cb)});
+  feed& ret = *f;
+  loop_.add(fd, event_loop::readable, [this, &ret](unsigned) {
+    dispatch(ret);
+  });
+  feeds_.emplace(fd, std::move(f));
+  return ret.socket;
+}
+
+void nanonet::util::network::udp_reactor::remove(datagram_socket const& s) {
+  const auto it = feeds_.find(s.fd());
+  if (feeds_.end() == it || &it->second->socket != &s) {
+    return;
+  }
+  loop_.remove(it->first);
+  if (it->second.get() == current_) {
+    removed_ = std::move(it->second);
+  }
+  feeds_.erase(it);
+}
+
+void nanonet::util::network::udp_reactor::dispatch(feed& f) {
+  // Level triggered, the loop calls again if more is queued
+  const long n = f.socket.receive_batch(messages_);
+  if (0 == n) {
+    return;
+  }
+
+  current_ = &f;
+  try {
+    f.cb(f.socket, std::span<datagram_message const>(messages_.data(), n));
+  } catch (...) {
+    current_ = nullptr;
+    removed_.reset();
+    throw;
+  }
+  current_ = nullptr;
+  removed_.reset();
+}
@@ -0,0 +1,483 @@
+//
+// Copyright 2015 KISS Technologies GmbH, Switzerland
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+//
+// Benchmarks, not part of the regression tests.  Note that some of them
+// need a large number of file descriptors (ulimit -n).
+//
+
+#include "nanonet/util.h"
+#include "nanonet/sys/network.h"
+#include "nanonet/sys/server.h"
+#include "nanonet/sys/syslogger.h"
+#include "nanonet/sys/util.h"
+
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <fstream>
+#include <iostream>
+#include <cstring>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+using namespace nanonet::util::network ;
+
+namespace {
+
+std::string const BENCH_HOST = "127.0.0.1" ;
+// Outside of the ephemeral port range, clients use lots of those
+std::string const BENCH_PORT = "23210"     ;
+
+void usage( std::string const& name ) {
+
+  std::cerr <<
+"usage: " << name << " <command>\n"
+"Available commands:\n"
+"echo mode [ idle [ active [ seconds ] ] ]:\n"
+"                     Run a line echo server with mode threads (one\n"
+"                     thread per connection), events (event loop\n"
+"                     threads) or coroutines (coroutines on event loop\n"
+"                     threads).  Open idle connections, then send lines\n"
+"                     over active connections for the given time and\n"
+"                     report round trips per second.\n"
+"                     Default: 1000 idle, 100 active, 5 seconds.\n"
+"connect mode [ clients [ seconds ] ]:\n"
+"                     Connect storm: Clients connect and immediately\n"
+"                     close again for the given time.  Reports accepted\n"
+"                     connections per second.  Modes as for echo.\n"
+"                     Default: 10 clients, 5 seconds.\n"
+"getline [ lines [ length ] ]:\n"
+"                     Read lines of the given length from a string stream\n"
+"                     with nanonet::util::getline(), character-wise as\n"
+"                     before and with std::getline().  Compares find_char()\n"
+"                     with std::memchr().\n"
+"                     Default: 1000000 lines, 80 characters.\n"
+"udp [ seconds [ batch [ size ] ] ]:\n"
+"                     Send datagrams over loopback for the given time,\n"
+"                     one per call with send()/receive(), then batch per\n"
+"                     call with send_batch()/receive_batch(), then with\n"
+"                     segmentation offload (send_segmented() and\n"
+"                     receive_segments()).  Reports datagrams per second.\n"
+"                     Default: 3 seconds, batches of 32, 64 bytes.\n"
+  ;
+
+}
+
+// @return Number of threads of this process
+long thread_count() {
+  std::ifstream status( "/proc/self/status" ) ;
+  std::string line ;
+  while( std::getline( status , line ) ) {
+    if( 0 == line.rfind( "Threads:" , 0 ) ) {
+      return std::stol( line.substr( 8 ) ) ;
+    }
+  }
+  return -1 ;
+}
+
+bool echo_handler(
+    std::string const& line ,
+    std::istream& ,
+    std::ostream& os ,
+    std::ostream& ,
+    nanonet::util::server_status const& ) {
+  // Flush, in thread mode the server doesn't flush after the handler
+  os << line << std::endl ;
+  return true ;
+}
+
+nanonet::util::co_task<> echo_coroutine( nanonet::util::co_connection& c ) {
+  while( auto const line = co_await c.read_line() ) {
+    if( !co_await c.write( *line ) || !co_await c.write( "\n" ) ) {
+      break ;
+    }
+  }
+}
+
+// Sends lines and waits for the echo until stop is set
+void echo_client( std::atomic<bool> const& stop , std::atomic<long>& count ) {
+  connection c( BENCH_HOST , BENCH_PORT ) ;
+  c.no_delay() ;
+  onstream os( c ) ;
+  instream is( c ) ;
+
+  std::string line ;
+  long n = 0 ;
+  while( !stop ) {
+    os << "The quick brown fox jumps over the lazy dog" << std::endl ;
+    if( !nanonet::util::getline( is , line , 1000 ) ) {
+      throw std::runtime_error( "echo: unexpected end of input" ) ;
+    }
+    ++n ;
+  }
+  count += n ;
+}
+
+// A server on BENCH_PORT in the background, shut down on destruction
+struct bench_server {
+  bench_server(
+      std::string const& mode ,
+      nanonet::util::input_handler_type const& handler ) {
+    nanonet::util::server_parameters p ;
+    p.service = BENCH_PORT ;
+    p.server_name = "BENCH" ;
+    p.n_listen_retries = 10 ;
+    p.backlog = 1000 ;
+    p.log_connections = false ;
+    p.timeout = 3600 ;
+    p.background = true ;
+    if( "events" == mode || "coroutines" == mode ) {
+      p.event_threads = std::max( 1u , std::thread::hardware_concurrency() ) ;
+    } else if( "threads" != mode ) {
+      throw std::runtime_error( "mode must be threads, events or coroutines" ) ;
+    }
+
+    if( "coroutines" == mode ) {
+      // Echoes, whatever handler is
+      manager = nanonet::util::run_server(
+          nanonet::util::coroutine_handler_type{ echo_coroutine } ,
+          running , p , &sl ) ;
+    } else {
+      manager = nanonet::util::run_server(
+          handler , running , std::nullopt , p , &sl ) ;
+    }
+
+    // Give the server time to listen
+    nanonet::util::sleep( 0.5 ) ;
+  }
+
+  ~bench_server() {
+    running.shutdown() ;
+  }
+
+private:
+  // The manager logs on destruction, so sl must outlive it
+  nanonet::util::log::syslogger sl{ "BENCH" } ;
+  nanonet::util::running_flag running ;
+  nanonet::util::server_manager manager ;
+} ;
+
+void echo(
+    std::string const& mode ,
+    long const idle ,
+    long const active ,
+    double const seconds ) {
+
+  bench_server const server( mode , echo_handler ) ;
+
+  std::vector< std::unique_ptr< connection > > idle_connections ;
+  for( long i = 0 ; i < idle ; ++i ) {
+    idle_connections.push_back(
+        std::make_unique< connection >( BENCH_HOST , BENCH_PORT ) ) ;
+  }
+
+  std::atomic<bool> stop{ false } ;
+  std::atomic<long> count{ 0 } ;
+  std::vector< std::thread > clients ;
+
+  double const start = nanonet::util::time() ;
+  for( long i = 0 ; i < active ; ++i ) {
+    clients.emplace_back( [ &stop , &count ] { echo_client( stop , count ) ; } ) ;
+  }
+
+  nanonet::util::sleep( seconds ) ;
+  long const threads = thread_count() ;
+  stop = true ;
+
+  for( auto& t : clients ) { t.join() ; }
+  double const elapsed = nanonet::util::time() - start ;
+
+  std::cout << "Mode:                " << mode << '\n'
+            << "Idle connections:    " << idle << '\n'
+            << "Active connections:  " << active << '\n'
+            << "Round trips:         " << count << '\n'
+            << "Round trips/s:       " << count / elapsed << '\n'
+            << "Process threads:     " << threads
+            << " (including " << active << " client threads)"
+            << std::endl ;
+}
+
+// Connects and closes until stop is set
+void connect_client( std::atomic<bool> const& stop , std::atomic<long>& count ) {
+  long n = 0 ;
+  while( !stop ) {
+    connection c( BENCH_HOST , BENCH_PORT ) ;
+    ++n ;
+  }
+  count += n ;
+}
+
+void connect_storm(
+    std::string const& mode ,
+    long const n_clients ,
+    double const seconds ) {
+
+  bench_server const server( mode , echo_handler ) ;
+
+  std::atomic<bool> stop{ false } ;
+  std::atomic<long> count{ 0 } ;
+  std::vector< std::thread > clients ;
+
+  double const start = nanonet::util::time() ;
+  for( long i = 0 ; i < n_clients ; ++i ) {
+    clients.emplace_back( [ &stop , &count ] { connect_client( stop , count ) ; } ) ;
+  }
+
+  nanonet::util::sleep( seconds ) ;
+  stop = true ;
+
+  for( auto& t : clients ) { t.join() ; }
+  double const elapsed = nanonet::util::time() - start ;
+
+  std::cout << "Mode:                " << mode << '\n'
+            << "Clients:             " << n_clients << '\n'
+            << "Connections:         " << count << '\n'
+            << "Connections/s:       " << count / elapsed
+            << std::endl ;
+}
+
+// nanonet::util::getline() before find_char():  Character-wise through
+// the stream buffer
+bool getline_charwise( std::istream& is , std::string& s , long const maxsize ) {
+  std::istream::sentry sen( is , true ) ;
+  if( !sen ) { return false ; }
+  s.clear() ;
+  std::istreambuf_iterator< char > it( is ) ;
+  std::istreambuf_iterator< char > const eos ;
+  while( static_cast< long >( s.size() ) < maxsize ) {
+    if( eos == it ) {
+      is.setstate( std::ios_base::failbit | std::ios_base::eofbit ) ;
+      return false ;
+    }
+    char const c = *it ;
+    ++it ;
+    if( '\n' == c ) { return true ; }
+    s.push_back( c ) ;
+  }
+  return true ;
+}
+
+template< typename F >
+void bench_getline( 
+    char const* const name , std::string const& input , F const& f ) {
+  std::istringstream is( input ) ;
+  std::string line ;
+  long n = 0 ;
+  double const start = nanonet::util::time() ;
+  while( f( is , line ) ) { ++n ; }
+  double const elapsed = nanonet::util::time() - start ;
+
+  std::cout << name << ": " << n / elapsed << " lines/s, "
+            << input.size() / elapsed / 1e6 << " MB/s" << std::endl ;
+}
+
+template< typename F >
+void bench_find( 
+    char const* const name , std::string const& input , F const& f ) {
+  // Search for a character that isn't there
+  long const repetitions = 20 ;
+  long found = 0 ;
+  double const start = nanonet::util::time() ;
+  // Varying offsets so that the calls can't be optimized away
+  for( long i = 0 ; i < repetitions ; ++i ) {
+    found += nullptr != f( input.data() + i , '\n' , input.size() - i ) ;
+  }
+  double const elapsed = nanonet::util::time() - start ;
+
+  always_assert( 0 == found ) ;
+  std::cout << name << ": " 
+            << repetitions * input.size() / elapsed / 1e9 << " GB/s" 
+            << std::endl ;
+}
+
+void getline_bench( long const lines , long const length ) {
+  std::string input ;
+  input.reserve( lines * ( length + 1 ) ) ;
+  for( long i = 0 ; i < lines ; ++i ) {
+    for( long j = 0 ; j < length ; ++j ) {
+      input.push_back( 'a' + ( i + j ) % 26 ) ;
+    }
+    input.push_back( '\n' ) ;
+  }
+
+  long const maxsize = length + 1 ;
+  std::cout << "Lines:               " << lines << '\n'
+            << "Line length:         " << length << std::endl ;
+
+  bench_getline( "getline character-wise" , input ,
+      [ maxsize ]( std::istream& is , std::string& s ) 
+      { return getline_charwise( is , s , maxsize ) ; } ) ;
+  bench_getline( "nanonet::util::getline" , input ,
+      [ maxsize ]( std::istream& is , std::string& s ) 
+      { return !!nanonet::util::getline( is , s , maxsize ) ; } ) ;
+  bench_getline( "std::getline         " , input ,
+      []( std::istream& is , std::string& s ) 
+      { return !!std::getline( is , s ) ; } ) ;
+
+  std::string const no_newline( input.size() , 'x' ) ;
+  bench_find( "find_char  " , no_newline , nanonet::util::find_char ) ;
+  bench_find( "std::memchr" , no_newline ,
+      []( char const* const p , char const c , long const n ) {
+        return static_cast< char const* >( std::memchr( p , c , n ) ) ;
+      } ) ;
+}
+
+// Sends datagrams of size bytes over loopback for the given time,
+// batch per call (0: Use send() and receive())
+// batch: 0 for send()/receive(), otherwise messages per batch
+// segmented: Use segmentation offload for batches
+void udp_run( long const batch , long const size , double const seconds ,
+              bool const segmented = false ) {
+  datagram_socket receiver( BENCH_HOST , BENCH_PORT ) ;
+  auto sender = datagram_socket::connected( receiver.local() ) ;
+  if( segmented ) { receiver.receive_offload() ; }
+
+  std::atomic<bool> stop{ false } ;
+  long sent = 0 ;
+  std::thread sending( [ & ] {
+    std::vector< char > payload( size , 'x' ) ;
+    std::vector< char > const records( batch * size , 'x' ) ;
+    std::vector< datagram_message > messages( std::max( batch , 1L ) ) ;
+    for( auto& m : messages ) {
+      m.buffer = payload ;
+      m.size   = size ;
+    }
+    while( !stop ) {
+      if( segmented ) {
+        sender.send_segmented( records , size ) ;
+        sent += batch ;
+      } else if( batch > 0 ) {
+        sent += sender.send_batch( messages , false ) ;
+      } else {
+        sender.send( payload.begin() , payload.end() ) ;
+        ++sent ;
+      }
+    }
+  } ) ;
+
+  std::vector< char > buffers( std::max( batch , 1L ) * size ) ;
+  std::vector< datagram_message > messages( std::max( batch , 1L ) ) ;
+  for( long i = 0 ; i < static_cast< long >( messages.size() ) ; ++i ) {
+    messages[ i ].buffer = std::span< char >( &buffers[ i * size ] , size ) ;
+  }
+
+  std::vector< char > coalesced( 65536 ) ;
+  datagram_segments segments ;
+
+  long received = 0 ;
+  double const start = nanonet::util::time() ;
+  double elapsed = 0 ;
+  while( true ) {
+    elapsed = nanonet::util::time() - start ;
+    if( elapsed >= seconds ) { stop = true ; }
+    if( segmented ) {
+      if( receiver.receive_segments( coalesced , segments , 0.1 ) ) {
+        received += segments.count() ;
+      } else if( stop ) {
+        break ;
+      }
+    } else if( batch > 0 ) {
+      long const n = receiver.receive_batch( messages , 0.1 ) ;
+      if( 0 == n && stop ) { break ; }
+      received += n ;
+    } else {
+      if( datagram_socket::timeout() == receiver.receive( buffers.begin() , 0.1 ) ) {
+        if( stop ) { break ; }
+      } else {
+        ++received ;
+      }
+    }
+  }
+  sending.join() ;
+
+  std::cout << "Mode:                " 
+            << ( segmented ? "segmented " + std::to_string( batch )
+               : batch > 0 ? "batch " + std::to_string( batch ) : "single" ) << '\n'
+            << "Sent/s:              " << sent / seconds << '\n'
+            << "Received/s:          " << received / seconds << '\n'
+            << "Lost:                " << sent - received
+            << std::endl ;
+}
+
+} // end anonymous namespace
+
+
+int main( int argc , char const* const* const argv ) {
+
+  try {
+
+  if( argc <= 1 ) {
+
+    usage( argv[ 0 ] ) ;
+    return 1 ;
+
+  }
+
+  std::string const command = argv[ 1 ] ;
+
+  if( "echo" == command ) {
+
+    if( argc < 3 || argc > 6 ) { usage( argv[ 0 ] ) ; return 1 ; }
+
+    echo( argv[ 2 ] ,
+          argc > 3 ? std::stol( argv[ 3 ] ) : 1000 ,
+          argc > 4 ? std::stol( argv[ 4 ] ) : 100 ,
+          argc > 5 ? std::stod( argv[ 5 ] ) : 5 ) ;
+
+  } else if( "connect" == command ) {
+
+    if( argc < 3 || argc > 5 ) { usage( argv[ 0 ] ) ; return 1 ; }
+
+    connect_storm( argv[ 2 ] ,
+                   argc > 3 ? std::stol( argv[ 3 ] ) : 10 ,
+                   argc > 4 ? std::stod( argv[ 4 ] ) : 5 ) ;
+
+  } else if( "udp" == command ) {
+
+    if( argc > 5 ) { usage( argv[ 0 ] ) ; return 1 ; }
+
+    double const seconds = argc > 2 ? std::stod( argv[ 2 ] ) : 3 ;
+    long   const batch   = argc > 3 ? std::stol( argv[ 3 ] ) : 32 ;
+    long   const size    = argc > 4 ? std::stol( argv[ 4 ] ) : 64 ;
+    udp_run( 0     , size , seconds ) ;
+    udp_run( batch , size , seconds ) ;
+    udp_run( batch , size , seconds , true ) ;
+
+  } else if( "getline" == command ) {
+
+    if( argc > 4 ) { usage( argv[ 0 ] ) ; return 1 ; }
+
+    getline_bench( argc > 2 ? std::stol( argv[ 2 ] ) : 1000000 ,
+                   argc > 3 ? std::stol( argv[ 3 ] ) : 80 ) ;
+
+  } else {
+
+    usage( argv[ 0 ] ) ;
+    return 1 ;
+
+  }
+
+  } catch( std::exception const& e ) {
+    std::cerr << e.what() << std::endl ;
+    return 1 ;
+  }
+
+}
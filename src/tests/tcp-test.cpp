@@ -18,6 +18,7 @@
 #include "nanonet/http.h"
 #include "nanonet/registry.h"
 #include "nanonet/util.h"
+#include "nanonet/xdr.h"
 #include "nanonet/sys/network.h"
 #include "nanonet/sys/server.h"
 #include "nanonet/sys/syslogger.h"
@@ -28,11 +29,14 @@
 #include <string>
 #include <sstream>
 #include <exception>
+#include <iomanip>
 #include <stdexcept>
 #include <algorithm>
 #include <optional>
 #include <memory>
 #include <random>
+#include <span>
+#include <string_view>
 #include <thread>
 
 #include <cassert>
@@ -46,6 +50,11 @@ std::string const DAYTIME_PORT   = "daytime"       ;
 // Default send/receive timeout
 double const DEFAULT_TIMEOUT = 20;
 
+// Service, client and server idle timeout [s] of the cycles command
+std::string const CYCLES_SERVICE = "unix:@nanonet-tcp-test-cycles" ;
+double const CYCLES_TIMEOUT = 5 ;
+double const CYCLES_IDLE_TIMEOUT = 1 ;
+
 using namespace nanonet::util::network ;
 using namespace nanonet::util::log ;
 
@@ -59,6 +68,32 @@ void usage( std::string const& name ) {
 "cat      port:       Wait for connection and copy TCP stream to stdout.\n"
 "reverse  port:       Start a reverse server, one thread per connection.\n"
 "reverse_bg port:     Start a reverse server in background.\n"
+"reverse_ev port [ timeout [ read_timeout [ write_timeout ] ] ]:\n"
+"                     Start a reverse server, two event loop threads.\n"
+"                     Optional: Idle, read and write timeouts [s]\n"
+"reverse_sh port:     Start a reverse server with four pinned listener shards.\n"
+"reverse_pool port:   Start a reverse server, two handler threads, at most\n"
+"                     four connections, rejects further ones.\n"
+"reverse_co port [ timeout [ read_timeout [ write_timeout ] ] ]:\n"
+"                     Start a reverse server using coroutines on two\n"
+"                     event loop threads.  Timeouts as for reverse_ev.\n"
+"reverse_frames port [ event_threads ]:  Start a binary reverse server:\n"
+"                     Answers each length-prefixed frame (XDR opaque)\n"
+"                     with the reversed payload.\n"
+"reverse_handoff port control [ drain_timeout ]:  Start a reverse server,\n"
+"                     two event loop threads, taking over the listener\n"
+"                     from one already running with the same control\n"
+"                     socket (e.g. unix:/tmp/reverse-handoff.sock).  The\n"
+"                     old one drains its connections and exits.\n"
+"cycles   [ connections ]:  Start a reverse server with two event loop\n"
+"                     threads in background, then connect, send a line\n"
+"                     and close, one connection after the other.  Then\n"
+"                     two connections closed by the server's idle timeout\n"
+"                     and two more normal ones.  Fails unless all of them\n"
+"                     are served.  Default: 10 connections.\n"
+"reverse_metrics port metrics_port:  Start a reverse server, two handler\n"
+"                     threads, serving Prometheus metrics on\n"
+"                     http://localhost:metrics_port/metrics\n"
 "httpd    port:       Start an HTTP server on given port.\n"
 "                     Serves .txt and .html files from current directory.\n"
 "hello    port:       Start a hello world server, immediately closes connection.\n"
@@ -71,6 +106,10 @@ void usage( std::string const& name ) {
 "                     Optional: Connect timeout [s]\n"
 "wget     URL:        Request URL using HTTP/1.0 and dump the content\n"
 "                     (including HTTP headers!) to stdout.\n"
+"\n"
+"Ports may be Unix domain sockets unix:<path> or unix:@<name> (abstract\n"
+"namespace), e.g. reverse_ev unix:/tmp/reverse.sock and, in another\n"
+"window, telnet - unix:/tmp/reverse.sock\n"
 // "tiles    config:     Download map tiles as per config.\n"
   ;
 
@@ -89,6 +128,7 @@ void reverse_service_welcome(
         "501 Type ``close'' to end the session.\n"
         "501 Type ``shutdown'' or ``sd'' to kill the server.\n"
         "501 Type ``status'' for server status.\n"
+        "501 Type ``latency'' for handler latencies.\n"
       << std::endl ;
 }
 
@@ -114,10 +154,19 @@ bool reverse_service_handle_line(
           << "101 server name: " << status.name << '\n'
           << "101 current number of connections: " << status.connections_current << '\n'
           << "101 total number of connections: " << status.connections_total << '\n'
+          << "101 rejected connections: " << status.connections_rejected << '\n'
+          << "101 lines received: " << status.lines_received.value() << '\n'
           << "101 connections per second (slow estimate)  : " << status.cps_estimate_slow   << '\n'
           << "101 connections per second (medium estimate): " << status.cps_estimate_medium << '\n'
           << "101 connections per second (fast estimate)  : " << status.cps_estimate_fast
           << std::endl;
+    } else if( "latency" == ss ) {
+      const auto h = status.handler_time.snapshot();
+      ons << "102 handler calls: " << h.count() << '\n'
+          << "102 handler time p50 [us]: " << 1e6 * h.quantile(0.5) << '\n'
+          << "102 handler time p99 [us]: " << 1e6 * h.quantile(0.99) << '\n'
+          << "102 handler time p999 [us]: " << 1e6 * h.quantile(0.999)
+          << std::endl;
     } else if( "shutdown" == ss or "sd" == ss ) {
       ons << "201 shutdown requested\n"
           << "201 please close this connection, then the server will exit"
@@ -288,8 +337,72 @@ void run_hello_server( std::string const& port ) {
 
 }
 
-void run_reverse_server( std::ostream& sl, std::string const& port , const bool background ) {
+// Binary variant of the reverse service: Answers each frame with the
+// reversed frame.  An empty frame closes the connection, "sd" shuts
+// down the server.
+bool reverse_service_handle_frame(
+    std::span<const char> const frame,
+    std::istream& ,
+    std::ostream& ons,
+    std::ostream& ,
+    const nanonet::util::server_status& ) {
+  if (frame.empty()) {
+    return false;
+  }
+  if (std::string_view(frame.data(), frame.size()) == "sd") {
+    throw nanonet::util::shutdown_exception("Server shutdown requested: sd");
+  }
+
+  std::string reversed(frame.rbegin(), frame.rend());
+  nanonet::xdr::write_frame(ons, reversed);
+  ons.flush();
+  return true;
+}
+
+// Coroutine variant of the reverse service, same commands
+nanonet::util::co_task<> reverse_service_coroutine(
+    nanonet::util::co_connection& c ) {
+  std::ostringstream welcome ;
+  reverse_service_welcome( welcome , c.status() ) ;
+  if( not co_await c.write( welcome.str() ) ) {
+    co_return ;
+  }
+
+  std::string reply ;
+  while( auto const line = co_await c.read_line() ) {
+    std::istringstream iss{ std::string( *line ) } ;
+    std::ostringstream oss ;
+    std::string ss ;
+    bool close = false ;
+    while( iss >> ss ) {
+      if( "close" == ss ) {
+        oss << "550 Goodbye!" << std::endl ;
+        close = true ;
+        break ;
+      } else if( "shutdown" == ss or "sd" == ss ) {
+        co_await c.write( "201 shutdown requested\n" ) ;
+        throw nanonet::util::shutdown_exception(
+            "Server shutdown requested: " + ss ) ;
+      }
+      reverse( ss.begin() , ss.end() ) ;
+      oss << ss << std::endl ;
+    }
+
+    reply = oss.str() ;
+    if( not co_await c.write( reply ) or close ) {
+      co_return ;
+    }
+  }
+}
 
+void reverse_service_busy(
+    std::ostream& os, nanonet::util::server_status const& status) {
+  os << "503 Server busy, " << status.connections_current
+     << " connection(s), please try again later" << std::endl;
+}
+
+nanonet::util::server_parameters reverse_server_parameters(
+    std::string const& port , const bool background ) {
   nanonet::util::server_parameters p;
   p.service = port;
   p.n_listen_retries = 10;
@@ -297,10 +410,24 @@ void run_reverse_server( std::ostream& sl, std::string const& port , const bool
   p.server_name = "REVERSE-SERVER-0.92";
   p.log_connections = true;
   p.background = background;
+  return p;
+}
+
+// Sets the timeouts given as optional arguments, starting at argv[ i ]
+void set_timeouts(
+    nanonet::util::server_parameters& p ,
+    int const argc , char const* const* const argv , int const i ) {
+  if( argc > i     ) { p.timeout       = std::stod( argv[ i     ] ) ; }
+  if( argc > i + 1 ) { p.read_timeout  = std::stod( argv[ i + 1 ] ) ; }
+  if( argc > i + 2 ) { p.write_timeout = std::stod( argv[ i + 2 ] ) ; }
+}
+
+void run_reverse_server(
+    std::ostream& sl, nanonet::util::server_parameters const& p ) {
 
   nanonet::util::running_flag running;
 
-  std::cout << "Starting reverse server; background = " << background
+  std::cout << "Starting reverse server; background = " << p.background
             << std::endl;
 
   const auto manager = nanonet::util::run_server(
@@ -311,7 +438,7 @@ void run_reverse_server( std::ostream& sl, std::string const& port , const bool
 
   // If server runs in foreground, return from run_server() means
   // that shutdown is complete.
-  if (not background) {
+  if (not p.background) {
     std::cout << "Server shutdown completed; exiting"
               << std::endl;
     return;
@@ -336,6 +463,91 @@ void run_reverse_server( std::ostream& sl, std::string const& port , const bool
   }
 }
 
+[[noreturn]] void cycles_failed( char const* const what , long const i ) {
+  std::ostringstream oss ;
+  oss << "cycles: " << what << " in connection " << i ;
+  throw std::runtime_error( oss.str() ) ;
+}
+
+// Connects to the cycles server, sends a line and closes.
+void serve_cycle( long const i ) {
+  connection c( "" , CYCLES_SERVICE ) ;
+  c.timeout( CYCLES_TIMEOUT ) ;
+  instream is( c ) ;
+  onstream os( c ) ;
+
+  // The welcome message ends with an empty line
+  std::string line ;
+  while( std::getline( is , line ) && !line.empty() ) {}
+  if( !is ) {
+    cycles_failed( "no welcome message" , i ) ;
+  }
+
+  os << "cycle" << std::endl ;
+  if( !std::getline( is , line ) ) {
+    cycles_failed( "no reply" , i ) ;
+  }
+  std::cout << "Connection " << i << ": " << line << std::endl ;
+}
+
+// Connects to the cycles server and waits until the server closes the
+// connection after its idle timeout.
+void idle_cycle( long const i ) {
+  connection c( "" , CYCLES_SERVICE ) ;
+  c.timeout( CYCLES_TIMEOUT ) ;
+  instream is( c ) ;
+
+  double const start = nanonet::util::time() ;
+  std::string line ;
+  while( std::getline( is , line ) ) {}
+  if( nanonet::util::time() - start >= CYCLES_TIMEOUT ) {
+    cycles_failed( "no idle timeout" , i ) ;
+  }
+  std::cout << "Connection " << i << ": Closed by server" << std::endl ;
+}
+
+// Sequential connect/close cycles against an event loop server:  Each
+// worker must keep serving after connections have been closed by the
+// client or by the server's idle timeout.
+void run_cycles( long const n ) {
+  // Not echoed, the output must not depend on timing
+  nanonet::util::log::syslogger sl( "CYCLES" ) ;
+  nanonet::util::running_flag running ;
+
+  auto p = reverse_server_parameters( CYCLES_SERVICE , true ) ;
+  p.event_threads = 2 ;
+  p.timeout = CYCLES_IDLE_TIMEOUT ;
+  p.log_connections = false ;
+  const auto manager = nanonet::util::run_server(
+      reverse_service_handle_line ,
+      running ,
+      nanonet::util::os_writer{ reverse_service_welcome } , p , &sl ) ;
+
+  // Give the server time to listen
+  nanonet::util::sleep( 0.5 ) ;
+
+  // Shut down on errors as well, the manager waits for it
+  try {
+    long i = 0 ;
+    for( ; i < n ; ++i ) {
+      serve_cycle( i ) ;
+    }
+    // Once for each worker, then check that both are still serving
+    for( long const end = i + 2 ; i < end ; ++i ) {
+      idle_cycle( i ) ;
+    }
+    for( long const end = i + 2 ; i < end ; ++i ) {
+      serve_cycle( i ) ;
+    }
+  } catch( ... ) {
+    running.shutdown() ;
+    throw ;
+  }
+
+  running.shutdown() ;
+  std::cout << "Served " << n + 4 << " connections" << std::endl ;
+}
+
 void run_http_server(std::ostream& sl, const std::string& port) {
   nanonet::util::server_parameters p;
   p.service = port;
@@ -527,12 +739,81 @@ int main( int argc , char const* const* const argv ) {
   } else if( "reverse" == command ) {
   
     if( 3 != argc ) { usage( argv[ 0 ] ) ; return 1 ; }
-    run_reverse_server( sl , argv[ 2 ] , false ) ;
+    run_reverse_server( sl , reverse_server_parameters( argv[ 2 ] , false ) ) ;
 
   } else if( "reverse_bg" == command ) {
   
     if( 3 != argc ) { usage( argv[ 0 ] ) ; return 1 ; }
-    run_reverse_server( sl , argv[ 2 ] , true ) ;
+    run_reverse_server( sl , reverse_server_parameters( argv[ 2 ] , true ) ) ;
+
+  } else if( "reverse_ev" == command ) {
+  
+    if( argc < 3 || argc > 6 ) { usage( argv[ 0 ] ) ; return 1 ; }
+    auto p = reverse_server_parameters( argv[ 2 ] , false ) ;
+    p.event_threads = 2 ;
+    set_timeouts( p , argc , argv , 3 ) ;
+    run_reverse_server( sl , p ) ;
+
+  } else if( "reverse_sh" == command ) {
+  
+    if( 3 != argc ) { usage( argv[ 0 ] ) ; return 1 ; }
+    auto p = reverse_server_parameters( argv[ 2 ] , false ) ;
+    p.listen_shards = 4 ;
+    p.pin_listen_shards = true ;
+    run_reverse_server( sl , p ) ;
+
+  } else if( "reverse_pool" == command ) {
+  
+    if( 3 != argc ) { usage( argv[ 0 ] ) ; return 1 ; }
+    auto p = reverse_server_parameters( argv[ 2 ] , false ) ;
+    p.handler_threads = 2 ;
+    p.max_connections = 4 ;
+    p.overflow = nanonet::util::overflow_policy::reject ;
+    p.busy_message = nanonet::util::os_writer{ reverse_service_busy } ;
+    run_reverse_server( sl , p ) ;
+
+  } else if( "reverse_co" == command ) {
+  
+    if( argc < 3 || argc > 6 ) { usage( argv[ 0 ] ) ; return 1 ; }
+    auto p = reverse_server_parameters( argv[ 2 ] , false ) ;
+    p.event_threads = 2 ;
+    set_timeouts( p , argc , argv , 3 ) ;
+    nanonet::util::running_flag running ;
+    const auto manager = nanonet::util::run_server(
+        nanonet::util::coroutine_handler_type{ reverse_service_coroutine } ,
+        running , p , &sl ) ;
+
+  } else if( "reverse_frames" == command ) {
+  
+    if( 3 != argc && 4 != argc ) { usage( argv[ 0 ] ) ; return 1 ; }
+    auto p = reverse_server_parameters( argv[ 2 ] , false ) ;
+    p.event_threads = 4 == argc ? std::stol( argv[ 3 ] ) : 0 ;
+    nanonet::util::running_flag running ;
+    const auto manager = nanonet::util::run_server(
+        nanonet::util::frame_handler_type{ reverse_service_handle_frame } ,
+        running , std::nullopt , p , &sl ) ;
+
+  } else if( "reverse_handoff" == command ) {
+  
+    if( 4 != argc && 5 != argc ) { usage( argv[ 0 ] ) ; return 1 ; }
+    auto p = reverse_server_parameters( argv[ 2 ] , false ) ;
+    p.event_threads = 2 ;
+    p.handoff_service = argv[ 3 ] ;
+    if( 5 == argc ) { p.handoff_drain_timeout = std::stod( argv[ 4 ] ) ; }
+    run_reverse_server( sl , p ) ;
+
+  } else if( "cycles" == command ) {
+
+    if( argc > 3 ) { usage( argv[ 0 ] ) ; return 1 ; }
+    run_cycles( 3 == argc ? std::stol( argv[ 2 ] ) : 10 ) ;
+
+  } else if( "reverse_metrics" == command ) {
+  
+    if( 4 != argc ) { usage( argv[ 0 ] ) ; return 1 ; }
+    auto p = reverse_server_parameters( argv[ 2 ] , false ) ;
+    p.handler_threads = 2 ;
+    p.metrics_service = argv[ 3 ] ;
+    run_reverse_server( sl , p ) ;
 
   } else if( "httpd" == command ) {
   
@@ -16,6 +16,7 @@
 
 
 #include "nanonet/sys/network.h"
+#include "nanonet/sys/udp-reactor.h"
 #include "nanonet/util.h"
 
 #include <iostream>
@@ -26,6 +27,8 @@
 #include <iomanip>
 #include <sstream>
 #include <fstream>
+#include <list>
+#include <span>
 
 #include <cassert>
 #include <cstdlib>
@@ -59,11 +62,15 @@ void usage( std::string const prog ) {
 "                                    received messages\n"
 "\n"
 "The <proto> argument refers to protocol version for the local socket\n"
-"and must be 'ip4' or 'ip6'.  For resolve, it may be 'any'.\n"
+"and must be 'ip4', 'ip6' or 'unix'.  For resolve, it may be 'any'.\n"
+"For 'unix', ports are Unix domain socket paths unix:<path> or\n"
+"unix:@<name> (abstract namespace).\n"
 "\n"
 "Examples:\n"
 "  udp-test pong ip6 4711\n"
 "  In another window: udp-test ping ip6 ::1 4711 \"Hi there\" \"Hi again\"\n"
+"  udp-test pong unix unix:@pong\n"
+"  In another window: udp-test ping unix - unix:@pong no \"Hi there\"\n"
   ;
 
 }
@@ -177,8 +184,150 @@ void unbound_local() {
 }
 #endif
 
+// Send and receive over loopback with contiguous ranges (no copies)
+// and others (copied via a pooled buffer).
+void contiguous_ranges() {
+  auto r = datagram_socket::bound( "127.0.0.1" , "0" ) ;
+  auto s = datagram_socket::connected( r.local() ) ;
+
+  char const* const hello = "hello" ;
+  s.send( hello , hello + 5 ) ;
+  std::vector< char > v( 100 ) ;
+  always_assert( 5 == r.receive( v.begin() , 1 ) ) ;
+  always_assert( "hello" == std::string( v.data() , 5 ) ) ;
+
+  std::vector< unsigned char > const u{ 'a' , 'b' , 'c' } ;
+  s.send( u.begin() , u.end() ) ;
+  std::span< char > const sp( v ) ;
+  always_assert( 3 == r.receive( sp.begin() , 1 , sp.size() ) ) ;
+  always_assert( "abc" == std::string( v.data() , 3 ) ) ;
+
+  std::list< char > const l{ 'x' , 'y' } ;
+  s.send( l.begin() , l.end() , r.local() ) ;
+  std::string msg ;
+  datagram_socket::address_type source ;
+  always_assert( 2 == r.receive( source , std::back_inserter( msg ) , 1 ) ) ;
+  always_assert( "xy" == msg ) ;
+  always_assert( source.port() == s.local().port() ) ;
+
+  // Truncated to n
+  s.send( hello , hello + 5 ) ;
+  always_assert( 2 == r.receive( v.data() , 1 , 2 ) ) ;
+  always_assert( r.timeout() == r.receive( v.data() , 0 ) ) ;
+}
+
+// Sends 200 records of 100 bytes and a short one with segmentation
+// offload, receives them with receive offload.  The kernel decides how
+// many datagrams it coalesces.
+void segmentation_offload() {
+  auto r = datagram_socket::bound( "127.0.0.1" , "0" ) ;
+  r.receive_offload() ;
+  auto s = datagram_socket::connected( r.local() ) ;
+
+  long const records = 200 ;
+  std::vector< char > data( records * 100 + 30 ) ;
+  for( long i = 0 ; i < static_cast< long >( data.size() ) ; ++i ) {
+    data[ i ] = i / 100 ;
+  }
+  s.send_segmented( data , 100 ) ;
+
+  std::vector< char > buffer( 65536 ) ;
+  datagram_segments segments ;
+  long received = 0 ;
+  while( received < records + 1 ) {
+    always_assert( r.receive_segments( buffer , segments , 1 ) ) ;
+    always_assert( !segments.truncated ) ;
+    for( long i = 0 ; i < segments.count() ; ++i , ++received ) {
+      auto const d = segments[ i ] ;
+      always_assert( 
+          static_cast< long >( d.size() ) == ( received < records ? 100 : 30 ) ) ;
+      always_assert( d.front() == static_cast< char >( received ) ) ;
+      always_assert( d.back () == static_cast< char >( received ) ) ;
+    }
+  }
+  always_assert( records + 1 == received ) ;
+}
+
+// Three sockets in one reactor, the first one removes itself after
+// its first batch.
+void reactor() {
+  udp_reactor r( 4 ) ;
+  std::vector< long > received( 3 ) ;
+  std::vector< datagram_socket::address_type > local ;
+  for( long i = 0 ; i < 3 ; ++i ) {
+    auto& s = r.add( datagram_socket::bound( "127.0.0.1" , "0" ) ,
+        [ & , i ]( datagram_socket& s , 
+                   std::span< datagram_message const > const batch ) {
+      always_assert( batch.size() <= 4 ) ;
+      for( auto const& m : batch ) {
+        always_assert( 1 == m.size && 'a' + i == m.buffer[ 0 ] ) ;
+      }
+      received[ i ] += batch.size() ;
+      if( 0 == i ) { r.remove( s ) ; }
+    } ) ;
+    local.push_back( s.local() ) ;
+  }
+  always_assert( 3 == r.size() ) ;
+
+  datagram_socket sender( ipv4 ) ;
+  for( long i = 0 ; i < 3 ; ++i ) {
+    std::string const msg( 1 , 'a' + i ) ;
+    for( long j = 0 ; j < 10 ; ++j ) {
+      sender.send( msg.begin() , msg.end() , local[ i ] ) ;
+    }
+  }
+
+  while( received[ 1 ] + received[ 2 ] < 20 ) {
+    always_assert( r.run_once( 1 ) > 0 ) ;
+  }
+  always_assert( 2 == r.size() ) ;
+  always_assert( 1 <= received[ 0 ] && received[ 0 ] <= 4 ) ;
+  always_assert( 10 == received[ 1 ] && 10 == received[ 2 ] ) ;
+  always_assert( 0 == r.run_once( 0 ) ) ;
+
+  // Each posted task counts
+  long tasks = 0 ;
+  for( long i = 0 ; i < 3 ; ++i ) {
+    r.loop().post( [ &tasks ] { ++tasks ; } ) ;
+  }
+  always_assert( 3 == r.run_once( 1 ) && 3 == tasks ) ;
+}
+
+// Kernel receive timestamps lie between sending and receiving
+void timestamps() {
+  auto r = datagram_socket::bound( "127.0.0.1" , "0" ) ;
+  auto s = datagram_socket::connected( r.local() ) ;
+  std::string const msg = "tick" ;
+  std::vector< char > buffer( 100 ) ;
+  datagram_socket::address_type source ;
+  double timestamp = -1 ;
+
+  s.send( msg.begin() , msg.end() ) ;
+  always_assert( 4 == r.receive_timestamped( 
+        source , timestamp , buffer.begin() , 1 ) ) ;
+  always_assert( 0 == timestamp ) ;
+
+  r.receive_timestamps() ;
+  double const before = utc() ;
+  s.send( msg.begin() , msg.end() ) ;
+  s.send( msg.begin() , msg.end() ) ;
+  always_assert( 4 == r.receive_timestamped( 
+        source , timestamp , buffer.begin() , 1 ) ) ;
+  always_assert( before <= timestamp && timestamp <= utc() ) ;
+
+  std::vector< datagram_message > messages( 1 ) ;
+  messages[ 0 ].buffer = buffer ;
+  always_assert( 1 == r.receive_batch( messages , 1 ) ) ;
+  always_assert( timestamp <= messages[ 0 ].timestamp ) ;
+  always_assert( messages[ 0 ].timestamp <= utc() ) ;
+}
+
 void run_tests() {
   // unbound_local();
+  timestamps();
+  contiguous_ranges();
+  segmentation_offload();
+  reactor();
   {
     datagram_socket s( ipv4 ) ;
     expect_throws( datagram_socket s1( ipv4 ) , 
@@ -14,10 +14,16 @@
 // limitations under the License.
 //
 
+#include <algorithm>
+#include <atomic>
+#include <cmath>
 #include <iomanip>
 #include <iostream>
 #include <list>
+#include <memory>
 #include <random>
+#include <sstream>
+#include <string>
 #include <thread>
 #include <type_traits>
 #include <vector>
@@ -26,8 +32,11 @@
 
 #include "nanonet/container-util.h"
 #include "nanonet/error.h"
+#include "nanonet/histogram.h"
 #include "nanonet/random.h"
+#include "nanonet/rate-limiter.h"
 #include "nanonet/safe_queue.h"
+#include "nanonet/timer-wheel.h"
 #include "nanonet/type_traits.h"
 #include "nanonet/util.h"
 #include "nanonet/xdr.h"
@@ -176,6 +185,39 @@ void test_xdr_string(std::ostream& os) {
   }
 }
 
+void test_xdr_frame(std::ostream& os) {
+  os << "Testing frames" << std::endl;
+
+  std::stringstream ss;
+  std::string payload;
+  for (int i = 0; i < 100; ++i) {
+    nanonet::xdr::write_frame(ss, payload);
+    payload.push_back('a' + i % 26);
+  }
+  always_assert(ss.str().size() % 4 == 0);
+
+  std::vector<char> buf;
+  for (int i = 0; i < 100; ++i) {
+    always_assert(nanonet::xdr::read_frame(ss, buf, 1000));
+    always_assert(std::string(buf.begin(), buf.end()) == payload.substr(0, i));
+  }
+  always_assert(not nanonet::xdr::read_frame(ss, buf, 1000));
+
+  // Too large
+  std::stringstream large;
+  nanonet::xdr::write_frame(large, payload);
+  try {
+    nanonet::xdr::read_frame(large, buf, 99);
+    always_assert(false);
+  } catch (std::runtime_error const& e) {
+    os << e.what() << std::endl;
+  }
+
+  // Truncated
+  std::stringstream truncated(large.str().substr(0, 10));
+  always_assert(not nanonet::xdr::read_frame(truncated, buf, 1000));
+}
+
 void test_xdr(std::ostream& os) {
   test_xdr<false, 16>(os);
   test_xdr<false, 32>(os);
@@ -191,6 +233,8 @@ void test_xdr(std::ostream& os) {
   test_xdr_float_ieee(os);
 
   test_xdr_string(os);
+
+  test_xdr_frame(os);
 }
 
 void test_increment_sentry() {
@@ -537,6 +581,455 @@ void test_stringutils(std::ostream& os) {
   verify_throws("No colon found", nanonet::util::split_colon_blank, "");
 }
 
+void test_histogram(std::ostream& os) {
+  using nanonet::math::histogram;
+
+  // Bucket boundaries are consistent
+  for (int i = 0; i < histogram::BUCKETS; ++i) {
+    always_assert(histogram::lower_bound(i) < histogram::upper_bound(i));
+    always_assert(i == histogram::bucket(histogram::lower_bound(i)));
+    if (i + 1 < histogram::BUCKETS) {
+      always_assert(histogram::upper_bound(i) == histogram::lower_bound(i + 1));
+    }
+  }
+  always_assert(0 == histogram::bucket(-1));
+  always_assert(histogram::BUCKETS - 1 == histogram::bucket(1e9));
+
+  histogram h;
+  always_assert(0 == h.quantile(0.5));
+  always_assert(0 == h.mean());
+
+  // 1us ... 1000us
+  for (int i = 1; i <= 1000; ++i) {
+    h.record(1e-6 * i);
+  }
+
+  os << "Histogram count: " << h.count() << std::endl;
+  os << "Histogram mean [us]: " << 1e6 * h.mean() << std::endl;
+  for (const double q : {0.0, 0.5, 0.9, 0.99, 0.999, 1.0}) {
+    const double expected = std::max(1.0, 1000 * q);
+    const double actual = 1e6 * h.quantile(q);
+    always_assert(std::fabs(actual - expected) <= expected / 16);
+    os << "Histogram quantile " << q << " [us]: " << actual << std::endl;
+  }
+
+  // Sharded histogram and counter from several threads
+  nanonet::math::sharded_histogram sh;
+  nanonet::math::sharded_counter sc;
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 20; ++t) {
+    threads.emplace_back([&sh, &sc] {
+      for (int i = 1; i <= 1000; ++i) {
+        sh.record(1e-6 * i);
+        sc.add(2);
+      }
+    });
+  }
+  for (auto& t : threads) { t.join(); }
+
+  const histogram s = sh.snapshot();
+  always_assert(20000 == s.count());
+  always_assert(40000 == sc.value());
+  for (int i = 0; i < histogram::BUCKETS; ++i) {
+    always_assert(s.count(i) == 20 * h.count(i));
+  }
+  os << "Sharded histogram mean [us]: " << 1e6 * s.mean() << std::endl;
+  os << "Sharded histogram p99 [us]: " << 1e6 * s.quantile(0.99) << std::endl;
+}
+
+void test_timer_wheel(std::ostream& os) {
+  using nanonet::util::timer_wheel;
+
+  // Resolution 1, so integral times are exact
+  timer_wheel w(1, 0);
+  std::vector<std::uint64_t> fired;
+  auto const collect = [&fired](timer_wheel::timer_id, std::uint64_t const u) {
+    fired.push_back(u);
+  };
+  auto const print = [&os, &fired](double const now) {
+    os << "Timer wheel expired at " << now << ":";
+    for (const auto u : fired) { os << " " << u; }
+    os << std::endl;
+    fired.clear();
+  };
+
+  const auto a = w.add(1);
+  const auto b = w.add(2);
+  const auto c = w.add(3);
+  const auto d = w.add(4);
+  w.arm(a, 10);
+  w.arm(b, 5000);
+  // Beyond the last level
+  w.arm(c, 3e9);
+  w.arm(d, 5);
+  always_assert(4 == w.size());
+  os << "Timer wheel next expiry: " << w.next_expiry() << std::endl;
+
+  for (const double now : {4.5, 5.0}) {
+    w.expire(now, collect);
+    print(now);
+  }
+
+  // Rearm and disarm
+  w.arm(a, 100);
+  w.disarm(b);
+  always_assert(not w.armed(b));
+  w.arm(b, 70);
+  for (const double now : {69.0, 70.0, 99.0, 100.0, 2.9e9, 3e9}) {
+    w.expire(now, collect);
+    print(now);
+  }
+  always_assert(0 == w.size());
+  always_assert(std::isinf(w.next_expiry()));
+
+  // Expired timers can be rearmed and removed by the handler
+  w.arm(a, 3e9 + 10);
+  w.arm(d, 3e9 + 10);
+  long calls = 0;
+  w.expire(3e9 + 10,
+      [&w, &calls, d](timer_wheel::timer_id const id, std::uint64_t) {
+    ++calls;
+    if (d == id) {
+      w.remove(d);
+    } else {
+      w.arm(id, 3e9 + 20);
+    }
+  });
+  always_assert(2 == calls);
+  always_assert(1 == w.size());
+
+  // Disarming an expired timer suppresses its handler call
+  w.arm(b, 3e9 + 20);
+  calls = 0;
+  w.expire(3e9 + 20,
+      [&w, &calls, a, b](timer_wheel::timer_id const id, std::uint64_t) {
+    ++calls;
+    w.disarm(a == id ? b : a);
+  });
+  always_assert(1 == calls);
+  always_assert(0 == w.size());
+  w.remove(a);
+  w.remove(b);
+  w.remove(c);
+  always_assert(0 == w.size());
+
+  // Random deadlines, compared with the obvious implementation
+  std::mt19937 gen(42);
+  timer_wheel rw(1, 0);
+  std::vector<double> deadlines(2000, -1);
+  for (std::size_t i = 0; i < deadlines.size(); ++i) {
+    always_assert(i == rw.add(i));
+  }
+
+  double now = 0;
+  long n_fired = 0;
+  while (now < 1e7) {
+    for (int k = 0; k < 50; ++k) {
+      const std::size_t i = gen() % deadlines.size();
+      if (0 == gen() % 10) {
+        rw.disarm(i);
+        deadlines[i] = -1;
+      } else {
+        deadlines[i] = now + std::pow(2.0, gen() % 24) + gen() % 100;
+        rw.arm(i, deadlines[i]);
+      }
+    }
+
+    now += gen() % 2 ? gen() % 100 : std::pow(2.0, gen() % 22);
+    std::vector<std::uint64_t> expected;
+    for (std::size_t i = 0; i < deadlines.size(); ++i) {
+      if (deadlines[i] >= 0 and deadlines[i] <= now) {
+        expected.push_back(i);
+        deadlines[i] = -1;
+      }
+    }
+    rw.expire(now, collect);
+    std::sort(fired.begin(), fired.end());
+    always_assert(expected == fired);
+    n_fired += fired.size();
+    fired.clear();
+  }
+  os << "Timer wheel random test: " << n_fired << " timers expired" << std::endl;
+}
+
+void test_rate_limiter(std::ostream& os) {
+  // 2 per second, bursts of 3, 2 keys per shard
+  nanonet::util::rate_limiter l(2, 3, 32);
+
+  auto const allowed = [&l](std::string const& key, double const now) {
+    int ret = 0;
+    for (int i = 0; i < 10; ++i) {
+      ret += l.allow(key, now);
+    }
+    return ret;
+  };
+
+  os << "Rate limiter burst: " << allowed("a", 0) << std::endl;
+  os << "Rate limiter after 0.5s: " << allowed("a", 0.5) << std::endl;
+  os << "Rate limiter after 1.5s: " << allowed("a", 1.5) << std::endl;
+  os << "Rate limiter after 100s: " << allowed("a", 100) << std::endl;
+  os << "Rate limiter other key: " << allowed("b", 100) << std::endl;
+
+  // Memory is bounded, forgotten keys start over
+  for (int i = 0; i < 1000; ++i) {
+    always_assert(l.allow(std::to_string(i), 200));
+  }
+  always_assert(l.size() <= 32);
+  always_assert(3 == allowed("a", 200));
+
+  // Concurrent use of the same key
+  nanonet::util::rate_limiter cl(1, 100, 1000);
+  std::atomic<int> n{0};
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 8; ++t) {
+    threads.emplace_back([&cl, &n] {
+      for (int i = 0; i < 1000; ++i) {
+        n += cl.allow("x", 0);
+      }
+    });
+  }
+  for (auto& t : threads) { t.join(); }
+  os << "Rate limiter concurrent: " << n << std::endl;
+}
+
+// Reads from a string in chunks of at most chunk bytes
+struct chunk_reader {
+  chunk_reader(std::string data, long const chunk)
+  : data(std::move(data)), chunk(chunk) {}
+
+  long read(char* const buf, long const n) {
+    long const ret = std::min({n, chunk, static_cast<long>(data.size() - pos)});
+    std::copy(data.begin() + pos, data.begin() + pos + ret, buf);
+    pos += ret;
+    return ret;
+  }
+
+  void shutdown_read() {}
+
+  std::string data;
+  long chunk;
+  long pos = 0;
+};
+
+// Character-wise reference for nanonet::util::getline()
+bool getline_reference(std::istream& is, std::string& s, long const maxsize) {
+  s.clear();
+  char c;
+  while (static_cast<long>(s.size()) < maxsize) {
+    if (!is.get(c)) {
+      return false;
+    }
+    if ('\n' == c) {
+      return true;
+    }
+    s.push_back(c);
+  }
+  return true;
+}
+
+// Buffered streams take the find_char() path, lines spanning refills
+// and exactly maxsize long
+void test_getline_buffered() {
+  std::string input;
+  for (int i = 0; i < 200; ++i) {
+    input += std::string(i % 70, 'a' + i % 26) + "\n";
+  }
+  input += "no newline";
+
+  for (long const maxsize : {1, 10, 33, 64, 1000}) {
+    std::vector<std::string> expected;
+    std::istringstream ref(input);
+    std::string line;
+    while (getline_reference(ref, line, maxsize)) {
+      expected.push_back(line);
+    }
+
+    std::istringstream is1(input);
+    istreambuf<chunk_reader> buf(
+        std::make_shared<chunk_reader>(input, 7), 16, 2);
+    std::istream is2(&buf);
+    for (std::istream* const is : {static_cast<std::istream*>(&is1), &is2}) {
+      std::vector<std::string> actual;
+      while (nanonet::util::getline(*is, line, maxsize)) {
+        actual.push_back(line);
+      }
+      always_assert(is->eof());
+      always_assert(actual == expected);
+    }
+  }
+
+  // All alignments and lengths around the vector sizes
+  std::string const data(200, 'x');
+  for (long offset = 0; offset < 40; ++offset) {
+    for (long n = 0; n + offset <= 100; ++n) {
+      std::string d = data;
+      always_assert(!nanonet::util::find_char(d.data() + offset, '\n', n));
+      if (n > 0) {
+        d[offset + n - 1] = '\n';
+        d[offset + n] = '\n';
+        always_assert(nanonet::util::find_char(d.data() + offset, '\n', n)
+                      == d.data() + offset + n - 1);
+      }
+    }
+  }
+}
+
+void test_istreambuf_span(std::ostream& os) {
+  std::string const input =
+      "short\n"
+      "a line longer than the buffer\n"
+      "x\n"
+      "no newline";
+  istreambuf<chunk_reader> buf(
+      std::make_shared<chunk_reader>(input, 3), 8, 2);
+
+  // Lines across refills, buffer grows for the long one
+  for (int i = 0; i < 3; ++i) {
+    os << "read_until: [" << buf.read_until('\n', 100) << "] capacity "
+       << buf.capacity() << std::endl;
+  }
+
+  // Too long or no delimiter before EOF: Nothing consumed
+  always_assert(buf.read_until('\n', 4).empty());
+  always_assert(buf.read_until('\n').empty());
+  os << "available: " << buf.available() << std::endl;
+
+  auto const span = buf.peek_span();
+  os << "peek_span: [" << std::string(span.begin(), span.end()) << "]"
+     << std::endl;
+  buf.consume(3);
+  always_assert(buf.fill(100) == 7);
+
+  // Putback and std::streambuf interface still work
+  always_assert(buf.sungetc() == ' ');
+  std::istream is(&buf);
+  std::string rest;
+  is >> rest;
+  os << "rest: [" << rest << "]" << std::endl;
+  always_assert(0 == buf.available());
+  always_assert(buf.peek_span().empty());
+}
+
+// A chunk_reader with scatter read, records the read sizes
+struct scatter_reader : chunk_reader {
+  using chunk_reader::chunk_reader;
+
+  long read(char* const buf, long const n) {
+    calls += ' ';
+    calls += std::to_string(n);
+    return chunk_reader::read(buf, n);
+  }
+
+  long read(char* const buf1, long const n1, char* const buf2, long const n2) {
+    calls += ' ';
+    calls += std::to_string(n1);
+    calls += '+';
+    calls += std::to_string(n2);
+    long const ret1 = chunk_reader::read(buf1, n1);
+    return ret1 < n1 ? ret1 : ret1 + chunk_reader::read(buf2, n2);
+  }
+
+  std::string calls;
+};
+
+void test_istreambuf_xsgetn(std::ostream& os) {
+  std::string input;
+  for (int i = 0; i < 100; ++i) {
+    input += std::to_string(i) + " ";
+  }
+  auto const rw = std::make_shared<scatter_reader>(input, 1000);
+  istreambuf<scatter_reader> buf(rw, 16, 2);
+  std::istream is(&buf);
+
+  // Small read through the buffer, then large ones directly
+  std::string small(5, 0);
+  always_assert(is.read(&small[0], small.size()));
+  std::string large(50, 0);
+  always_assert(is.read(&large[0], large.size()));
+  always_assert(small + large == input.substr(0, 55));
+
+  // Putback from the caller's data, then the refilled buffer
+  always_assert(is.unget());
+  always_assert(is.get() == large.back());
+  os << "after large read: available " << buf.available() << std::endl;
+
+  std::string rest(1000, 0);
+  is.read(&rest[0], rest.size());
+  always_assert(is.eof());
+  rest.resize(is.gcount());
+  always_assert(small + large + rest == input);
+  os << "istreambuf reads:" << rw->calls << std::endl;
+}
+
+// Records the sizes of write() calls.  The gather write is optional,
+// see ostreambuf.
+template <bool gather>
+struct recording_writer {
+  long write(char const* const buf, long const n) {
+    data.append(buf, n);
+    calls += ' ';
+    calls += std::to_string(n);
+    return n;
+  }
+
+  long write(char const* const buf1, long const n1,
+             char const* const buf2, long const n2)
+  requires gather {
+    data.append(buf1, n1);
+    data.append(buf2, n2);
+    calls += ' ';
+    calls += std::to_string(n1);
+    calls += '+';
+    calls += std::to_string(n2);
+    return n1 + n2;
+  }
+
+  void shutdown_write() {}
+
+  std::string data;
+  std::string calls;
+};
+
+template <bool gather>
+void test_ostreambuf_xsputn(std::ostream& os) {
+  auto const rw = std::make_shared<recording_writer<gather>>();
+  std::string const large(100, 'x');
+  {
+    ostreambuf<recording_writer<gather>> buf(rw, 16);
+    std::ostream out(&buf);
+    out << "abc" << std::string(10, 'y') << "0123456789" << large << "z";
+    out.flush();
+    always_assert(out.good());
+  }
+  always_assert(rw->data ==
+      "abc" + std::string(10, 'y') + "0123456789" + large + "z");
+  os << "ostreambuf writes (gather " << gather << "):" << rw->calls
+     << std::endl;
+}
+
+void test_buffer_pool(std::ostream& os) {
+  auto const before = nanonet::util::buffer_pool_stats();
+  {
+    nanonet::util::pooled_buffer b1(1000);
+    nanonet::util::pooled_buffer b2(3 * nanonet::util::MAX_POOLED_SIZE);
+    always_assert(1000 == b1.size());
+  }
+  // Same size class
+  nanonet::util::pooled_buffer b3(600);
+  nanonet::util::pooled_buffer b4(std::move(b3));
+  always_assert(b3.empty());
+  always_assert(600 == b4.size());
+
+  auto const after = nanonet::util::buffer_pool_stats();
+  os << "buffer pool: hits " << after.hits - before.hits
+     << " misses " << after.misses - before.misses
+     << " held " << after.bytes_held - before.bytes_held << std::endl;
+  always_assert(after.hit_rate() > 0);
+
+  nanonet::util::buffer_pool_trim();
+  always_assert(0 == nanonet::util::buffer_pool_stats().bytes_held);
+}
+
 #if 0
 void test_utf8_canonical() {
   always_assert(u8"" == nanonet::util::utf8_canonical(u8""));
@@ -596,6 +1089,7 @@ int main() {
   test_capped_vector();
 
   test_getline();
+  test_getline_buffered();
 
   test_safe_queue_destructor();
   test_safe_queue(100000);
@@ -608,6 +1102,21 @@ int main() {
 
   test_xdr(std::cout);
 
+  test_histogram(std::cout);
+
+  test_timer_wheel(std::cout);
+
+  test_rate_limiter(std::cout);
+
+  test_istreambuf_span(std::cout);
+
+  test_istreambuf_xsgetn(std::cout);
+
+  test_ostreambuf_xsputn<false>(std::cout);
+  test_ostreambuf_xsputn<true >(std::cout);
+
+  test_buffer_pool(std::cout);
+
   test_increment_sentry();
 
         {
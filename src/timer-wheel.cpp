@@ -0,0 +1,262 @@
+//
+// Copyright 2015 KISS Technologies GmbH, Switzerland
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+//
+// The classic hierarchical wheel:  A timer due in delta ticks goes to
+// the lowest level l with delta < 2^((l + 1) * SLOT_BITS), into the slot
+// given by the corresponding bits of its deadline.  Whenever the
+// current tick crosses a slot boundary of level l, the timers in the
+// next slot of level l are reinserted, which moves them down.
+//
+
+#include "nanonet/timer-wheel.h"
+
+#include "nanonet/assert.h"
+
+#include <algorithm>
+#include <bit>
+#include <limits>
+
+#include <cmath>
+
+using nanonet::util::timer_wheel;
+
+namespace {
+
+// Timers due later than that are put in the last slot of the last
+// level and reinserted when it comes up [ticks]
+constexpr std::uint64_t MAX_DELTA =
+    (std::uint64_t{1} << (timer_wheel::LEVELS * timer_wheel::SLOT_BITS)) - 1;
+
+constexpr std::uint64_t SLOT_MASK = timer_wheel::SLOTS - 1;
+
+} // anonymous namespace
+
+
+nanonet::util::timer_wheel::timer_wheel(
+    double const resolution, double const now)
+: resolution_(resolution),
+  origin_(now) {
+  always_assert(resolution > 0);
+  heads_.fill(NONE);
+}
+
+// @return t [s] in ticks, rounded up
+std::uint64_t nanonet::util::timer_wheel::to_ticks(double const t) const {
+  const double ticks = std::ceil((t - origin_) / resolution_);
+  if (not (ticks > 0)) {
+    return 0;
+  }
+  if (ticks >= static_cast<double>(std::numeric_limits<std::uint64_t>::max())) {
+    return std::numeric_limits<std::uint64_t>::max();
+  }
+  return static_cast<std::uint64_t>(ticks);
+}
+
+timer_wheel::timer_id nanonet::util::timer_wheel::add(
+    std::uint64_t const user_data) {
+  timer_id id = free_;
+  if (NONE == id) {
+    always_assert(entries_.size() < NONE);
+    id = static_cast<timer_id>(entries_.size());
+    entries_.emplace_back();
+  } else {
+    free_ = entries_[id].next;
+  }
+
+  entry& e = entries_[id];
+  e = entry();
+  e.user_data = user_data;
+  e.slot = DISARMED;
+  return id;
+}
+
+void nanonet::util::timer_wheel::remove(timer_id const id) {
+  disarm(id);
+  entry& e = entries_[id];
+  e.slot = FREE;
+  e.next = free_;
+  free_ = id;
+}
+
+void nanonet::util::timer_wheel::arm(timer_id const id, double const deadline) {
+  disarm(id);
+  entries_[id].deadline = to_ticks(deadline);
+  insert(id);
+  ++armed_;
+}
+
+void nanonet::util::timer_wheel::disarm(timer_id const id) {
+  always_assert(id < entries_.size());
+  entry& e = entries_[id];
+  always_assert(FREE != e.slot);
+  if (e.slot >= 0) {
+    unlink(id);
+    --armed_;
+  }
+  e.slot = DISARMED;
+}
+
+bool nanonet::util::timer_wheel::armed(timer_id const id) const {
+  always_assert(id < entries_.size());
+  return entries_[id].slot >= 0;
+}
+
+std::uint64_t nanonet::util::timer_wheel::user_data(timer_id const id) const {
+  always_assert(id < entries_.size());
+  return entries_[id].user_data;
+}
+
+void nanonet::util::timer_wheel::insert(timer_id const id) {
+  entry& e = entries_[id];
+
+  std::uint64_t delta = std::max(e.deadline, current_) - current_;
+  int level = 0;
+  if (delta > MAX_DELTA) {
+    delta = MAX_DELTA;
+    level = LEVELS - 1;
+  } else {
+    while (delta >> ((level + 1) * SLOT_BITS)) {
+      ++level;
+    }
+  }
+
+  const std::uint64_t due = current_ + delta;
+  const int slot = level * SLOTS
+                 + static_cast<int>((due >> (level * SLOT_BITS)) & SLOT_MASK);
+
+  e.slot = slot;
+  e.prev = NONE;
+  e.next = heads_[slot];
+  if (NONE != e.next) {
+    entries_[e.next].prev = id;
+  }
+  heads_[slot] = id;
+  occupied_[level] |= std::uint64_t{1} << (slot % SLOTS);
+}
+
+void nanonet::util::timer_wheel::unlink(timer_id const id) {
+  entry& e = entries_[id];
+  if (NONE == e.prev) {
+    heads_[e.slot] = e.next;
+  } else {
+    entries_[e.prev].next = e.next;
+  }
+  if (NONE != e.next) {
+    entries_[e.next].prev = e.prev;
+  }
+  if (NONE == heads_[e.slot]) {
+    occupied_[e.slot / SLOTS] &= ~(std::uint64_t{1} << (e.slot % SLOTS));
+  }
+  e.prev = e.next = NONE;
+}
+
+// Reinserts the timers from the current slot of the given level
+void nanonet::util::timer_wheel::cascade(int const level) {
+  const int slot = level * SLOTS
+      + static_cast<int>((current_ >> (level * SLOT_BITS)) & SLOT_MASK);
+
+  timer_id id = heads_[slot];
+  heads_[slot] = NONE;
+  occupied_[level] &= ~(std::uint64_t{1} << (slot % SLOTS));
+
+  while (NONE != id) {
+    const timer_id next = entries_[id].next;
+    insert(id);
+    id = next;
+  }
+}
+
+long nanonet::util::timer_wheel::expire(
+    double const now, expiry_handler const& h) {
+  const double t = std::floor((now - origin_) / resolution_);
+  if (t < 0) {
+    return 0;
+  }
+  const std::uint64_t target = static_cast<std::uint64_t>(t);
+
+  fired_.clear();
+  while (current_ <= target) {
+    if (0 == armed_) {
+      current_ = target + 1;
+      break;
+    }
+
+    // Crossing a boundary of level 0, then possibly of higher levels
+    if (0 == (current_ & SLOT_MASK)) {
+      for (int level = 1; level < LEVELS; ++level) {
+        cascade(level);
+        if (current_ & ((std::uint64_t{1} << ((level + 1) * SLOT_BITS)) - 1)) {
+          break;
+        }
+      }
+    }
+
+    // Skip empty slots up to the next boundary
+    const std::uint64_t pending = occupied_[0] >> (current_ & SLOT_MASK);
+    if (0 == pending) {
+      current_ = std::min(target, current_ | SLOT_MASK) + 1;
+      continue;
+    }
+    const std::uint64_t next = current_ + std::countr_zero(pending);
+    if (next > target) {
+      current_ = target + 1;
+      break;
+    }
+    current_ = next;
+
+    const int slot = static_cast<int>(current_ & SLOT_MASK);
+    timer_id id = heads_[slot];
+    heads_[slot] = NONE;
+    occupied_[0] &= ~(std::uint64_t{1} << slot);
+
+    // Level 0 slots only contain timers due at exactly this tick
+    while (NONE != id) {
+      entry& e = entries_[id];
+      const timer_id next = e.next;
+      e.slot = FIRED;
+      e.prev = e.next = NONE;
+      --armed_;
+      fired_.push_back(id);
+      id = next;
+    }
+    ++current_;
+  }
+
+  // Timers may be disarmed, removed or rearmed by the handler
+  long ret = 0;
+  for (std::size_t i = 0; i < fired_.size(); ++i) {
+    const timer_id id = fired_[i];
+    if (FIRED != entries_[id].slot) {
+      continue;
+    }
+    entries_[id].slot = DISARMED;
+    ++ret;
+    h(id, entries_[id].user_data);
+  }
+  return ret;
+}
+
+double nanonet::util::timer_wheel::next_expiry() const {
+  if (0 == armed_) {
+    return std::numeric_limits<double>::infinity();
+  }
+  const std::uint64_t pending = occupied_[0] >> (current_ & SLOT_MASK);
+  const std::uint64_t tick = pending
+      ? current_ + std::countr_zero(pending)
+      : (current_ | SLOT_MASK) + 1;
+  return origin_ + tick * resolution_;
+}
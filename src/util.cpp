@@ -23,6 +23,8 @@
 #include "nanonet/detail/platform_wrappers.h"
 #include "nanonet/sys/syslogger.h"
 
+#include <algorithm>
+#include <bit>
 #include <chrono>
 #include <codecvt>
 #include <iomanip>
@@ -41,6 +43,10 @@
 #include <cstring>
 #include <ctime>
 
+#if defined( __SSE2__ )
+#  include <immintrin.h>
+#endif
+
 
 using namespace nanonet::util ;
 
@@ -68,6 +74,69 @@ std::string to_string(std::wstring const& s) {
   return conv.to_bytes(s);
 }
 
+// Public access to the get area of any std::streambuf, through
+// pointers to its protected members
+struct get_area : std::streambuf {
+  static char* begin( std::streambuf* const sb )
+  { return ( sb->*&get_area::gptr )() ; }
+  static char* end( std::streambuf* const sb )
+  { return ( sb->*&get_area::egptr )() ; }
+  static void consume( std::streambuf* const sb , long const n )
+  { ( sb->*&get_area::gbump )( static_cast< int >( n ) ) ; }
+} ;
+
+char const* find_char_memchr( 
+    char const* const p , char const c , long const n ) {
+  return static_cast< char const* >( std::memchr( p , c , n ) ) ;
+}
+
+#if defined( __SSE2__ )
+char const* find_char_sse2( 
+    char const* const p , char const c , long const n ) {
+  __m128i const needle = _mm_set1_epi8( c ) ;
+  long i = 0 ;
+  for( ; i + 16 <= n ; i += 16 ) {
+    __m128i const chunk = 
+      _mm_loadu_si128( reinterpret_cast< __m128i const* >( p + i ) ) ;
+    unsigned const mask = 
+      _mm_movemask_epi8( _mm_cmpeq_epi8( chunk , needle ) ) ;
+    if( mask ) { return p + i + std::countr_zero( mask ) ; }
+  }
+  return find_char_memchr( p + i , c , n - i ) ;
+}
+#endif
+
+#if defined( __x86_64__ ) && defined( __GNUC__ )
+__attribute__(( target( "avx2" ) ))
+char const* find_char_avx2( 
+    char const* const p , char const c , long const n ) {
+  __m256i const needle = _mm256_set1_epi8( c ) ;
+  long i = 0 ;
+  for( ; i + 32 <= n ; i += 32 ) {
+    __m256i const chunk = 
+      _mm256_loadu_si256( reinterpret_cast< __m256i const* >( p + i ) ) ;
+    unsigned const mask = 
+      _mm256_movemask_epi8( _mm256_cmpeq_epi8( chunk , needle ) ) ;
+    if( mask ) { return p + i + std::countr_zero( mask ) ; }
+  }
+  return find_char_sse2( p + i , c , n - i ) ;
+}
+#endif
+
+// Chosen according to the CPU
+using find_char_function = char const* ( * )( char const* , char , long ) ;
+
+find_char_function select_find_char() {
+#if defined( __x86_64__ ) && defined( __GNUC__ )
+  __builtin_cpu_init() ;
+  return __builtin_cpu_supports( "avx2" ) ? find_char_avx2 : find_char_sse2 ;
+#elif defined( __SSE2__ )
+  return find_char_sse2 ;
+#else
+  return find_char_memchr ;
+#endif
+}
+
 } // anonymous namespace
 
 
@@ -89,22 +158,41 @@ std::istream& nanonet::util::getline(
   s.clear() ;
   s.reserve( size_hint ) ;
 
-  std::istreambuf_iterator< char > it( is ) ;
-  std::istreambuf_iterator< char > const eos ;
+  std::streambuf* const sb = is.rdbuf() ;
 
   long i = 0 ;
 
   while( i < maxsize ) {
-    if ( eos == it ) {
+    char const* const begin = get_area::begin( sb ) ;
+    long const n = std::min( 
+        get_area::end( sb ) - begin , 
+        std::min( maxsize - i , 
+                  static_cast< long >( std::numeric_limits< int >::max() ) ) ) ;
+
+    if( n > 0 ) {
+      char const* const nl = find_char( begin , '\n' , n ) ;
+      if( nl ) {
+        s.append( begin , nl ) ;
+        get_area::consume( sb , nl - begin + 1 ) ;
+        return is ;
+      }
+      s.append( begin , n ) ;
+      get_area::consume( sb , n ) ;
+      i += n ;
+      continue ;
+    }
+
+    // Empty get area:  Refill, or character-wise for unbuffered
+    // streams
+    std::streambuf::int_type const c = sb->sbumpc() ;
+    if ( std::streambuf::traits_type::eof() == c ) {
       is.setstate( std::ios_base::failbit | std::ios_base::eofbit ) ;
       return is ;
     }
-    char const c = *it ;
-    ++it ;
     if( '\n' == c ) {
       return is ;
     } else {
-      s.push_back( c ) ;
+      s.push_back( std::streambuf::traits_type::to_char_type( c ) ) ;
       ++i ;
     }
   }
@@ -112,11 +200,17 @@ std::istream& nanonet::util::getline(
   return is ;
 }
 
+char const* nanonet::util::find_char(
+    char const* const p , char const c , long const n ) {
+  static find_char_function const impl = select_find_char() ;
+  return impl( p , c , n ) ;
+}
+
 std::string nanonet::util::trim(const std::string& s) {
   auto ret = s;
   ret.erase(0, ret.find_first_not_of(" \n\r\t"));
   ret.erase(ret.find_last_not_of(" \n\r\t") + 1);
-  return s;
+  return ret;
 }
 
 std::vector<std::string> nanonet::util::split(std::string const& str, char const sep) {